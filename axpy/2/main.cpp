@@ -6,6 +6,7 @@
 #include <chrono>
 #include <iomanip>
 #include <omp.h>
+#include <cmath>
 
 const char* saxpy_kernel = 
 "__kernel void saxpy(int n, float a, __global float* x, int incx, __global float* y, int incy){										\n" \
@@ -21,6 +22,33 @@ const char* daxpy_kernel =
 "	y[index * incy] += a * x[index * incx];																								\n" \
 "}}";
 
+// double emulated with float pairs hi + lo (about 48 bits) for devices with slow or no fp64
+const char* dfaxpy_kernel =
+"inline float2 quick_two_sum(float a, float b) {\n" \
+"	const float s = a + b;\n" \
+"	return (float2)(s, b - (s - a));\n" \
+"}\n" \
+"inline float2 two_sum(float a, float b) {\n" \
+"	const float s = a + b;\n" \
+"	const float bb = s - a;\n" \
+"	return (float2)(s, (a - (s - bb)) + (b - bb));\n" \
+"}\n" \
+"inline float2 df_add(float2 a, float2 b) {\n" \
+"	float2 s = two_sum(a.x, b.x);\n" \
+"	const float2 t = two_sum(a.y, b.y);\n" \
+"	s = quick_two_sum(s.x, s.y + t.x);\n" \
+"	return quick_two_sum(s.x, s.y + t.y);\n" \
+"}\n" \
+"inline float2 df_mul(float2 a, float2 b) {\n" \
+"	const float p = a.x * b.x;\n" \
+"	return quick_two_sum(p, fma(a.x, b.x, -p) + (a.x * b.y + a.y * b.x));\n" \
+"}\n" \
+"__kernel void dfaxpy(int n, float2 a, __global float2* x, int incx, __global float2* y, int incy){\n" \
+"int index = get_global_id(0);\n" \
+"if (index < n) {\n" \
+"	y[index * incy] = df_add(y[index * incy], df_mul(a, x[index * incx]));\n" \
+"}}";
+
 
 double saxpy_cpu(int n, float a, float* x, int incx, float* y, int incy) {
 	double start = omp_get_wtime();
@@ -129,6 +157,35 @@ double run_opencl_kernel(cl_device_id& device, const char* source, const char* k
 }
 
 
+cl_float2 split_double(double x) {
+	cl_float2 split;
+	split.s[0] = (float)x;
+	split.s[1] = (float)(x - split.s[0]);
+	return split;
+}
+
+// daxpy through dfaxpy_kernel: x and y go to the device as float pairs and y comes back joined
+double dfaxpy_opencl(cl_device_id& device, int n, double a, double* x, int incx, double* y, int incy, size_t group = 16) {
+	std::vector<cl_float2> x_split(n), y_split(n);
+	for (int i = 0; i < n; i++) {
+		x_split[i] = split_double(x[i]);
+		y_split[i] = split_double(y[i]);
+	}
+	double time = run_opencl_kernel(device, dfaxpy_kernel, "dfaxpy", n, split_double(a), x_split.data(), incx, y_split.data(), incy, group);
+	for (int i = 0; i < n; i++) y[i] = (double)y_split[i].s[0] + y_split[i].s[1];
+	return time;
+}
+
+// emulated double keeps about 48 bits, 2^-48 is 3.6e-15
+void check_split(std::vector<double> & a, std::vector<double> & b){
+	for(int i = 0;i < a.size();++i){
+		if (std::fabs(a[i] - b[i]) > 1e-13 * std::fabs(a[i])) {
+			std::cout << std::fabs(a[i] - b[i]) << '\n';
+			exit(1);
+		}
+	}
+}
+
 template<typename T>
 void generator(std::vector<T> & a, int & n, T & A, bool generate_len){
 	// std::mt19937 gen(std::chrono::high_resolution_clock::now().time_since_epoch().count());
@@ -207,6 +264,18 @@ void test_precision(){
 				check(true_y, y);
 				std::cout << "test opencl double #" << test << " done\n";
 			}
+			for (int test = 0; test < tests; ++test) {
+				std::vector<double> x;
+				int len;
+				double a;
+				generator(x, len, a, true);
+				std::vector<double> true_y(len, 0), y(len, 0);
+
+				daxpy_cpu(len, a, x.data(), 1, true_y.data(), 1);
+				double opencl_time = dfaxpy_opencl(devices[j], len, a, x.data(), 1, y.data(), 1);
+				check_split(true_y, y);
+				std::cout << "test opencl double-float #" << test << " done\n";
+			}
 		}
 	}
 
@@ -287,6 +356,17 @@ void performance(){
 					std::cout << "double n " << len << " group " << group << " time " << std::fixed << std::setprecision(20) << opencl_time << '\n';
 				}
 			}
+			for (size_t group = 8; group <= 256; group <<= 1) {
+				for (int len = start_len; len < finish_len; len += step_len) {
+					std::vector<double> x;
+					double a;
+					generator(x, len, a, false);
+					std::vector<double> y(len, 0);
+
+					double opencl_time = dfaxpy_opencl(devices[j], len, a, x.data(), 1, y.data(), 1);
+					std::cout << "double-float n " << len << " group " << group << " time " << std::fixed << std::setprecision(20) << opencl_time << '\n';
+				}
+			}
 		}
 	}
 	std::cout << "OpenMP\n";
@@ -0,0 +1,56 @@
+#define BLOCK_SIZE 16
+
+// Double precision emulated with floats: a value is the unevaluated sum x + y of a float2, about
+// 48 significant bits from fp32 instructions only, for devices with slow or no fp64.
+
+// s + e == a + b exactly, needs |a| >= |b|
+inline float2 quick_two_sum(float a, float b) {
+	const float s = a + b;
+	return (float2)(s, b - (s - a));
+}
+
+// s + e == a + b exactly
+inline float2 two_sum(float a, float b) {
+	const float s = a + b;
+	const float bb = s - a;
+	return (float2)(s, (a - (s - bb)) + (b - bb));
+}
+
+inline float2 df_add(float2 a, float2 b) {
+	float2 s = two_sum(a.x, b.x);
+	const float2 t = two_sum(a.y, b.y);
+	s = quick_two_sum(s.x, s.y + t.x);
+	return quick_two_sum(s.x, s.y + t.y);
+}
+
+// the low part of a.x * b.x comes exactly from fma
+inline float2 df_mul(float2 a, float2 b) {
+	const float p = a.x * b.x;
+	return quick_two_sum(p, fma(a.x, b.x, -p) + (a.x * b.y + a.y * b.x));
+}
+
+__kernel void gemmSplitBlock(int n, int m, int k, __global const float2* a, __global const float2* b, __global float2* c) {
+	__local float2 A[BLOCK_SIZE][BLOCK_SIZE];
+	__local float2 B[BLOCK_SIZE][BLOCK_SIZE];
+
+	int local_row = get_local_id(1);
+	int local_col = get_local_id(0);
+
+	int global_row = get_global_id(1);
+	int global_col = get_global_id(0);
+
+	float2 res = (float2)(0.0f, 0.0f);
+	int nBlocks = m / BLOCK_SIZE;
+	for (int iBlock = 0; iBlock < nBlocks; iBlock++) {
+		int block_col = iBlock * BLOCK_SIZE + local_col;
+		int block_row = iBlock * BLOCK_SIZE + local_row;
+		A[local_row][local_col] = a[global_row * m + block_col];
+		B[local_row][local_col] = b[block_row * k + global_col];
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for(int i = 0;i < BLOCK_SIZE;i++){
+			res = df_add(res, df_mul(A[local_row][i], B[i][local_col]));
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	c[global_row * k + global_col] = res;
+}
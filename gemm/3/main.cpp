@@ -66,8 +66,41 @@ void clear_matrix(int n, int m, T* matrix){
 	for (int i = 0; i < n * m; i++) matrix[i] = T(0);
 }
 
+// emulated double carries about 48 bits: the mean error relative to the mean |c| stays near 2^-48
+bool check_gemm_split(int n, int k, const double* reference, const double* c) {
+	double error = 0, size = 0;
+	for (int i = 0; i < n * k; i++) {
+		error += std::abs(reference[i] - c[i]);
+		size += std::abs(reference[i]);
+	}
+	std::cout << "relative error = \t\t" << error / size << '\n';
+	if (error > size * 1e-12) {
+		exit(1);
+	}
+	return 1;
+}
+
 int n = 16 * 100, m = 16 * 100, k = 16 * 100;
 
+void compare_split(float* a, float* b, const float* reference) {}
+
+// Double GEMM on every device, as float pairs or native as the probe picks, checked against the
+// OpenMP double result
+void compare_split(double* a, double* b, const double* reference) {
+	std::cout << "\nEMULATED DOUBLE\n******************************************************************\n";
+	const int platforms[3] = { 0, 2, 1 };
+	const char* devices[3] = { "hd", "cpu", "gpu" };
+	double* c = new double[n * k];
+	for (int d = 0; d < 3; d++) {
+		bool split;
+		clear_matrix(n, k, c);
+		auto time = opencl_gemm_fp64(platforms[d], n, m, k, a, b, c, split);
+		std::cout << (split ? "opencl gemm split " : "opencl gemm native ") << devices[d] << " = \t" << time << '\n';
+		check_gemm_split(n, k, reference, c);
+	}
+	delete[] c;
+}
+
 template<typename T>
 void lets_go(const char * message){
 	std::cout << message << '\n';
@@ -182,6 +215,7 @@ void lets_go(const char * message){
 		std::cout << "opencl gemm image gpu = \t" << opencl_gpu_image_time << '\n';
 		check_gemm(n, k, c_omp_block_1, c_opencl_gpu_image);
 	}
+	compare_split(a, b, c_omp_block_1);
 	std::cout << "******************************************************************\n";
 }
 
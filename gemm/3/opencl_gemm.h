@@ -1,8 +1,12 @@
 ﻿#include <CL/cl.h>
 #include <istream>
 #include <fstream>
+#include <vector>
+#include <map>
 
 #define BLOCK_SIZE 16
+// matrices of the native / emulated double probe
+#define PROBE_SIZE 256
 
 void initialize(int platform_index, cl_device_id& device){
 	cl_platform_id* platforms = new cl_platform_id[3];
@@ -193,4 +197,59 @@ double opencl_gemm_image(int platform_index, int n, int m, int k, T* a, T* b, T*
 	clReleaseCommandQueue(command_queue);
 	clReleaseContext(context);
 	return time;
+}
+
+// double as a float pair hi + lo, lo is the rounding error of hi
+void split_double(size_t count, const double* x, cl_float2* split) {
+	for (size_t i = 0; i < count; i++) {
+		split[i].s[0] = (float)x[i];
+		split[i].s[1] = (float)(x[i] - split[i].s[0]);
+	}
+}
+
+void join_double(size_t count, const cl_float2* split, double* x) {
+	for (size_t i = 0; i < count; i++) x[i] = (double)split[i].s[0] + split[i].s[1];
+}
+
+// Double GEMM with fp32 instructions only: a, b and c go to the device as float pairs
+// (gemm_block_split.cl), about 48 bits of the 53 of a double survive.
+double opencl_gemm_split(int platform_index, int n, int m, int k, const double* a, const double* b, double* c, char* filename, char* kernelname) {
+	std::vector<cl_float2> a_split((size_t)n * m), b_split((size_t)m * k), c_split((size_t)n * k);
+	split_double(a_split.size(), a, a_split.data());
+	split_double(b_split.size(), b, b_split.data());
+	double time = opencl_gemm(platform_index, n, m, k, a_split.data(), b_split.data(), c_split.data(), filename, kernelname);
+	join_double(c_split.size(), c_split.data(), c);
+	return time;
+}
+
+// Native or emulated double for the device of platform_index: emulated when it has no fp64 at all,
+// otherwise both block kernels multiply PROBE_SIZE matrices and the faster one is taken.
+// The probe runs once per platform.
+bool prefer_split(int platform_index) {
+	static std::map<int, bool> decided;
+	auto found = decided.find(platform_index);
+	if (found != decided.end()) return found->second;
+
+	cl_device_id device;
+	initialize(platform_index, device);
+	cl_device_fp_config fp64 = 0;
+	clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64), &fp64, nullptr);
+	bool split = true;
+	if (fp64 != 0) {
+		std::vector<double> a(PROBE_SIZE * PROBE_SIZE, 1.0 / 3), c(PROBE_SIZE * PROBE_SIZE);
+		double native = opencl_gemm(platform_index, PROBE_SIZE, PROBE_SIZE, PROBE_SIZE, a.data(), a.data(), c.data(), (char*)"gemm_block_double.cl", (char*)"gemmDoubleBlock");
+		double emulated = opencl_gemm_split(platform_index, PROBE_SIZE, PROBE_SIZE, PROBE_SIZE, a.data(), a.data(), c.data(), (char*)"gemm_block_split.cl", (char*)"gemmSplitBlock");
+		std::cout << "probe: native double " << native << ", emulated " << emulated << '\n';
+		split = emulated < native;
+	}
+	decided[platform_index] = split;
+	return split;
+}
+
+// Double GEMM on the device of platform_index by what prefer_split picked for it: the float pair
+// kernel or the native gemmDoubleBlock. split tells which one ran.
+double opencl_gemm_fp64(int platform_index, int n, int m, int k, double* a, double* b, double* c, bool& split) {
+	split = prefer_split(platform_index);
+	if (split) return opencl_gemm_split(platform_index, n, m, k, a, b, c, (char*)"gemm_block_split.cl", (char*)"gemmSplitBlock");
+	return opencl_gemm(platform_index, n, m, k, a, b, c, (char*)"gemm_block_double.cl", (char*)"gemmDoubleBlock");
 }
\ No newline at end of file
@@ -4,7 +4,9 @@
 #include <random>
 #include <chrono>
 #include "opencl_gemm.h"
+#include "partition_calibration.h"
 #include <cassert>
+#include <vector>
 
 //[n * m] X [m * k] = [n * k]
 std::mt19937 gen(std::chrono::high_resolution_clock::now().time_since_epoch().count());
@@ -93,7 +95,8 @@ void lets_go(const char * message){
 	T* c_opencl_gpu = new T[n * k];
 	T* c_opencl_cpu_gpu = new T[n * k];
 
-	double cpu_time, gpu_time, cpu_gpu_time;
+	double cpu_time, gpu_time, cpu_gpu_time, partition;
+	int rows_done[2];
 	/*auto seq_time = stupid_gemm(n, m, k, a, b, c_seq);
 	std::cout << "sequential gemm = \t\t" << seq_time << '\n';*/
 
@@ -110,6 +113,15 @@ void lets_go(const char * message){
 	cpu_gpu_time = opencl_gemm(2, 1, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname, 0.0025);
 	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
 	std::cout << "0.0025 * cpu & 0.9975 * gpu = \t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	cpu_gpu_time = opencl_gemm_dynamic(2, 1, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname, rows_done);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "dynamic: " << rows_done[0] << " cpu & " << rows_done[1] << " gpu rows = \t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	partition = calibrate_partition(2, 1, n, m, k, a, b, filename, kernelname);
+	cpu_gpu_time = opencl_gemm(2, 1, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname, partition);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "calibrated: " << partition << " * cpu & " << 1 - partition << " * gpu = \t" << cpu_gpu_time << '\n';
 
 
 	std::cout << "\nIntel(R) Core(TM) i5-7500 VS Intel(R) HD Graphics 630: standart version\n******************************************************************\n";
@@ -125,6 +137,15 @@ void lets_go(const char * message){
 	cpu_gpu_time = opencl_gemm(2, 0, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname, 0.0025);
 	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
 	std::cout << "0.0025 * cpu & 0.9975 * gpu = \t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	cpu_gpu_time = opencl_gemm_dynamic(2, 0, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname, rows_done);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "dynamic: " << rows_done[0] << " cpu & " << rows_done[1] << " gpu rows = \t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	partition = calibrate_partition(2, 0, n, m, k, a, b, filename, kernelname);
+	cpu_gpu_time = opencl_gemm(2, 0, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname, partition);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "calibrated: " << partition << " * cpu & " << 1 - partition << " * gpu = \t" << cpu_gpu_time << '\n';
 
 
 
@@ -141,6 +162,15 @@ void lets_go(const char * message){
 	cpu_gpu_time = opencl_gemm(2, 1, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname_block, 0.0025);
 	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
 	std::cout << "0.0025 * cpu & 0.9975 * gpu = \t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	cpu_gpu_time = opencl_gemm_dynamic(2, 1, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname_block, rows_done);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "dynamic: " << rows_done[0] << " cpu & " << rows_done[1] << " gpu rows = \t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	partition = calibrate_partition(2, 1, n, m, k, a, b, filename, kernelname_block);
+	cpu_gpu_time = opencl_gemm(2, 1, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname_block, partition);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "calibrated: " << partition << " * cpu & " << 1 - partition << " * gpu = \t" << cpu_gpu_time << '\n';
 
 	std::cout << "\nIntel(R) Core(TM) i5-7500 VS Intel(R) HD Graphics 630: block version\n******************************************************************\n";
 	generate_matrix(a, b, n, m, k);
@@ -154,7 +184,38 @@ void lets_go(const char * message){
 	generate_matrix(a, b, n, m, k);
 	cpu_gpu_time = opencl_gemm(2, 0, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname_block, 0.9975);
 	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
-	std::cout << "0.9975 * cpu & 0.0025 * gpu = \t" << cpu_gpu_time << "\n\n";
+	std::cout << "0.9975 * cpu & 0.0025 * gpu = \t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	cpu_gpu_time = opencl_gemm_dynamic(2, 0, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname_block, rows_done);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "dynamic: " << rows_done[0] << " cpu & " << rows_done[1] << " gpu rows = \t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	partition = calibrate_partition(2, 0, n, m, k, a, b, filename, kernelname_block);
+	cpu_gpu_time = opencl_gemm(2, 0, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname_block, partition);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "calibrated: " << partition << " * cpu & " << 1 - partition << " * gpu = \t" << cpu_gpu_time << '\n';
+
+	std::cout << "\nAll devices: block version\n******************************************************************\n";
+	std::vector<cl_device_id> devices = enumerate_devices();
+	std::vector<int> device_rows(devices.size());
+	generate_matrix(a, b, n, m, k);
+	std::vector<device_share> shares = calibrate_shares(devices, n, m, k, a, b, filename, kernelname_block);
+	cpu_gpu_time = opencl_gemm(shares, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname_block);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "calibrated " << devices.size() << " devices = \t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	cpu_gpu_time = opencl_gemm_shared(shares, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname_block);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "shared contexts = \t\t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	int grid_rows;
+	cpu_gpu_time = opencl_gemm_2d(shares, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname_block, &grid_rows);
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "2d " << grid_rows << " x " << devices.size() / grid_rows << " grid = \t\t" << cpu_gpu_time << '\n';
+	generate_matrix(a, b, n, m, k);
+	cpu_gpu_time = opencl_gemm_dynamic(devices, n, m, k, a, b, c_opencl_cpu_gpu, filename, kernelname_block, device_rows.data());
+	// check_gemm(n, k, c_seq, c_opencl_cpu_gpu);
+	std::cout << "dynamic " << devices.size() << " devices = \t" << cpu_gpu_time << "\n\n";
 
 }
 
@@ -1,6 +1,11 @@
-﻿#include <CL/cl.h>
+﻿#pragma once
+#include <CL/cl.h>
 #include <istream>
 #include <fstream>
+#include <algorithm>
+#include <vector>
+#include <cassert>
+#include <omp.h>
 
 #define BLOCK_SIZE 16
 
@@ -11,15 +16,72 @@ void get_device_name(cl_device_id& device) {
 }
 
 void initialize(int platform_index, cl_device_id& device){
-	cl_platform_id* platforms = new cl_platform_id[3];
-	clGetPlatformIDs(3, platforms, nullptr);
+	cl_uint platform_count = 0;
+	clGetPlatformIDs(0, nullptr, &platform_count);
+	std::vector<cl_platform_id> platforms(platform_count);
+	clGetPlatformIDs(platform_count, platforms.data(), nullptr);
 
-	cl_device_id* devices = new cl_device_id[1];
-	clGetDeviceIDs(platforms[platform_index], CL_DEVICE_TYPE_ALL, 1, devices, nullptr);
-	device = devices[0];
+	clGetDeviceIDs(platforms[platform_index], CL_DEVICE_TYPE_ALL, 1, &device, nullptr);
 	get_device_name(device);
 }
 
+// Every device of every platform, in platform order.
+std::vector<cl_device_id> enumerate_devices() {
+	cl_uint platform_count = 0;
+	clGetPlatformIDs(0, nullptr, &platform_count);
+	std::vector<cl_platform_id> platforms(platform_count);
+	clGetPlatformIDs(platform_count, platforms.data(), nullptr);
+
+	std::vector<cl_device_id> devices;
+	for (cl_uint i = 0; i < platform_count; i++) {
+		cl_uint device_count = 0;
+		clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 0, nullptr, &device_count);
+		std::vector<cl_device_id> platform_devices(device_count);
+		clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, device_count, platform_devices.data(), nullptr);
+		devices.insert(devices.end(), platform_devices.begin(), platform_devices.end());
+	}
+	return devices;
+}
+
+// A device of the heterogeneous executor and its relative share of the rows.
+struct device_share {
+	cl_device_id device;
+	double weight;
+};
+
+// Splits length into BLOCK_SIZE aligned parts proportional to the weights.
+std::vector<int> split_length(int length, const std::vector<double>& weights) {
+	int blocks = length / BLOCK_SIZE;
+	double total = 0;
+	for (double w : weights) total += w;
+
+	std::vector<int> parts(weights.size(), 0);
+	std::vector<double> rest(weights.size());
+	if (total <= 0) return parts;
+	int given = 0;
+	for (size_t i = 0; i < weights.size(); i++) {
+		double share = blocks * weights[i] / total;
+		parts[i] = (int)share;
+		rest[i] = share - parts[i];
+		given += parts[i];
+	}
+	// the largest remainders get the leftover blocks
+	while (given < blocks) {
+		size_t i = std::max_element(rest.begin(), rest.end()) - rest.begin();
+		parts[i]++;
+		rest[i] = -1;
+		given++;
+	}
+	for (int& p : parts) p *= BLOCK_SIZE;
+	return parts;
+}
+
+std::vector<int> split_rows(int n, const std::vector<device_share>& devices) {
+	std::vector<double> weights;
+	for (const device_share& d : devices) weights.push_back(d.weight);
+	return split_length(n, weights);
+}
+
 std::string read_kernel(char* filename){
 	std::ifstream is(filename);
 	std::string ans, tmp;
@@ -53,7 +115,12 @@ struct opencl_env {
 		cl_mem _memB,
 		cl_mem _memC
 	) : context(_context), queue(_queue), program(_program), kernel(_kernel), memObjA(_memA), memObjB(_memB), memObjC(_memC) {}
+	opencl_env(opencl_env&& other) noexcept
+		: context(other.context), queue(other.queue), program(other.program), kernel(other.kernel), memObjA(other.memObjA), memObjB(other.memObjB), memObjC(other.memObjC) {
+		other.context = nullptr;
+	}
 	~opencl_env(){
+		if (context == nullptr) return;
 		clReleaseMemObject(memObjA);
 		clReleaseMemObject(memObjB);
 		clReleaseMemObject(memObjC);
@@ -66,7 +133,7 @@ struct opencl_env {
 
 template<typename T>
 opencl_env create_env(
-		int platform_index,
+		cl_device_id device,
 		int n,
 		int m,
 		int k,
@@ -74,8 +141,6 @@ opencl_env create_env(
 		T* b,
 		char* filename,
 		char* kernelname){
-	cl_device_id device;
-	initialize(platform_index, device);
 	std::string kernel_code = read_kernel(filename);
 	size_t kernel_len = kernel_code.size();
 
@@ -124,6 +189,75 @@ opencl_env create_env(
 	return opencl_env(context, command_queue, program, kernel, memObjA, memObjB, memObjC);
 }
 
+template<typename T>
+opencl_env create_env(
+		int platform_index,
+		int n,
+		int m,
+		int k,
+		T* a,
+		T* b,
+		char* filename,
+		char* kernelname){
+	cl_device_id device;
+	initialize(platform_index, device);
+	return create_env(device, n, m, k, a, b, filename, kernelname);
+}
+
+// Splits the rows of A between the devices by their weights and runs them concurrently.
+// Returns the sum of the kernel times.
+template<typename T>
+double opencl_gemm(
+		const std::vector<device_share>& devices,
+		int n,
+		int m,
+		int k,
+		T* a,
+		T* b,
+		T* c,
+		char* filename,
+		char* kernelname) {
+	if (n % BLOCK_SIZE != 0){
+		std::cout << "wrong size of matrices\n";
+		exit(1);
+	}
+	std::vector<int> rows = split_rows(n, devices);
+	std::vector<int> first_row, env_rows;
+	std::vector<opencl_env> envs;
+	envs.reserve(devices.size());
+	int row = 0;
+	for (size_t i = 0; i < devices.size(); row += rows[i], i++) {
+		if (rows[i] == 0) continue;
+		envs.push_back(create_env(devices[i].device, rows[i], m, k, &a[row * m], b, filename, kernelname));
+		first_row.push_back(row);
+		env_rows.push_back(rows[i]);
+	}
+
+	size_t group_size[2] = { BLOCK_SIZE, BLOCK_SIZE };
+	std::vector<cl_event> events(envs.size());
+	cl_int ret;
+	for (size_t i = 0; i < envs.size(); i++) {
+		size_t global_work_size[2] = { k, env_rows[i] };
+		ret = clEnqueueNDRangeKernel(envs[i].queue, envs[i].kernel, 2, nullptr, global_work_size, group_size, 0, nullptr, &events[i]);
+		check_ret(ret, "clEnqueueNDRangeKernel");
+	}
+
+	double time = 0;
+	cl_ulong time_start;
+	cl_ulong time_end;
+	for (size_t i = 0; i < envs.size(); i++) {
+		clWaitForEvents(1, &events[i]);
+		ret = clEnqueueReadBuffer(envs[i].queue, envs[i].memObjC, CL_TRUE, 0, sizeof(T) * env_rows[i] * k, &c[first_row[i] * k], 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueReadBuffer");
+
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+		time += (time_end - time_start) / 1e9;
+		clReleaseEvent(events[i]);
+	}
+	return time;
+}
+
 template<typename T>
 double opencl_gemm(
 		int cpu_platform_index,
@@ -137,82 +271,603 @@ double opencl_gemm(
 		char* filename,
 		char* kernelname,
 		double partition) {
-	int cpu_n = n * partition;
+	int cpu_n = (int)(n * partition + 0.5);
 	int gpu_n = n - cpu_n;
 
 	if (cpu_n % BLOCK_SIZE != 0 || gpu_n % BLOCK_SIZE != 0){
 		std::cout << "wrong size of matrices\n";
 		exit(1);
 	}
-	size_t cpu_global_work_size[2] = { k, cpu_n };
-	size_t gpu_global_work_size[2] = { k, gpu_n };
-	size_t group_size[2] = { BLOCK_SIZE, BLOCK_SIZE };
+	cl_device_id cpu, gpu;
+	initialize(cpu_platform_index, cpu);
+	initialize(gpu_platform_index, gpu);
+	std::vector<device_share> devices = { { cpu, (double)cpu_n }, { gpu, (double)gpu_n } };
+	return opencl_gemm(devices, n, m, k, a, b, c, filename, kernelname);
+}
+
+template<typename T>
+opencl_env create_panel_env(
+		cl_device_id device,
+		int panel_n,
+		int m,
+		int k,
+		T* b,
+		char* filename,
+		char* kernelname) {
+	std::string kernel_code = read_kernel(filename);
+	size_t kernel_len = kernel_code.size();
+
 	cl_int ret;
+	// Create context
+	cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &ret);
+	check_ret(ret, "clCreateContext");
+	cl_queue_properties props[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
+	// Create queue
+	cl_command_queue command_queue = clCreateCommandQueueWithProperties(context, device, props, &ret);
+	check_ret(ret, "clCreateCommandQueueWithProperties");
+	// Create program
+	cl_program program = clCreateProgramWithSource(context, 1, (const char**)&kernel_code, &kernel_len, &ret);
+	check_ret(ret, "clCreateProgramWithSource");
+	// Build
+	ret = clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr);
+	check_ret(ret, "clBuildProgram");
+	// Create kernel
+	cl_kernel kernel = clCreateKernel(program, kernelname, &ret);
+	check_ret(ret, "clCreateKernel");
+	// Create buffer: A and C hold one panel of rows, B stays resident for the whole run
+	cl_mem memObjA = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(T) * panel_n * m, nullptr, &ret);
+	check_ret(ret, "create buffer A");
+	cl_mem memObjB = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(T) * m * k, nullptr, &ret);
+	check_ret(ret, "create buffer B");
+	cl_mem memObjC = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(T) * panel_n * k, nullptr, &ret);
+	check_ret(ret, "create buffer C");
+	// Write buffer
+	ret = clEnqueueWriteBuffer(command_queue, memObjB, CL_TRUE, 0, sizeof(T) * m * k, b, 0, nullptr, nullptr);
+	check_ret(ret, "EnqueueWriteBuffer B");
+	// Set kernel Args (arg 0 is set for every panel)
+	ret = clSetKernelArg(kernel, 1, sizeof(int), &m);
+	check_ret(ret, "set kernel arg 1");
+	ret = clSetKernelArg(kernel, 2, sizeof(int), &k);
+	check_ret(ret, "set kernel arg 2");
+	ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &memObjA);
+	check_ret(ret, "set kernel arg 3");
+	ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &memObjB);
+	check_ret(ret, "set kernel arg 4");
+	ret = clSetKernelArg(kernel, 5, sizeof(cl_mem), &memObjC);
+	check_ret(ret, "set kernel arg 5");
+	return opencl_env(context, command_queue, program, kernel, memObjA, memObjB, memObjC);
+}
 
-	if (gpu_n == 0){
-		opencl_env cpu_env = create_env(cpu_platform_index, cpu_n, m, k, a, b, filename, kernelname);
-		cl_event cpu_event;
-		ret = clEnqueueNDRangeKernel(cpu_env.queue, cpu_env.kernel, 2, nullptr, cpu_global_work_size, group_size, 0, nullptr, &cpu_event);
-		clWaitForEvents(1, &cpu_event);
-		clFinish(cpu_env.queue);
-		ret = clEnqueueReadBuffer(cpu_env.queue, cpu_env.memObjC, CL_TRUE, 0, sizeof(T) * cpu_n * k, c, 0, nullptr, nullptr);
-		cl_ulong time_start;
-		cl_ulong time_end;
+// Shared queue of row panels of C for the dynamic scheduler.
+// Rows [next_row, n) are not taken yet; rate[i] is the measured speed of device i
+// in rows per second (0 until its first panel is done), active[i] is 0 once device i stopped.
+struct panel_queue {
+	int n;
+	int next_row;
+	int min_chunk;
+	int max_chunk;
+	int devices;
+	double* rate;
+	int* active;
+};
+
+// Takes the next panel for the device. Returns its height (0 when the device should stop).
+// While some device is still unmeasured everyone gets min_chunk rows. After that the chunk is
+// guided: half of the remaining rows scaled by the device's share of the total speed, so the
+// panels shrink towards the end. A device also stops when the fastest other active device would
+// finish all the remaining rows before it finishes its own panel; the rates of stopped devices
+// are stale and do not count, and the last active device never stops while rows remain.
+int next_panel(panel_queue& q, int device, int& row) {
+	int rows = 0;
+#pragma omp critical(panel_queue)
+	{
+		int remaining = q.n - q.next_row;
+		double total = 0;
+		bool measured = true;
+		for (int i = 0; i < q.devices; i++) {
+			if (!q.active[i]) continue;
+			total += q.rate[i];
+			if (q.rate[i] == 0) measured = false;
+		}
+		if (!measured) {
+			rows = q.min_chunk;
+		} else {
+			rows = (int)(remaining * q.rate[device] / total / 2) / BLOCK_SIZE * BLOCK_SIZE;
+			if (rows < q.min_chunk) rows = q.min_chunk;
+		}
+		if (rows > q.max_chunk) rows = q.max_chunk;
+		if (rows > remaining) rows = remaining;
+
+		double fastest = 0;
+		for (int i = 0; i < q.devices; i++) {
+			if (i != device && q.active[i]) fastest = std::max(fastest, q.rate[i]);
+		}
+		if (measured && fastest > 0 && rows / q.rate[device] > remaining / fastest) rows = 0;
+		if (rows == 0) q.active[device] = 0;
 
-		clGetEventProfilingInfo(cpu_event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
-		clGetEventProfilingInfo(cpu_event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+		row = q.next_row;
+		q.next_row += rows;
+	}
+	return rows;
+}
 
-		double nanoSeconds = time_end - time_start;
-		return nanoSeconds / 1e9;
+// Row panels of C handed out by next_panel to a thread per device. The rates come from the
+// profiled kernel times, so uploads and readbacks do not skew the chunk sizes. Returns the sum of
+// the kernel times like opencl_gemm. A device writes, multiplies and reads one panel after another
+// through a single A and C buffer: no transfer overlaps its kernels.
+template<typename T>
+double opencl_gemm_dynamic(
+		const std::vector<cl_device_id>& devices,
+		int n,
+		int m,
+		int k,
+		T* a,
+		T* b,
+		T* c,
+		char* filename,
+		char* kernelname,
+		int* rows_done = nullptr) {
+	if (n % BLOCK_SIZE != 0){
+		std::cout << "wrong size of matrices\n";
+		exit(1);
 	}
+	int device_count = (int)devices.size();
+	std::vector<double> rate(device_count, 0);
+	std::vector<int> done(device_count, 0);
+	std::vector<int> active(device_count, 1);
 
-	if (cpu_n == 0){
-		opencl_env gpu_env = create_env(gpu_platform_index, gpu_n, m, k, a, b, filename, kernelname);
-		cl_event gpu_event;
-		ret = clEnqueueNDRangeKernel(gpu_env.queue, gpu_env.kernel, 2, nullptr, gpu_global_work_size, group_size, 0, nullptr, &gpu_event);
-		clWaitForEvents(1, &gpu_event);
-		clFinish(gpu_env.queue);
+	panel_queue q;
+	q.n = n;
+	q.next_row = 0;
+	q.min_chunk = std::min(n, 4 * BLOCK_SIZE);
+	q.max_chunk = std::max(q.min_chunk, (n / 2 + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE);
+	q.rate = rate.data();
+	q.active = active.data();
 
-		ret = clEnqueueReadBuffer(gpu_env.queue, gpu_env.memObjC, CL_TRUE, 0, sizeof(T) * gpu_n * k, c, 0, nullptr, nullptr);
+	std::vector<double> busy(device_count, 0);
+#pragma omp parallel num_threads(device_count)
+	{
+#pragma omp single
+		q.devices = omp_get_num_threads();
+		int device = omp_get_thread_num();
+		opencl_env env = create_panel_env(devices[device], q.max_chunk, m, k, b, filename, kernelname);
+		size_t group_size[2] = { BLOCK_SIZE, BLOCK_SIZE };
+		cl_int ret;
+		cl_event event;
+		int row, rows;
 		cl_ulong time_start;
 		cl_ulong time_end;
+#pragma omp barrier
+
+		while ((rows = next_panel(q, device, row)) > 0) {
+			size_t global_work_size[2] = { k, rows };
+			ret = clEnqueueWriteBuffer(env.queue, env.memObjA, CL_FALSE, 0, sizeof(T) * rows * m, &a[row * m], 0, nullptr, nullptr);
+			check_ret(ret, "EnqueueWriteBuffer A");
+			ret = clSetKernelArg(env.kernel, 0, sizeof(int), &rows);
+			check_ret(ret, "set kernel arg 0");
+			ret = clEnqueueNDRangeKernel(env.queue, env.kernel, 2, nullptr, global_work_size, group_size, 0, nullptr, &event);
+			check_ret(ret, "clEnqueueNDRangeKernel");
+			ret = clEnqueueReadBuffer(env.queue, env.memObjC, CL_TRUE, 0, sizeof(T) * rows * k, &c[row * k], 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueReadBuffer");
+			clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
+			clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+			clReleaseEvent(event);
+
+			busy[device] += (time_end - time_start) / 1e9;
+			done[device] += rows;
+#pragma omp critical(panel_queue)
+			rate[device] = done[device] / std::max(busy[device], 1e-9);
+		}
+	}
+	assert(q.next_row == n);
+	double time = 0;
+	for (int i = 0; i < device_count; i++) time += busy[i];
+
+	if (rows_done != nullptr) {
+		for (int i = 0; i < device_count; i++) rows_done[i] = done[i];
+	}
+	return time;
+}
+
+template<typename T>
+double opencl_gemm_dynamic(
+		int cpu_platform_index,
+		int gpu_platform_index,
+		int n,
+		int m,
+		int k,
+		T* a,
+		T* b,
+		T* c,
+		char* filename,
+		char* kernelname,
+		int* rows_done = nullptr) {
+	std::vector<cl_device_id> devices(2);
+	initialize(cpu_platform_index, devices[0]);
+	initialize(gpu_platform_index, devices[1]);
+	return opencl_gemm_dynamic(devices, n, m, k, a, b, c, filename, kernelname, rows_done);
+}
 
-		clGetEventProfilingInfo(gpu_event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
-		clGetEventProfilingInfo(gpu_event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+// Block of C computed by one device in the 2D decomposition.
+struct gemm_tile {
+	int device;
+	int row, rows;
+	int col, cols;
+};
 
-		double nanoSeconds = time_end - time_start;
-		return nanoSeconds / 1e9;
+// Tiles of a pr x pc device grid: devices [i * pc, (i + 1) * pc) share the i-th band of rows,
+// bands get rows by the total weight of their devices, and inside a band the columns are split by weight.
+// pc == 1 is the usual 1D row split.
+std::vector<gemm_tile> grid_tiles(int n, int k, const std::vector<device_share>& devices, int pr, int pc) {
+	std::vector<double> band_weights(pr, 0);
+	for (size_t d = 0; d < devices.size(); d++) band_weights[d / pc] += devices[d].weight;
+	std::vector<int> band_rows = split_length(n, band_weights);
+
+	std::vector<gemm_tile> tiles;
+	int row = 0;
+	for (int i = 0; i < pr; row += band_rows[i], i++) {
+		std::vector<double> weights;
+		for (int j = 0; j < pc; j++) weights.push_back(devices[i * pc + j].weight);
+		std::vector<int> cols = split_length(k, weights);
+		int col = 0;
+		for (int j = 0; j < pc; col += cols[j], j++) {
+			if (band_rows[i] == 0 || cols[j] == 0) continue;
+			tiles.push_back({ i * pc + j, row, band_rows[i], col, cols[j] });
+		}
 	}
+	return tiles;
+}
 
-	opencl_env cpu_env = create_env(cpu_platform_index, cpu_n, m, k, a, b, filename, kernelname);
-	opencl_env gpu_env = create_env(gpu_platform_index, gpu_n, m, k, &a[cpu_n * m], b, filename, kernelname);
+// Bytes of A, B and C a tile needs on its device.
+size_t tile_bytes(const gemm_tile& tile, int m, size_t elem) {
+	return elem * ((size_t)tile.rows * m + (size_t)m * tile.cols + (size_t)tile.rows * tile.cols);
+}
 
+// Picks the device grid moving the fewest bytes over the bus among those that fit into
+// the memory of every device. The 1D row split is the pr = devices, pc = 1 grid.
+std::vector<gemm_tile> choose_tiles(int n, int m, int k, const std::vector<device_share>& devices, size_t elem, int& grid_rows) {
+	int count = (int)devices.size();
+	std::vector<gemm_tile> best;
+	size_t best_traffic = 0;
+	bool best_fits = false;
+	for (int pr = count; pr >= 1; pr--) {
+		if (count % pr != 0) continue;
+		std::vector<gemm_tile> tiles = grid_tiles(n, k, devices, pr, count / pr);
+		size_t traffic = 0;
+		bool fits = true;
+		for (const gemm_tile& tile : tiles) {
+			cl_ulong global_mem, max_alloc;
+			clGetDeviceInfo(devices[tile.device].device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, nullptr);
+			clGetDeviceInfo(devices[tile.device].device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, nullptr);
+			size_t bytes = tile_bytes(tile, m, elem);
+			size_t largest = elem * std::max((size_t)tile.rows * m, (size_t)m * tile.cols);
+			if (bytes > global_mem || largest > max_alloc) fits = false;
+			traffic += bytes;
+		}
+		if (best.empty() || (fits && !best_fits) || (fits == best_fits && traffic < best_traffic)) {
+			grid_rows = pr;
+			best = tiles;
+			best_traffic = traffic;
+			best_fits = fits;
+		}
+	}
+	return best;
+}
 
-	cl_event cpu_event, gpu_event;
-	ret = clEnqueueNDRangeKernel(cpu_env.queue, cpu_env.kernel, 2, nullptr, cpu_global_work_size, group_size, 0, nullptr, &cpu_event);
-	ret = clEnqueueNDRangeKernel(gpu_env.queue, gpu_env.kernel, 2, nullptr, gpu_global_work_size, group_size, 0, nullptr, &gpu_event);
-	clWaitForEvents(1, &cpu_event);
-	clWaitForEvents(1, &gpu_event);
-	clFinish(cpu_env.queue);
-	clFinish(gpu_env.queue);
+template<typename T>
+opencl_env create_tile_env(
+		cl_device_id device,
+		const gemm_tile& tile,
+		int m,
+		int k,
+		T* a,
+		T* b,
+		char* filename,
+		char* kernelname) {
+	std::string kernel_code = read_kernel(filename);
+	size_t kernel_len = kernel_code.size();
 
-	ret = clEnqueueReadBuffer(cpu_env.queue, cpu_env.memObjC, CL_TRUE, 0, sizeof(T) * cpu_n * k, c, 0, nullptr, nullptr);
-	check_ret(ret, "clEnqueueReadBuffer");
-	ret = clEnqueueReadBuffer(gpu_env.queue, gpu_env.memObjC, CL_TRUE, 0, sizeof(T) * gpu_n * k, &c[cpu_n * k], 0, nullptr, nullptr);
-	check_ret(ret, "clEnqueueReadBuffer");
+	cl_int ret;
+	// Create context
+	cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &ret);
+	check_ret(ret, "clCreateContext");
+	cl_queue_properties props[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
+	// Create queue
+	cl_command_queue command_queue = clCreateCommandQueueWithProperties(context, device, props, &ret);
+	check_ret(ret, "clCreateCommandQueueWithProperties");
+	// Create program
+	cl_program program = clCreateProgramWithSource(context, 1, (const char**)&kernel_code, &kernel_len, &ret);
+	check_ret(ret, "clCreateProgramWithSource");
+	// Build
+	ret = clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr);
+	check_ret(ret, "clBuildProgram");
+	// Create kernel
+	cl_kernel kernel = clCreateKernel(program, kernelname, &ret);
+	check_ret(ret, "clCreateKernel");
+	// Create buffer: the band of A, the column slice of B and the block of C
+	cl_mem memObjA = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(T) * tile.rows * m, nullptr, &ret);
+	check_ret(ret, "create buffer A");
+	cl_mem memObjB = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(T) * m * tile.cols, nullptr, &ret);
+	check_ret(ret, "create buffer B");
+	cl_mem memObjC = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(T) * tile.rows * tile.cols, nullptr, &ret);
+	check_ret(ret, "create buffer C");
+	// Write buffer
+	ret = clEnqueueWriteBuffer(command_queue, memObjA, CL_TRUE, 0, sizeof(T) * tile.rows * m, &a[tile.row * m], 0, nullptr, nullptr);
+	check_ret(ret, "EnqueueWriteBuffer A");
+	size_t buffer_origin[3] = { 0, 0, 0 };
+	size_t host_origin[3] = { sizeof(T) * tile.col, 0, 0 };
+	size_t region[3] = { sizeof(T) * tile.cols, m, 1 };
+	ret = clEnqueueWriteBufferRect(command_queue, memObjB, CL_TRUE, buffer_origin, host_origin, region, sizeof(T) * tile.cols, 0, sizeof(T) * k, 0, b, 0, nullptr, nullptr);
+	check_ret(ret, "EnqueueWriteBufferRect B");
+	// Set kernel Args: the tile is a rows x m by m x cols product
+	ret = clSetKernelArg(kernel, 0, sizeof(int), &tile.rows);
+	check_ret(ret, "set kernel arg 0");
+	ret = clSetKernelArg(kernel, 1, sizeof(int), &m);
+	check_ret(ret, "set kernel arg 1");
+	ret = clSetKernelArg(kernel, 2, sizeof(int), &tile.cols);
+	check_ret(ret, "set kernel arg 2");
+	ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &memObjA);
+	check_ret(ret, "set kernel arg 3");
+	ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &memObjB);
+	check_ret(ret, "set kernel arg 4");
+	ret = clSetKernelArg(kernel, 5, sizeof(cl_mem), &memObjC);
+	check_ret(ret, "set kernel arg 5");
+	return opencl_env(context, command_queue, program, kernel, memObjA, memObjB, memObjC);
+}
 
+// Like opencl_gemm, but each device gets only its band of A and its column slice of B.
+// The device grid (including the plain 1D row split) is chosen by choose_tiles.
+// Returns the sum of the kernel times.
+template<typename T>
+double opencl_gemm_2d(
+		const std::vector<device_share>& devices,
+		int n,
+		int m,
+		int k,
+		T* a,
+		T* b,
+		T* c,
+		char* filename,
+		char* kernelname,
+		int* grid_rows = nullptr) {
+	if (n % BLOCK_SIZE != 0 || k % BLOCK_SIZE != 0){
+		std::cout << "wrong size of matrices\n";
+		exit(1);
+	}
+	int pr;
+	std::vector<gemm_tile> tiles = choose_tiles(n, m, k, devices, sizeof(T), pr);
+	if (grid_rows != nullptr) *grid_rows = pr;
+	std::vector<opencl_env> envs;
+	envs.reserve(tiles.size());
+	for (const gemm_tile& tile : tiles) {
+		envs.push_back(create_tile_env(devices[tile.device].device, tile, m, k, a, b, filename, kernelname));
+	}
+
+	size_t group_size[2] = { BLOCK_SIZE, BLOCK_SIZE };
+	std::vector<cl_event> events(envs.size());
+	cl_int ret;
+	for (size_t i = 0; i < envs.size(); i++) {
+		size_t global_work_size[2] = { tiles[i].cols, tiles[i].rows };
+		ret = clEnqueueNDRangeKernel(envs[i].queue, envs[i].kernel, 2, nullptr, global_work_size, group_size, 0, nullptr, &events[i]);
+		check_ret(ret, "clEnqueueNDRangeKernel");
+	}
+
+	double time = 0;
 	cl_ulong time_start;
 	cl_ulong time_end;
+	for (size_t i = 0; i < envs.size(); i++) {
+		clWaitForEvents(1, &events[i]);
+		size_t buffer_origin[3] = { 0, 0, 0 };
+		size_t host_origin[3] = { sizeof(T) * tiles[i].col, tiles[i].row, 0 };
+		size_t region[3] = { sizeof(T) * tiles[i].cols, tiles[i].rows, 1 };
+		ret = clEnqueueReadBufferRect(envs[i].queue, envs[i].memObjC, CL_TRUE, buffer_origin, host_origin, region, sizeof(T) * tiles[i].cols, 0, sizeof(T) * k, 0, c, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueReadBufferRect");
 
-	clGetEventProfilingInfo(cpu_event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
-	clGetEventProfilingInfo(cpu_event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+		time += (time_end - time_start) / 1e9;
+		clReleaseEvent(events[i]);
+	}
+	return time;
+}
 
-	double cpu_nanoSeconds = time_end - time_start;
+// Devices of one platform sharing a context: the program is built once for all of them,
+// and every device gets its own queue and kernel.
+struct opencl_shared_env {
+	cl_context context;
+	cl_program program;
+	std::vector<cl_device_id> devices;
+	std::vector<cl_command_queue> queues;
+	std::vector<cl_kernel> kernels;
+	// parents first, then their sub-buffers; released in reverse order
+	std::vector<cl_mem> buffers;
+	opencl_shared_env(cl_context _context, cl_program _program, const std::vector<cl_device_id>& _devices)
+		: context(_context), program(_program), devices(_devices) {}
+	opencl_shared_env(opencl_shared_env&& other) noexcept
+		: context(other.context),
+		program(other.program),
+		devices(std::move(other.devices)),
+		queues(std::move(other.queues)),
+		kernels(std::move(other.kernels)),
+		buffers(std::move(other.buffers)) {
+		other.context = nullptr;
+	}
+	~opencl_shared_env() {
+		if (context == nullptr) return;
+		for (size_t i = buffers.size(); i-- > 0;) clReleaseMemObject(buffers[i]);
+		for (cl_kernel kernel : kernels) clReleaseKernel(kernel);
+		clReleaseProgram(program);
+		for (cl_command_queue queue : queues) clReleaseCommandQueue(queue);
+		clReleaseContext(context);
+	}
+};
 
-	clGetEventProfilingInfo(gpu_event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
-	clGetEventProfilingInfo(gpu_event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+cl_platform_id get_platform(cl_device_id device) {
+	cl_platform_id platform;
+	clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr);
+	return platform;
+}
+
+opencl_shared_env create_shared_env(const std::vector<cl_device_id>& devices, char* filename, char* kernelname) {
+	std::string kernel_code = read_kernel(filename);
+	size_t kernel_len = kernel_code.size();
+
+	cl_int ret;
+	// Create context
+	cl_context context = clCreateContext(nullptr, (cl_uint)devices.size(), devices.data(), nullptr, nullptr, &ret);
+	check_ret(ret, "clCreateContext");
+	// Create program
+	cl_program program = clCreateProgramWithSource(context, 1, (const char**)&kernel_code, &kernel_len, &ret);
+	check_ret(ret, "clCreateProgramWithSource");
+	// Build once for all devices
+	ret = clBuildProgram(program, (cl_uint)devices.size(), devices.data(), nullptr, nullptr, nullptr);
+	check_ret(ret, "clBuildProgram");
 
-	double gpu_nanoSeconds = time_end - time_start;
+	opencl_shared_env env(context, program, devices);
+	cl_queue_properties props[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
+	for (cl_device_id device : devices) {
+		// Create queue
+		env.queues.push_back(clCreateCommandQueueWithProperties(context, device, props, &ret));
+		check_ret(ret, "clCreateCommandQueueWithProperties");
+		// Create kernel
+		env.kernels.push_back(clCreateKernel(program, kernelname, &ret));
+		check_ret(ret, "clCreateKernel");
+	}
+	return env;
+}
 
-	return cpu_nanoSeconds / 1e9 + gpu_nanoSeconds / 1e9;
+cl_mem create_sub_buffer(opencl_shared_env& env, cl_mem buffer, size_t origin, size_t size) {
+	cl_buffer_region region = { origin, size };
+	cl_int ret;
+	cl_mem sub_buffer = clCreateSubBuffer(buffer, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &ret);
+	check_ret(ret, "clCreateSubBuffer");
+	env.buffers.push_back(sub_buffer);
+	return sub_buffer;
+}
+
+// Sub-buffer origins must be multiples of CL_DEVICE_MEM_BASE_ADDR_ALIGN of the device.
+bool sub_buffer_aligned(cl_device_id device, size_t origin) {
+	cl_uint align_bits;
+	clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(align_bits), &align_bits, nullptr);
+	return origin % (align_bits / 8) == 0;
+}
+
+// Like opencl_gemm, but devices of the same platform share one context. A and C are allocated
+// once per platform with a sub-buffer view per device and B once for all of its devices; each
+// device's sub-buffers of A and C are moved to it with clEnqueueMigrateMemObjects. B is read by
+// every device at once, so it is left to the implicit migration of the runtime: moving it by hand
+// while other devices' kernels read it is undefined. Falls back to opencl_gemm when a device's
+// rows do not start at an aligned sub-buffer origin.
+template<typename T>
+double opencl_gemm_shared(
+		const std::vector<device_share>& devices,
+		int n,
+		int m,
+		int k,
+		T* a,
+		T* b,
+		T* c,
+		char* filename,
+		char* kernelname) {
+	if (n % BLOCK_SIZE != 0){
+		std::cout << "wrong size of matrices\n";
+		exit(1);
+	}
+	// devices of one platform go next to each other so that they own a contiguous range of rows
+	std::vector<device_share> sorted = devices;
+	std::stable_sort(sorted.begin(), sorted.end(), [](const device_share& l, const device_share& r) {
+		return get_platform(l.device) < get_platform(r.device);
+	});
+	std::vector<int> rows = split_rows(n, sorted);
+
+	// group[i] is the first device of the platform of device i
+	std::vector<size_t> group(sorted.size());
+	std::vector<int> first_row(sorted.size());
+	for (size_t i = 0, row = 0; i < sorted.size(); row += rows[i], i++) {
+		group[i] = (i > 0 && get_platform(sorted[i].device) == get_platform(sorted[i - 1].device)) ? group[i - 1] : i;
+		first_row[i] = (int)row;
+		int offset = first_row[i] - first_row[group[i]];
+		if (!sub_buffer_aligned(sorted[i].device, sizeof(T) * offset * m) || !sub_buffer_aligned(sorted[i].device, sizeof(T) * offset * k)) {
+			return opencl_gemm(devices, n, m, k, a, b, c, filename, kernelname);
+		}
+	}
+
+	std::vector<opencl_shared_env> envs;
+	envs.reserve(sorted.size());
+	std::vector<cl_event> events;
+	std::vector<size_t> event_device;
+	cl_int ret;
+	size_t group_size[2] = { BLOCK_SIZE, BLOCK_SIZE };
+	for (size_t g = 0; g < sorted.size(); g++) {
+		if (group[g] != g) continue;
+		size_t last = g;
+		while (last + 1 < sorted.size() && group[last + 1] == g) last++;
+		int group_rows = first_row[last] + rows[last] - first_row[g];
+		if (group_rows == 0) continue;
+
+		std::vector<cl_device_id> group_devices;
+		for (size_t i = g; i <= last; i++) group_devices.push_back(sorted[i].device);
+		envs.push_back(create_shared_env(group_devices, filename, kernelname));
+		opencl_shared_env& env = envs.back();
+
+		// Create buffer
+		cl_mem memObjA = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(T) * group_rows * m, &a[first_row[g] * m], &ret);
+		check_ret(ret, "create buffer A");
+		env.buffers.push_back(memObjA);
+		cl_mem memObjB = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(T) * m * k, b, &ret);
+		check_ret(ret, "create buffer B");
+		env.buffers.push_back(memObjB);
+		cl_mem memObjC = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY, sizeof(T) * group_rows * k, nullptr, &ret);
+		check_ret(ret, "create buffer C");
+		env.buffers.push_back(memObjC);
+
+		for (size_t i = g; i <= last; i++) {
+			if (rows[i] == 0) continue;
+			size_t d = i - g;
+			int offset = first_row[i] - first_row[g];
+			cl_mem subA = create_sub_buffer(env, memObjA, sizeof(T) * offset * m, sizeof(T) * rows[i] * m);
+			cl_mem subC = create_sub_buffer(env, memObjC, sizeof(T) * offset * k, sizeof(T) * rows[i] * k);
+
+			ret = clEnqueueMigrateMemObjects(env.queues[d], 1, &subA, 0, 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueMigrateMemObjects A");
+			ret = clEnqueueMigrateMemObjects(env.queues[d], 1, &subC, CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED, 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueMigrateMemObjects C");
+
+			// Set kernel Args
+			ret = clSetKernelArg(env.kernels[d], 0, sizeof(int), &rows[i]);
+			check_ret(ret, "set kernel arg 0");
+			ret = clSetKernelArg(env.kernels[d], 1, sizeof(int), &m);
+			check_ret(ret, "set kernel arg 1");
+			ret = clSetKernelArg(env.kernels[d], 2, sizeof(int), &k);
+			check_ret(ret, "set kernel arg 2");
+			ret = clSetKernelArg(env.kernels[d], 3, sizeof(cl_mem), &subA);
+			check_ret(ret, "set kernel arg 3");
+			ret = clSetKernelArg(env.kernels[d], 4, sizeof(cl_mem), &memObjB);
+			check_ret(ret, "set kernel arg 4");
+			ret = clSetKernelArg(env.kernels[d], 5, sizeof(cl_mem), &subC);
+			check_ret(ret, "set kernel arg 5");
+
+			size_t global_work_size[2] = { k, rows[i] };
+			cl_event event;
+			ret = clEnqueueNDRangeKernel(env.queues[d], env.kernels[d], 2, nullptr, global_work_size, group_size, 0, nullptr, &event);
+			check_ret(ret, "clEnqueueNDRangeKernel");
+			ret = clEnqueueReadBuffer(env.queues[d], subC, CL_FALSE, 0, sizeof(T) * rows[i] * k, &c[first_row[i] * k], 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueReadBuffer");
+			events.push_back(event);
+		}
+	}
+
+	for (opencl_shared_env& env : envs) {
+		for (cl_command_queue queue : env.queues) clFinish(queue);
+	}
+	double time = 0;
+	cl_ulong time_start;
+	cl_ulong time_end;
+	for (cl_event event : events) {
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+		time += (time_end - time_start) / 1e9;
+		clReleaseEvent(event);
+	}
+	return time;
 }
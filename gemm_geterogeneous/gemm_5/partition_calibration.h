@@ -0,0 +1,193 @@
+#pragma once
+#include <CL/cl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <cmath>
+#include "opencl_gemm.h"
+
+#define CALIBRATION_CACHE "partition_cache.txt"
+#define PROBE_RUNS 3
+
+// Kernel time on a device as a function of the number of rows: t0 + per_row * rows.
+struct throughput_model {
+	double t0;
+	double per_row;
+	double time(int rows) const {
+		return rows == 0 ? 0 : t0 + per_row * rows;
+	}
+};
+
+std::string device_key(cl_device_id device) {
+	char name[128];
+	clGetDeviceInfo(device, CL_DEVICE_NAME, 128, name, nullptr);
+	return name;
+}
+
+// Sizes in the same power of two share a model.
+int shape_class(int size) {
+	return (int)std::floor(std::log2((double)size));
+}
+
+std::map<std::string, throughput_model> load_calibration() {
+	std::map<std::string, throughput_model> cache;
+	std::ifstream is(CALIBRATION_CACHE);
+	std::string line;
+	while (getline(is, line)) {
+		size_t tab = line.rfind('\t');
+		tab = line.rfind('\t', tab - 1);
+		if (tab == std::string::npos) continue;
+		throughput_model model;
+		std::istringstream(line.substr(tab + 1)) >> model.t0 >> model.per_row;
+		cache[line.substr(0, tab)] = model;
+	}
+	return cache;
+}
+
+void save_calibration(const std::string& key, const throughput_model& model) {
+	std::ofstream os(CALIBRATION_CACHE, std::ios::app);
+	os.precision(17);
+	os << key << '\t' << model.t0 << '\t' << model.per_row << '\n';
+}
+
+double event_time(cl_event event) {
+	cl_ulong time_start;
+	cl_ulong time_end;
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, nullptr);
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, nullptr);
+	return (time_end - time_start) / 1e9;
+}
+
+// Least squares line through the probe points.
+throughput_model fit_model(int probes, const int* rows, const double* times) {
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	for (int i = 0; i < probes; i++) {
+		sx += rows[i];
+		sy += times[i];
+		sxx += (double)rows[i] * rows[i];
+		sxy += rows[i] * times[i];
+	}
+	throughput_model model;
+	double det = probes * sxx - sx * sx;
+	model.per_row = det > 0 ? (probes * sxy - sx * sy) / det : 0;
+	if (model.per_row <= 0) {
+		model.per_row = sy / sx;
+	}
+	model.t0 = std::max(0.0, (sy - model.per_row * sx) / probes);
+	return model;
+}
+
+// Times the kernel on the first few block rows of A and fits the model.
+template<typename T>
+throughput_model probe_gemm(cl_device_id device, int n, int m, int k, T* a, T* b, char* filename, char* kernelname) {
+	const int probes = 4;
+	int rows[probes];
+	double times[probes];
+	int max_rows = std::min(n, 16 * BLOCK_SIZE);
+	opencl_env env = create_env(device, max_rows, m, k, a, b, filename, kernelname);
+	size_t group_size[2] = { BLOCK_SIZE, BLOCK_SIZE };
+	cl_int ret;
+	cl_event event;
+	for (int i = 0; i < probes; i++) {
+		rows[i] = std::max(BLOCK_SIZE, (max_rows >> (probes - 1 - i)) / BLOCK_SIZE * BLOCK_SIZE);
+		size_t global_work_size[2] = { k, rows[i] };
+		ret = clSetKernelArg(env.kernel, 0, sizeof(int), &rows[i]);
+		check_ret(ret, "set kernel arg 0");
+		times[i] = 0;
+		// the first launch is a warm up
+		for (int run = 0; run <= PROBE_RUNS; run++) {
+			ret = clEnqueueNDRangeKernel(env.queue, env.kernel, 2, nullptr, global_work_size, group_size, 0, nullptr, &event);
+			check_ret(ret, "clEnqueueNDRangeKernel");
+			clWaitForEvents(1, &event);
+			double time = event_time(event);
+			clReleaseEvent(event);
+			if (run == 1 || (run > 1 && time < times[i])) times[i] = time;
+		}
+	}
+	return fit_model(probes, rows, times);
+}
+
+// Rows for the first device minimising the finish time of the slower one.
+int optimal_split(int n, const throughput_model& cpu, const throughput_model& gpu) {
+	int best = 0;
+	double best_time = gpu.time(n);
+	for (int cpu_n = BLOCK_SIZE; cpu_n <= n; cpu_n += BLOCK_SIZE) {
+		double time = std::max(cpu.time(cpu_n), gpu.time(n - cpu_n));
+		if (time < best_time) {
+			best_time = time;
+			best = cpu_n;
+		}
+	}
+	return best;
+}
+
+// Rows for any number of devices: every block goes to the device that would finish it first.
+std::vector<int> balanced_rows(int n, const std::vector<throughput_model>& models) {
+	std::vector<int> rows(models.size(), 0);
+	for (int block = 0; block < n / BLOCK_SIZE; block++) {
+		size_t best = 0;
+		for (size_t i = 1; i < models.size(); i++) {
+			if (models[i].time(rows[i] + BLOCK_SIZE) < models[best].time(rows[best] + BLOCK_SIZE)) best = i;
+		}
+		rows[best] += BLOCK_SIZE;
+	}
+	return rows;
+}
+
+template<typename T>
+throughput_model calibrated_model(cl_device_id device, int n, int m, int k, T* a, T* b, char* filename, char* kernelname) {
+	std::string key = device_key(device) + '\t' + kernelname + " m" + std::to_string(shape_class(m)) + " k" + std::to_string(shape_class(k));
+
+	std::map<std::string, throughput_model> cache = load_calibration();
+	auto it = cache.find(key);
+	if (it != cache.end()) return it->second;
+
+	throughput_model model = probe_gemm(device, n, m, k, a, b, filename, kernelname);
+	save_calibration(key, model);
+	return model;
+}
+
+// Partition to pass to opencl_gemm. Models are probed once per (device, kernel, shape class)
+// and cached in CALIBRATION_CACHE for the next runs.
+template<typename T>
+double calibrate_partition(
+		int cpu_platform_index,
+		int gpu_platform_index,
+		int n,
+		int m,
+		int k,
+		T* a,
+		T* b,
+		char* filename,
+		char* kernelname) {
+	cl_device_id cpu_device, gpu_device;
+	initialize(cpu_platform_index, cpu_device);
+	initialize(gpu_platform_index, gpu_device);
+	throughput_model cpu = calibrated_model(cpu_device, n, m, k, a, b, filename, kernelname);
+	throughput_model gpu = calibrated_model(gpu_device, n, m, k, a, b, filename, kernelname);
+	return (double)optimal_split(n, cpu, gpu) / n;
+}
+
+// Calibrated weights for the N-device opencl_gemm.
+template<typename T>
+std::vector<device_share> calibrate_shares(
+		const std::vector<cl_device_id>& devices,
+		int n,
+		int m,
+		int k,
+		T* a,
+		T* b,
+		char* filename,
+		char* kernelname) {
+	std::vector<throughput_model> models;
+	for (cl_device_id device : devices) {
+		models.push_back(calibrated_model(device, n, m, k, a, b, filename, kernelname));
+	}
+	std::vector<int> rows = balanced_rows(n, models);
+	std::vector<device_share> shares;
+	for (size_t i = 0; i < devices.size(); i++) {
+		shares.push_back({ devices[i], (double)rows[i] });
+	}
+	return shares;
+}
@@ -0,0 +1,209 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "sparse_matrix.h"
+
+// File layout: a 64 byte header, then the arrays, each starting at a multiple of BINARY_ALIGN.
+// Dense: n * n values, row-major. CSR: row_ptr (n + 1 ints), col (nnz ints), val (nnz values).
+// Vector: n values. All numbers are in the byte order of the machine that wrote the file.
+#define BINARY_ALIGN 64
+
+enum binary_kind {
+	BINARY_DENSE,
+	BINARY_CSR,
+	BINARY_VECTOR
+};
+
+struct binary_header {
+	char magic[8];
+	int32_t kind;
+	int32_t value_size;
+	int64_t n;
+	int64_t nnz;
+	char reserved[32];
+};
+
+size_t binary_align(size_t offset) {
+	return (offset + BINARY_ALIGN - 1) / BINARY_ALIGN * BINARY_ALIGN;
+}
+
+// A whole file mapped read-only.
+struct mapped_file {
+	const char* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+mapped_file map_file(const std::string& path) {
+	mapped_file mapped;
+#ifdef _WIN32
+	mapped.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	LARGE_INTEGER size;
+	if (mapped.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(mapped.file, &size)) {
+		std::cout << "can not open " << path << '\n';
+		exit(1);
+	}
+	mapped.size = (size_t)size.QuadPart;
+	mapped.mapping = CreateFileMappingA(mapped.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	mapped.data = mapped.mapping ? (const char*)MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		std::cout << "can not open " << path << '\n';
+		exit(1);
+	}
+	mapped.size = (size_t)st.st_size;
+	void* data = mmap(nullptr, mapped.size, PROT_READ, MAP_SHARED, fd, 0);
+	mapped.data = data == MAP_FAILED ? nullptr : (const char*)data;
+	// the arrays are read front to back once, by the upload
+	if (mapped.data) madvise(data, mapped.size, MADV_SEQUENTIAL);
+	close(fd);
+#endif
+	if (mapped.data == nullptr) {
+		std::cout << "can not map " << path << '\n';
+		exit(1);
+	}
+	return mapped;
+}
+
+void unmap_file(mapped_file& mapped) {
+#ifdef _WIN32
+	UnmapViewOfFile(mapped.data);
+	CloseHandle(mapped.mapping);
+	CloseHandle(mapped.file);
+#else
+	munmap((void*)mapped.data, mapped.size);
+#endif
+	mapped.data = nullptr;
+}
+
+// A mapped binary matrix or vector; the pointers point into the mapping and stay valid until
+// unmap_binary.
+template<typename T>
+struct binary_matrix {
+	mapped_file file;
+	binary_header header;
+	const T* dense;
+	const T* vector;
+	csr_view<T> csr;
+};
+
+template<typename T>
+binary_matrix<T> map_binary(const std::string& path) {
+	binary_matrix<T> m = {};
+	m.file = map_file(path);
+	if (m.file.size < sizeof(binary_header)) {
+		std::cout << path << " is not a binary matrix\n";
+		exit(1);
+	}
+	memcpy(&m.header, m.file.data, sizeof(binary_header));
+	if (memcmp(m.header.magic, "JACOBI1", 8) != 0 || m.header.value_size != sizeof(T)) {
+		std::cout << path << " is not a binary matrix of " << sizeof(T) << " byte values\n";
+		exit(1);
+	}
+	size_t n = (size_t)m.header.n;
+	size_t offset = binary_align(sizeof(binary_header));
+	size_t end = offset;
+	if (m.header.kind == BINARY_DENSE) {
+		m.dense = (const T*)(m.file.data + offset);
+		end = offset + sizeof(T) * n * n;
+	}
+	else if (m.header.kind == BINARY_VECTOR) {
+		m.vector = (const T*)(m.file.data + offset);
+		end = offset + sizeof(T) * n;
+	}
+	else if (m.header.kind == BINARY_CSR) {
+		size_t nnz = (size_t)m.header.nnz;
+		size_t col = binary_align(offset + sizeof(int) * (n + 1));
+		size_t val = binary_align(col + sizeof(int) * nnz);
+		m.csr = { (int)n, { (const int*)(m.file.data + offset), n + 1 }, { (const int*)(m.file.data + col), nnz }, { (const T*)(m.file.data + val), nnz } };
+		end = val + sizeof(T) * nnz;
+	}
+	else {
+		std::cout << path << " has an unknown kind " << m.header.kind << '\n';
+		exit(1);
+	}
+	if (end > m.file.size) {
+		std::cout << path << " is truncated\n";
+		exit(1);
+	}
+	return m;
+}
+
+template<typename T>
+void unmap_binary(binary_matrix<T>& m) {
+	unmap_file(m.file);
+}
+
+// Writers: the header, then every array padded to BINARY_ALIGN.
+void write_binary_header(std::ofstream& os, binary_kind kind, int value_size, int64_t n, int64_t nnz) {
+	binary_header header = {};
+	memcpy(header.magic, "JACOBI1", 8);
+	header.kind = kind;
+	header.value_size = value_size;
+	header.n = n;
+	header.nnz = nnz;
+	os.write((const char*)&header, sizeof(header));
+}
+
+void write_binary_array(std::ofstream& os, const void* data, size_t bytes) {
+	static const char zeros[BINARY_ALIGN] = {};
+	size_t at = (size_t)os.tellp();
+	os.write(zeros, binary_align(at) - at);
+	os.write((const char*)data, bytes);
+}
+
+// a full disk or a failed write leaves a truncated file behind, stop rather than read it later
+void finish_binary(std::ofstream& os, const std::string& path) {
+	os.close();
+	if (!os) {
+		std::cout << "can not write " << path << '\n';
+		exit(1);
+	}
+}
+
+template<typename T>
+void write_binary_dense(const std::string& path, int n, const T* a) {
+	std::ofstream os(path, std::ios::binary);
+	write_binary_header(os, BINARY_DENSE, sizeof(T), n, (int64_t)n * n);
+	write_binary_array(os, a, sizeof(T) * n * n);
+	finish_binary(os, path);
+}
+
+template<typename T>
+void write_binary_csr(const std::string& path, const csr_view<T>& a) {
+	std::ofstream os(path, std::ios::binary);
+	write_binary_header(os, BINARY_CSR, sizeof(T), a.n, (int64_t)a.val.size());
+	write_binary_array(os, a.row_ptr.data(), sizeof(int) * a.row_ptr.size());
+	write_binary_array(os, a.col.data(), sizeof(int) * a.col.size());
+	write_binary_array(os, a.val.data(), sizeof(T) * a.val.size());
+	finish_binary(os, path);
+}
+
+// for results, x of a solve
+template<typename T>
+void write_binary_vector(const std::string& path, int n, const T* x) {
+	std::ofstream os(path, std::ios::binary);
+	write_binary_header(os, BINARY_VECTOR, sizeof(T), n, n);
+	write_binary_array(os, x, sizeof(T) * n);
+	finish_binary(os, path);
+}
@@ -13,4 +13,878 @@ __kernel void jacobiDouble(__global const double* a,
 
 	x1[j] = (b[j] - ans) / a[j * n + j];
 	delta[j] = (x1[j] - x0[j]) / x0[j];
-}
\ No newline at end of file
+}
+
+// Sum of |x[i]|: every work-group writes the sum of its part to partial[group]
+__kernel void reduceDouble(__global const double* x,
+						   __global double* partial,
+						   __local double* scratch,
+						   int n) {
+	const int lid = get_local_id(0);
+	double sum = 0;
+
+	for (int i = get_global_id(0); i < n; i += get_global_size(0)) {
+		sum += fabs(x[i]);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = get_local_size(0) / 2; step > 0; step /= 2) {
+		if (lid < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) partial[get_group_id(0)] = scratch[0];
+}
+
+// A work-group of (local0 x local1) work-items computes local1 rows: the local0 work-items of a row
+// read it with coalesced double4 loads, x0 is staged in tiles of 4 * local0 elements shared by the rows.
+// a[j * n + j] * x0[j] is included in the sum and taken back out after the reduction.
+__kernel void jacobiRowDouble(__global const double* a,
+						      __global const double* b,
+						      __global double* x0,
+						      __global double* x1,
+						      __global double* delta,
+						      int n,
+						      __local double* tile,
+						      __local double* scratch) {
+	const int lid0 = get_local_id(0);
+	const int lid1 = get_local_id(1);
+	const int local0 = get_local_size(0);
+	const int local1 = get_local_size(1);
+	const int lid = lid1 * local0 + lid0;
+	const int j = get_global_id(1);
+	const int width = 4 * local0;
+	const bool valid = j < n;
+	__global const double* row = a + (size_t)(valid ? j : 0) * n;
+	double sum = 0;
+
+	for (int start = 0; start < n; start += width) {
+		for (int t = lid; t < width; t += local0 * local1) {
+			tile[t] = start + t < n ? x0[start + t] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int i = start + 4 * lid0;
+		if (valid && i + 3 < n) {
+			double4 v = vload4(0, row + i);
+			double4 x = vload4(0, tile + 4 * lid0);
+			sum += dot(v, x);
+		}
+		else if (valid) {
+			for (int k = i; k < n; k++) sum += row[k] * tile[k - start];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = local0 / 2; step > 0; step /= 2) {
+		if (lid0 < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (valid && lid0 == 0) {
+		const double diagonal = row[j];
+		const double old = x0[j];
+		const double dx = (b[j] - scratch[lid]) / diagonal;
+		x1[j] = old + dx;
+		delta[j] = dx / old;
+	}
+}
+
+// Block SOR: a work-group of local0 work-items owns local0 consecutive rows. Rows of other blocks
+// use x0 (Jacobi between blocks), the rows of the block are relaxed one after another in local
+// memory (Gauss-Seidel inside the block). omega == 1 is block Gauss-Seidel.
+// tile holds local0 rows of A by SOR_TILE columns, padded by one to avoid bank conflicts.
+#define SOR_TILE 32
+__kernel void blockSorDouble(__global const double* a,
+						     __global const double* b,
+						     __global double* x0,
+						     __global double* x1,
+						     __global double* delta,
+						     int n,
+						     double omega,
+						     __local double* tile,
+						     __local double* dx) {
+	const int lid = get_local_id(0);
+	const int local0 = get_local_size(0);
+	const int first = get_group_id(0) * local0;
+	const int j = first + lid;
+	const int rows = min(local0, n - first);
+	double sum = 0;
+
+	// sum over all columns with x0, the tile loads are coalesced along the columns
+	for (int start = 0; start < n; start += SOR_TILE) {
+		for (int t = lid; t < local0 * SOR_TILE; t += local0) {
+			const int r = t / SOR_TILE;
+			const int c = t % SOR_TILE;
+			tile[r * (SOR_TILE + 1) + c] = r < rows && start + c < n ? a[(size_t)(first + r) * n + start + c] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (int c = 0; c < SOR_TILE && start + c < n; c++) {
+			sum += tile[lid * (SOR_TILE + 1) + c] * x0[start + c];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	// Gauss-Seidel inside the block: row r sees the updates dx of the rows before it
+	for (int r = 0; r < rows; r++) {
+		if (lid == r) {
+			dx[r] = omega * (b[j] - sum) / a[(size_t)j * n + j];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid > r && lid < rows) {
+			sum += a[(size_t)j * n + first + r] * dx[r];
+		}
+	}
+	if (lid < rows) {
+		x1[j] = x0[j] + dx[lid];
+		delta[j] = dx[lid] / x0[j];
+	}
+}
+
+// Half of a red-black SOR sweep: rows j with j % 2 == color are relaxed from x_in into x_out, the
+// rows of the other color are copied. Work-groups are laid out as in jacobiRowDouble over the rows of
+// one color, so the red half-sweep from x0 into x1 followed by the black one from x1 into x0 uses
+// the new red values in every black row.
+__kernel void redBlackDouble(__global const double* a,
+						     __global const double* b,
+						     __global const double* x_in,
+						     __global double* x_out,
+						     __global double* delta,
+						     int n,
+						     double omega,
+						     int color,
+						     __local double* tile,
+						     __local double* scratch) {
+	const int lid0 = get_local_id(0);
+	const int lid1 = get_local_id(1);
+	const int local0 = get_local_size(0);
+	const int local1 = get_local_size(1);
+	const int lid = lid1 * local0 + lid0;
+	const int j = 2 * get_global_id(1) + color;
+	const int other = 2 * get_global_id(1) + 1 - color;
+	const int width = 4 * local0;
+	const bool valid = j < n;
+	__global const double* row = a + (size_t)(valid ? j : 0) * n;
+	double sum = 0;
+
+	for (int start = 0; start < n; start += width) {
+		for (int t = lid; t < width; t += local0 * local1) {
+			tile[t] = start + t < n ? x_in[start + t] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int i = start + 4 * lid0;
+		if (valid && i + 3 < n) {
+			double4 v = vload4(0, row + i);
+			double4 x = vload4(0, tile + 4 * lid0);
+			sum += dot(v, x);
+		}
+		else if (valid) {
+			for (int k = i; k < n; k++) sum += row[k] * tile[k - start];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = local0 / 2; step > 0; step /= 2) {
+		if (lid0 < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid0 == 0 && valid) {
+		const double old = x_in[j];
+		const double dx = omega * (b[j] - scratch[lid]) / row[j];
+		x_out[j] = old + dx;
+		delta[j] = dx / old;
+	}
+	if (lid0 == 0 && other < n) {
+		x_out[other] = x_in[other];
+	}
+}
+
+// Kernels of the Krylov solvers (opencl_krylov.h).
+
+// y = A * x with the work-group layout of jacobiRowDouble
+__kernel void matvecDouble(__global const double* a,
+						   __global const double* x,
+						   __global double* y,
+						   int n,
+						   __local double* tile,
+						   __local double* scratch) {
+	const int lid0 = get_local_id(0);
+	const int lid1 = get_local_id(1);
+	const int local0 = get_local_size(0);
+	const int local1 = get_local_size(1);
+	const int lid = lid1 * local0 + lid0;
+	const int j = get_global_id(1);
+	const int width = 4 * local0;
+	const bool valid = j < n;
+	__global const double* row = a + (size_t)(valid ? j : 0) * n;
+	double sum = 0;
+
+	for (int start = 0; start < n; start += width) {
+		for (int t = lid; t < width; t += local0 * local1) {
+			tile[t] = start + t < n ? x[start + t] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int i = start + 4 * lid0;
+		if (valid && i + 3 < n) {
+			sum += dot(vload4(0, row + i), vload4(0, tile + 4 * lid0));
+		}
+		else if (valid) {
+			for (int k = i; k < n; k++) sum += row[k] * tile[k - start];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = local0 / 2; step > 0; step /= 2) {
+		if (lid0 < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (valid && lid0 == 0) y[j] = scratch[lid];
+}
+
+// Every work-group writes its part of x . y to partial[group]
+__kernel void dotDouble(__global const double* x,
+						__global const double* y,
+						__global double* partial,
+						__local double* scratch,
+						int n) {
+	const int lid = get_local_id(0);
+	double sum = 0;
+
+	for (int i = get_global_id(0); i < n; i += get_global_size(0)) {
+		sum += x[i] * y[i];
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = get_local_size(0) / 2; step > 0; step /= 2) {
+		if (lid < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) partial[get_group_id(0)] = scratch[0];
+}
+
+// result[slot] = sum of partial[0..n), one work-group
+__kernel void sumDouble(__global const double* partial,
+						__global double* result,
+						__local double* scratch,
+						int n,
+						int slot) {
+	const int lid = get_local_id(0);
+	double sum = 0;
+
+	for (int i = lid; i < n; i += get_local_size(0)) {
+		sum += partial[i];
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = get_local_size(0) / 2; step > 0; step /= 2) {
+		if (lid < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) result[slot] = scratch[0];
+}
+
+// y = alpha * x + beta * y
+__kernel void axpbyDouble(double alpha,
+						  __global const double* x,
+						  double beta,
+						  __global double* y,
+						  int n) {
+	const int i = get_global_id(0);
+	if (i < n) y[i] = alpha * x[i] + beta * y[i];
+}
+
+// Jacobi preconditioner: z = r / diag(A)
+__kernel void diagScaleDouble(__global const double* a,
+						      __global const double* r,
+						      __global double* z,
+						      int n) {
+	const int i = get_global_id(0);
+	if (i < n) z[i] = r[i] / a[(size_t)i * n + i];
+}
+
+// Kernels of the multiple right-hand side Jacobi (opencl_jacobi_multi).
+
+// upper bound of the columns of one solve
+#define MAX_RHS 32
+
+// One Jacobi sweep on the n x r block X (row-major): a work-group of local0 work-items owns row j,
+// every element of the row is loaded once and applied to all r columns. Columns with active[c] == 0
+// are copied and get delta = 0. scratch holds local0 * r sums.
+__kernel void jacobiMultiDouble(__global const double* a,
+								__global const double* b,
+								__global double* x0,
+								__global double* x1,
+								__global double* delta,
+								__global const int* active,
+								int n,
+								int r,
+								__local double* scratch) {
+	const int lid = get_local_id(0);
+	const int local0 = get_local_size(0);
+	const int j = get_group_id(0);
+	__global const double* row = a + (size_t)j * n;
+	double sum[MAX_RHS];
+
+	for (int c = 0; c < r; c++) sum[c] = 0;
+	for (int i = lid; i < n; i += local0) {
+		const double aji = row[i];
+		for (int c = 0; c < r; c++) sum[c] += aji * x0[i * r + c];
+	}
+	for (int c = 0; c < r; c++) scratch[c * local0 + lid] = sum[c];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = local0 / 2; step > 0; step /= 2) {
+		if (lid < step) {
+			for (int c = 0; c < r; c++) scratch[c * local0 + lid] += scratch[c * local0 + lid + step];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	for (int c = lid; c < r; c += local0) {
+		const int k = j * r + c;
+		const double old = x0[k];
+		const double dx = active[c] ? (b[k] - scratch[c * local0]) / row[j] : 0;
+		x1[k] = old + dx;
+		delta[k] = dx / old;
+	}
+}
+
+// Per column convergence: one work-group per column sums |delta| into residual[c], counts the
+// sweep in iterations[c] and clears active[c] once the column is below eps.
+__kernel void maskColumnsDouble(__global const double* delta,
+								__global double* residual,
+								__global int* active,
+								__global int* iterations,
+								__local double* scratch,
+								int n,
+								int r,
+								double eps) {
+	const int lid = get_local_id(0);
+	const int c = get_group_id(0);
+	double sum = 0;
+
+	for (int j = lid; j < n; j += get_local_size(0)) {
+		sum += fabs(delta[j * r + c]);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = get_local_size(0) / 2; step > 0; step /= 2) {
+		if (lid < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0 && active[c]) {
+		residual[c] = scratch[0];
+		iterations[c]++;
+		active[c] = scratch[0] > eps;
+	}
+}
+
+// Matrix-free Jacobi for structured grids (opencl_stencil.h). The operator is
+// center * u[p] + cx * (u[p - 1] + u[p + 1]) + cy * (u[p - nx] + u[p + nx]) (+ cz for the z neighbours),
+// points outside the grid are 0 (Dirichlet boundary). A work-group loads a tile with a halo of sweeps
+// points into local memory and makes sweeps Jacobi sweeps on it; the valid part shrinks by one point
+// per sweep, so only the interior of the tile is written back. delta is the change of the last sweep.
+__kernel void stencil2dDouble(__global const double* f,
+							  __global const double* u0,
+							  __global double* u1,
+							  __global double* delta,
+							  int nx,
+							  int ny,
+							  double center,
+							  double cx,
+							  double cy,
+							  int sweeps,
+							  __local double* tile) {
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int size_x = get_local_size(0);
+	const int size_y = get_local_size(1);
+	const int x = get_group_id(0) * (size_x - 2 * sweeps) + lx - sweeps;
+	const int y = get_group_id(1) * (size_y - 2 * sweeps) + ly - sweeps;
+	const bool inside = x >= 0 && x < nx && y >= 0 && y < ny;
+	const bool edge = lx == 0 || lx == size_x - 1 || ly == 0 || ly == size_y - 1;
+	const int l = ly * size_x + lx;
+	const size_t p = (size_t)y * nx + x;
+	const double rhs = inside ? f[p] : 0;
+	double u = inside ? u0[p] : 0;
+	double prev = u;
+
+	tile[l] = u;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (int s = 0; s < sweeps; s++) {
+		prev = u;
+		if (inside && !edge) {
+			u = (rhs - cx * (tile[l - 1] + tile[l + 1]) - cy * (tile[l - size_x] + tile[l + size_x])) / center;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		tile[l] = u;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (inside && lx >= sweeps && lx < size_x - sweeps && ly >= sweeps && ly < size_y - sweeps) {
+		u1[p] = u;
+		delta[p] = (u - prev) / prev;
+	}
+}
+
+__kernel void stencil3dDouble(__global const double* f,
+							  __global const double* u0,
+							  __global double* u1,
+							  __global double* delta,
+							  int nx,
+							  int ny,
+							  int nz,
+							  double center,
+							  double cx,
+							  double cy,
+							  double cz,
+							  int sweeps,
+							  __local double* tile) {
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lz = get_local_id(2);
+	const int size_x = get_local_size(0);
+	const int size_y = get_local_size(1);
+	const int size_z = get_local_size(2);
+	const int x = get_group_id(0) * (size_x - 2 * sweeps) + lx - sweeps;
+	const int y = get_group_id(1) * (size_y - 2 * sweeps) + ly - sweeps;
+	const int z = get_group_id(2) * (size_z - 2 * sweeps) + lz - sweeps;
+	const bool inside = x >= 0 && x < nx && y >= 0 && y < ny && z >= 0 && z < nz;
+	const bool edge = lx == 0 || lx == size_x - 1 || ly == 0 || ly == size_y - 1 || lz == 0 || lz == size_z - 1;
+	const int plane = size_x * size_y;
+	const int l = lz * plane + ly * size_x + lx;
+	const size_t p = ((size_t)z * ny + y) * nx + x;
+	const double rhs = inside ? f[p] : 0;
+	double u = inside ? u0[p] : 0;
+	double prev = u;
+
+	tile[l] = u;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (int s = 0; s < sweeps; s++) {
+		prev = u;
+		if (inside && !edge) {
+			u = (rhs - cx * (tile[l - 1] + tile[l + 1]) - cy * (tile[l - size_x] + tile[l + size_x])
+				- cz * (tile[l - plane] + tile[l + plane])) / center;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		tile[l] = u;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (inside && lx >= sweeps && lx < size_x - sweeps && ly >= sweeps && ly < size_y - sweeps
+		&& lz >= sweeps && lz < size_z - sweeps) {
+		u1[p] = u;
+		delta[p] = (u - prev) / prev;
+	}
+}
+
+// Sparse Jacobi sweeps (opencl_sparse.h), one work-item per row. The diagonal stays in the row
+// and is taken out as in jacobiRowDouble: x1 = x0 + (b - row . x0) / diag.
+
+// CSR: the entries of a row are contiguous, accesses of neighbouring work-items are not
+__kernel void jacobiCsrDouble(__global const double* val,
+							  __global const int* col,
+							  __global double* x0,
+							  __global double* x1,
+							  __global double* delta,
+							  __global const double* b,
+							  __global const double* diag,
+							  int n,
+							  __global const int* row_ptr) {
+	const int j = get_global_id(0);
+	if (j >= n) return;
+	double sum = 0;
+
+	for (int k = row_ptr[j]; k < row_ptr[j + 1]; k++) {
+		sum += val[k] * x0[col[k]];
+	}
+	const double dx = (b[j] - sum) / diag[j];
+	x1[j] = x0[j] + dx;
+	delta[j] = dx / x0[j];
+}
+
+// ELLPACK: entry k of row j at k * n + j, neighbouring work-items read neighbouring entries
+__kernel void jacobiEllDouble(__global const double* val,
+							  __global const int* col,
+							  __global double* x0,
+							  __global double* x1,
+							  __global double* delta,
+							  __global const double* b,
+							  __global const double* diag,
+							  int n,
+							  int width) {
+	const int j = get_global_id(0);
+	if (j >= n) return;
+	double sum = 0;
+
+	for (int k = 0; k < width; k++) {
+		const size_t p = (size_t)k * n + j;
+		sum += val[p] * x0[col[p]];
+	}
+	const double dx = (b[j] - sum) / diag[j];
+	x1[j] = x0[j] + dx;
+	delta[j] = dx / x0[j];
+}
+
+// SELL-C-sigma: work-item t handles the row perm[t] of slice t / c
+__kernel void jacobiSellDouble(__global const double* val,
+							   __global const int* col,
+							   __global double* x0,
+							   __global double* x1,
+							   __global double* delta,
+							   __global const double* b,
+							   __global const double* diag,
+							   int n,
+							   __global const int* slice_ptr,
+							   __global const int* perm,
+							   int c) {
+	const int t = get_global_id(0);
+	const int slice = t / c;
+	const int j = perm[t];
+	if (j < 0) return;
+	const int width = (slice_ptr[slice + 1] - slice_ptr[slice]) / c;
+	double sum = 0;
+
+	for (int k = 0; k < width; k++) {
+		const size_t p = slice_ptr[slice] + (size_t)k * c + t % c;
+		sum += val[p] * x0[col[p]];
+	}
+	const double dx = (b[j] - sum) / diag[j];
+	x1[j] = x0[j] + dx;
+	delta[j] = dx / x0[j];
+}
+
+// Kernels of the geometric multigrid (opencl_multigrid.h) on the grids of stencil3dDouble, one
+// work-item per point, x fastest. An axis is coarsened when the coarse size differs from the fine
+// one: fine point 2 * i + 1 lies on coarse point i. Values outside the grid are 0.
+
+inline double mg_at(__global const double* u, int x, int y, int z, int nx, int ny, int nz) {
+	return x >= 0 && x < nx && y >= 0 && y < ny && z >= 0 && z < nz ? u[((size_t)z * ny + y) * nx + x] : 0;
+}
+
+inline double mg_apply(__global const double* u, int x, int y, int z, int nx, int ny, int nz, double center, double cx, double cy, double cz) {
+	return center * mg_at(u, x, y, z, nx, ny, nz)
+		+ cx * (mg_at(u, x - 1, y, z, nx, ny, nz) + mg_at(u, x + 1, y, z, nx, ny, nz))
+		+ cy * (mg_at(u, x, y - 1, z, nx, ny, nz) + mg_at(u, x, y + 1, z, nx, ny, nz))
+		+ cz * (mg_at(u, x, y, z - 1, nx, ny, nz) + mg_at(u, x, y, z + 1, nx, ny, nz));
+}
+
+// weighted Jacobi: u1 = u0 + omega * (f - A u0) / center
+__kernel void mgSmoothDouble(__global const double* f,
+							 __global const double* u0,
+							 __global double* u1,
+							 int nx,
+							 int ny,
+							 int nz,
+							 double center,
+							 double cx,
+							 double cy,
+							 double cz,
+							 double omega) {
+	const int x = get_global_id(0), y = get_global_id(1), z = get_global_id(2);
+	if (x >= nx || y >= ny || z >= nz) return;
+	const size_t p = ((size_t)z * ny + y) * nx + x;
+	u1[p] = u0[p] + omega * (f[p] - mg_apply(u0, x, y, z, nx, ny, nz, center, cx, cy, cz)) / center;
+}
+
+// r = f - A u
+__kernel void mgResidualDouble(__global const double* f,
+							   __global const double* u,
+							   __global double* r,
+							   int nx,
+							   int ny,
+							   int nz,
+							   double center,
+							   double cx,
+							   double cy,
+							   double cz) {
+	const int x = get_global_id(0), y = get_global_id(1), z = get_global_id(2);
+	if (x >= nx || y >= ny || z >= nz) return;
+	const size_t p = ((size_t)z * ny + y) * nx + x;
+	r[p] = f[p] - mg_apply(u, x, y, z, nx, ny, nz, center, cx, cy, cz);
+}
+
+// full weighting, one work-item per coarse point: weights 1/4 1/2 1/4 along the coarsened axes
+__kernel void mgRestrictDouble(__global const double* r,
+							   __global double* f,
+							   int nx,
+							   int ny,
+							   int nz,
+							   int cnx,
+							   int cny,
+							   int cnz) {
+	const int x = get_global_id(0), y = get_global_id(1), z = get_global_id(2);
+	if (x >= cnx || y >= cny || z >= cnz) return;
+	const int sx = cnx != nx, sy = cny != ny, sz = cnz != nz;
+	const int fx = sx ? 2 * x + 1 : x, fy = sy ? 2 * y + 1 : y, fz = sz ? 2 * z + 1 : z;
+	double sum = 0;
+	for (int dz = -sz; dz <= sz; dz++) {
+		for (int dy = -sy; dy <= sy; dy++) {
+			for (int dx = -sx; dx <= sx; dx++) {
+				const double w = (dx ? 0.25 : (sx ? 0.5 : 1)) * (dy ? 0.25 : (sy ? 0.5 : 1)) * (dz ? 0.25 : (sz ? 0.5 : 1));
+				sum += w * mg_at(r, fx + dx, fy + dy, fz + dz, nx, ny, nz);
+			}
+		}
+	}
+	f[((size_t)z * cny + y) * cnx + x] = sum;
+}
+
+// u += linear interpolation of the coarse correction, one work-item per fine point
+__kernel void mgProlongDouble(__global const double* e,
+							  __global double* u,
+							  int nx,
+							  int ny,
+							  int nz,
+							  int cnx,
+							  int cny,
+							  int cnz) {
+	const int x = get_global_id(0), y = get_global_id(1), z = get_global_id(2);
+	if (x >= nx || y >= ny || z >= nz) return;
+	const int sx = cnx != nx, sy = cny != ny, sz = cnz != nz;
+	// coarse neighbours along every axis: one on a coarse point, two in between
+	const int x0 = sx ? (x - 1) >> 1 : x, y0 = sy ? (y - 1) >> 1 : y, z0 = sz ? (z - 1) >> 1 : z;
+	const int x1 = sx && !(x & 1) ? x0 + 1 : x0, y1 = sy && !(y & 1) ? y0 + 1 : y0, z1 = sz && !(z & 1) ? z0 + 1 : z0;
+	const double wx = x1 != x0 ? 0.5 : 1, wy = y1 != y0 ? 0.5 : 1, wz = z1 != z0 ? 0.5 : 1;
+	double sum = 0;
+	for (int cz = z0; cz <= z1; cz++) {
+		for (int cy = y0; cy <= y1; cy++) {
+			for (int cx = x0; cx <= x1; cx++) {
+				sum += mg_at(e, cx, cy, cz, cnx, cny, cnz);
+			}
+		}
+	}
+	u[((size_t)z * ny + y) * nx + x] += wx * wy * wz * sum;
+}
+
+// Global barrier of the persistent kernels: the work-groups must all be resident, which holds for
+// one work-group per compute unit. count is the number of arrived groups, generation flips
+// when the last one arrives; both start at 0.
+inline void global_barrier(volatile __global int* count, volatile __global int* generation) {
+	barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+	if (get_local_id(0) == 0) {
+		const int current = atomic_add(generation, 0);
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+		if (atomic_inc(count) == get_num_groups(0) - 1) {
+			atomic_xchg(count, 0);
+			atomic_inc(generation);
+		}
+		else {
+			while (atomic_add(generation, 0) == current);
+		}
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+}
+
+// A whole Jacobi solve in one launch: a fixed grid of work-groups loops over the sweeps, a
+// work-group computes every num_groups-th row with its work-items sharing the dot product.
+// After each sweep the groups meet at the global barrier, every group sums the per-group
+// residuals (double buffered by sweep parity) itself, so all of them stop at the same sweep
+// without a second barrier. x0 and x1 swap roles every sweep: after an odd number of sweeps the
+// answer is in x1. sync holds the barrier state (two ints, zero), iterations and accuracy
+// receive the number of sweeps and the last residual. All the groups must be resident at once
+// or the barrier never opens, the host launches at most one per compute unit.
+__kernel void jacobiPersistentDouble(__global const double* a,
+									 __global const double* b,
+									 __global double* x0,
+									 __global double* x1,
+									 __global double* partial,
+									 volatile __global int* sync,
+									 __global int* iterations,
+									 __global double* accuracy,
+									 __local double* scratch,
+									 int n,
+									 double eps,
+									 int max_iter) {
+	const int lid = get_local_id(0);
+	const int group = get_group_id(0);
+	const int groups = get_num_groups(0);
+	__global double* from = x0;
+	__global double* to = x1;
+	__local int done;
+	double total = 0;
+	int iter = 0;
+
+	while (iter < max_iter) {
+		double residual = 0;
+		for (int row = group; row < n; row += groups) {
+			double sum = 0;
+			for (int i = lid; i < n; i += get_local_size(0)) {
+				sum += a[(size_t)row * n + i] * from[i];
+			}
+			scratch[lid] = sum;
+			barrier(CLK_LOCAL_MEM_FENCE);
+			for (int step = get_local_size(0) / 2; step > 0; step /= 2) {
+				if (lid < step) scratch[lid] += scratch[lid + step];
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+			if (lid == 0) {
+				// the diagonal term is in the sum, x = from + (b - sum) / diagonal takes it back out
+				const double x = from[row] + (b[row] - scratch[0]) / a[(size_t)row * n + row];
+				residual += fabs((x - from[row]) / from[row]);
+				to[row] = x;
+			}
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+		if (lid == 0) partial[(iter & 1) * groups + group] = residual;
+		global_barrier(sync, sync + 1);
+
+		iter++;
+		if (lid == 0) {
+			total = 0;
+			for (int g = 0; g < groups; g++) total += partial[((iter - 1) & 1) * groups + g];
+			done = !(total > eps);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		__global double* swap = from;
+		from = to;
+		to = swap;
+		if (done) break;
+	}
+	if (group == 0 && lid == 0) {
+		*iterations = iter;
+		*accuracy = total;
+	}
+}
+
+// Batched Jacobi for many independent systems of the same n, one work-group per system. System s
+// has A at a + s * n * n stored column-major (a[j * n + i] is A[i][j], so neighbouring work-items
+// read neighbouring addresses), b and x at s * n. x stays in local memory for the whole solve and
+// so does A when cache_a is set (la holds n * n values then). The work-group sweeps until
+// sum(|(x1 - x0) / x0|) <= eps or max_iter and leaves, a converged system frees its compute unit.
+__kernel void jacobiBatchDouble(__global const double* a,
+								__global const double* b,
+								__global double* x,
+								__global int* iterations,
+								__global double* accuracy,
+								__local double* la,
+								__local double* x0,
+								__local double* x1,
+								__local double* scratch,
+								int n,
+								int cache_a,
+								double eps,
+								int max_iter) {
+	const int s = get_group_id(0);
+	const int lid = get_local_id(0);
+	const int lsize = get_local_size(0);
+	__global const double* as = a + (size_t)s * n * n;
+	__global const double* bs = b + (size_t)s * n;
+	if (cache_a) {
+		for (int k = lid; k < n * n; k += lsize) la[k] = as[k];
+	}
+	for (int i = lid; i < n; i += lsize) x0[i] = x[(size_t)s * n + i];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	double total = 0;
+	int iter = 0;
+	while (iter < max_iter) {
+		double residual = 0;
+		for (int i = lid; i < n; i += lsize) {
+			double sum = 0;
+			for (int j = 0; j < n; j++) {
+				sum += (cache_a ? la[j * n + i] : as[j * n + i]) * x0[j];
+			}
+			const double diag = cache_a ? la[i * n + i] : as[i * n + i];
+			const double next = (bs[i] - sum + diag * x0[i]) / diag;
+			residual += fabs((next - x0[i]) / x0[i]);
+			x1[i] = next;
+		}
+		scratch[lid] = residual;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (int step = lsize / 2; step > 0; step /= 2) {
+			if (lid < step) scratch[lid] += scratch[lid + step];
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+		total = scratch[0];
+		barrier(CLK_LOCAL_MEM_FENCE);
+		__local double* swap = x0;
+		x0 = x1;
+		x1 = swap;
+		iter++;
+		if (!(total > eps)) break;
+	}
+
+	for (int i = lid; i < n; i += lsize) x[(size_t)s * n + i] = x0[i];
+	if (lid == 0) {
+		iterations[s] = iter;
+		accuracy[s] = total;
+	}
+}
+
+// Kernels of the blocked LU and Cholesky factorizations (opencl_lu.h), in place on the row-major
+// n x n matrix a. A step factors the w columns from k on.
+
+// Row interchanges of an LU step in every column outside [k, k + w): rows k + i and pivots[i]
+// swap for i = 0 .. w - 1 in order.
+__kernel void swapRowsDouble(__global double* a,
+							 __global const int* pivots,
+							 int n,
+							 int k,
+							 int w) {
+	const int c = get_global_id(0);
+	if (c >= n || (c >= k && c < k + w)) return;
+	for (int i = 0; i < w; i++) {
+		const int p = pivots[i];
+		if (p != k + i) {
+			const double tmp = a[(size_t)(k + i) * n + c];
+			a[(size_t)(k + i) * n + c] = a[(size_t)p * n + c];
+			a[(size_t)p * n + c] = tmp;
+		}
+	}
+}
+
+// Row panel of an LU step, U12 = L11^-1 A12: L11 is the unit lower w x w block at (k, k), every
+// work-item solves one column c >= k + w by forward substitution.
+__kernel void trsmLowerDouble(__global double* a,
+							  int n,
+							  int k,
+							  int w) {
+	const int c = k + w + get_global_id(0);
+	if (c >= n) return;
+	for (int i = 1; i < w; i++) {
+		double x = a[(size_t)(k + i) * n + c];
+		for (int j = 0; j < i; j++) x -= a[(size_t)(k + i) * n + k + j] * a[(size_t)(k + j) * n + c];
+		a[(size_t)(k + i) * n + c] = x;
+	}
+}
+
+// Trailing update in the tiling of gemmDoubleBlock: C -= L U for the rows x cols block C at
+// (row0, col0), L is the rows x depth block at (row0, k) and U the depth x cols block at (k, col0).
+// Tiles past the edges are padded with zeros.
+#define GEMM_TILE 16
+__kernel void gemmUpdateDouble(__global double* a,
+							   int n,
+							   int row0,
+							   int col0,
+							   int k,
+							   int rows,
+							   int cols,
+							   int depth) {
+	__local double L[GEMM_TILE][GEMM_TILE];
+	__local double U[GEMM_TILE][GEMM_TILE];
+
+	const int local_row = get_local_id(1);
+	const int local_col = get_local_id(0);
+	const int row = get_global_id(1);
+	const int col = get_global_id(0);
+
+	double res = 0;
+	for (int p = 0; p < depth; p += GEMM_TILE) {
+		L[local_row][local_col] = row < rows && p + local_col < depth ? a[(size_t)(row0 + row) * n + k + p + local_col] : 0;
+		U[local_row][local_col] = p + local_row < depth && col < cols ? a[(size_t)(k + p + local_row) * n + col0 + col] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = 0; i < GEMM_TILE; i++) {
+			res += L[local_row][i] * U[i][local_col];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (row < rows && col < cols) a[(size_t)(row0 + row) * n + col0 + col] -= res;
+}
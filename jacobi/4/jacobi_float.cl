@@ -13,4 +13,1027 @@ __kernel void jacobiFloat(__global const float* a,
 
 	x1[j] = (b[j] - ans) / a[j * n + j];
 	delta[j] = (x1[j] - x0[j]) / x0[j];
-}
\ No newline at end of file
+}
+
+// Sum of |x[i]|: every work-group writes the sum of its part to partial[group]
+__kernel void reduceFloat(__global const float* x,
+						  __global float* partial,
+						  __local float* scratch,
+						  int n) {
+	const int lid = get_local_id(0);
+	float sum = 0;
+
+	for (int i = get_global_id(0); i < n; i += get_global_size(0)) {
+		sum += fabs(x[i]);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = get_local_size(0) / 2; step > 0; step /= 2) {
+		if (lid < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) partial[get_group_id(0)] = scratch[0];
+}
+
+// A work-group of (local0 x local1) work-items computes local1 rows: the local0 work-items of a row
+// read it with coalesced float4 loads, x0 is staged in tiles of 4 * local0 elements shared by the rows.
+// a[j * n + j] * x0[j] is included in the sum and taken back out after the reduction.
+__kernel void jacobiRowFloat(__global const float* a,
+						     __global const float* b,
+						     __global float* x0,
+						     __global float* x1,
+						     __global float* delta,
+						     int n,
+						     __local float* tile,
+						     __local float* scratch) {
+	const int lid0 = get_local_id(0);
+	const int lid1 = get_local_id(1);
+	const int local0 = get_local_size(0);
+	const int local1 = get_local_size(1);
+	const int lid = lid1 * local0 + lid0;
+	const int j = get_global_id(1);
+	const int width = 4 * local0;
+	const bool valid = j < n;
+	__global const float* row = a + (size_t)(valid ? j : 0) * n;
+	float sum = 0;
+
+	for (int start = 0; start < n; start += width) {
+		for (int t = lid; t < width; t += local0 * local1) {
+			tile[t] = start + t < n ? x0[start + t] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int i = start + 4 * lid0;
+		if (valid && i + 3 < n) {
+			float4 v = vload4(0, row + i);
+			float4 x = vload4(0, tile + 4 * lid0);
+			sum += dot(v, x);
+		}
+		else if (valid) {
+			for (int k = i; k < n; k++) sum += row[k] * tile[k - start];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = local0 / 2; step > 0; step /= 2) {
+		if (lid0 < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (valid && lid0 == 0) {
+		const float diagonal = row[j];
+		const float old = x0[j];
+		const float dx = (b[j] - scratch[lid]) / diagonal;
+		x1[j] = old + dx;
+		delta[j] = dx / old;
+	}
+}
+
+// Block SOR: a work-group of local0 work-items owns local0 consecutive rows. Rows of other blocks
+// use x0 (Jacobi between blocks), the rows of the block are relaxed one after another in local
+// memory (Gauss-Seidel inside the block). omega == 1 is block Gauss-Seidel.
+// tile holds local0 rows of A by SOR_TILE columns, padded by one to avoid bank conflicts.
+#define SOR_TILE 32
+__kernel void blockSorFloat(__global const float* a,
+						    __global const float* b,
+						    __global float* x0,
+						    __global float* x1,
+						    __global float* delta,
+						    int n,
+						    float omega,
+						    __local float* tile,
+						    __local float* dx) {
+	const int lid = get_local_id(0);
+	const int local0 = get_local_size(0);
+	const int first = get_group_id(0) * local0;
+	const int j = first + lid;
+	const int rows = min(local0, n - first);
+	float sum = 0;
+
+	// sum over all columns with x0, the tile loads are coalesced along the columns
+	for (int start = 0; start < n; start += SOR_TILE) {
+		for (int t = lid; t < local0 * SOR_TILE; t += local0) {
+			const int r = t / SOR_TILE;
+			const int c = t % SOR_TILE;
+			tile[r * (SOR_TILE + 1) + c] = r < rows && start + c < n ? a[(size_t)(first + r) * n + start + c] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (int c = 0; c < SOR_TILE && start + c < n; c++) {
+			sum += tile[lid * (SOR_TILE + 1) + c] * x0[start + c];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	// Gauss-Seidel inside the block: row r sees the updates dx of the rows before it
+	for (int r = 0; r < rows; r++) {
+		if (lid == r) {
+			dx[r] = omega * (b[j] - sum) / a[(size_t)j * n + j];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid > r && lid < rows) {
+			sum += a[(size_t)j * n + first + r] * dx[r];
+		}
+	}
+	if (lid < rows) {
+		x1[j] = x0[j] + dx[lid];
+		delta[j] = dx[lid] / x0[j];
+	}
+}
+
+// Half of a red-black SOR sweep: rows j with j % 2 == color are relaxed from x_in into x_out, the
+// rows of the other color are copied. Work-groups are laid out as in jacobiRowFloat over the rows of
+// one color, so the red half-sweep from x0 into x1 followed by the black one from x1 into x0 uses
+// the new red values in every black row.
+__kernel void redBlackFloat(__global const float* a,
+						    __global const float* b,
+						    __global const float* x_in,
+						    __global float* x_out,
+						    __global float* delta,
+						    int n,
+						    float omega,
+						    int color,
+						    __local float* tile,
+						    __local float* scratch) {
+	const int lid0 = get_local_id(0);
+	const int lid1 = get_local_id(1);
+	const int local0 = get_local_size(0);
+	const int local1 = get_local_size(1);
+	const int lid = lid1 * local0 + lid0;
+	const int j = 2 * get_global_id(1) + color;
+	const int other = 2 * get_global_id(1) + 1 - color;
+	const int width = 4 * local0;
+	const bool valid = j < n;
+	__global const float* row = a + (size_t)(valid ? j : 0) * n;
+	float sum = 0;
+
+	for (int start = 0; start < n; start += width) {
+		for (int t = lid; t < width; t += local0 * local1) {
+			tile[t] = start + t < n ? x_in[start + t] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int i = start + 4 * lid0;
+		if (valid && i + 3 < n) {
+			float4 v = vload4(0, row + i);
+			float4 x = vload4(0, tile + 4 * lid0);
+			sum += dot(v, x);
+		}
+		else if (valid) {
+			for (int k = i; k < n; k++) sum += row[k] * tile[k - start];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = local0 / 2; step > 0; step /= 2) {
+		if (lid0 < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid0 == 0 && valid) {
+		const float old = x_in[j];
+		const float dx = omega * (b[j] - scratch[lid]) / row[j];
+		x_out[j] = old + dx;
+		delta[j] = dx / old;
+	}
+	if (lid0 == 0 && other < n) {
+		x_out[other] = x_in[other];
+	}
+}
+
+// Kernels of the Krylov solvers (opencl_krylov.h).
+
+// y = A * x with the work-group layout of jacobiRowFloat
+__kernel void matvecFloat(__global const float* a,
+						  __global const float* x,
+						  __global float* y,
+						  int n,
+						  __local float* tile,
+						  __local float* scratch) {
+	const int lid0 = get_local_id(0);
+	const int lid1 = get_local_id(1);
+	const int local0 = get_local_size(0);
+	const int local1 = get_local_size(1);
+	const int lid = lid1 * local0 + lid0;
+	const int j = get_global_id(1);
+	const int width = 4 * local0;
+	const bool valid = j < n;
+	__global const float* row = a + (size_t)(valid ? j : 0) * n;
+	float sum = 0;
+
+	for (int start = 0; start < n; start += width) {
+		for (int t = lid; t < width; t += local0 * local1) {
+			tile[t] = start + t < n ? x[start + t] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int i = start + 4 * lid0;
+		if (valid && i + 3 < n) {
+			sum += dot(vload4(0, row + i), vload4(0, tile + 4 * lid0));
+		}
+		else if (valid) {
+			for (int k = i; k < n; k++) sum += row[k] * tile[k - start];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = local0 / 2; step > 0; step /= 2) {
+		if (lid0 < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (valid && lid0 == 0) y[j] = scratch[lid];
+}
+
+// Every work-group writes its part of x . y to partial[group]
+__kernel void dotFloat(__global const float* x,
+					   __global const float* y,
+					   __global float* partial,
+					   __local float* scratch,
+					   int n) {
+	const int lid = get_local_id(0);
+	float sum = 0;
+
+	for (int i = get_global_id(0); i < n; i += get_global_size(0)) {
+		sum += x[i] * y[i];
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = get_local_size(0) / 2; step > 0; step /= 2) {
+		if (lid < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) partial[get_group_id(0)] = scratch[0];
+}
+
+// result[slot] = sum of partial[0..n), one work-group
+__kernel void sumFloat(__global const float* partial,
+					   __global float* result,
+					   __local float* scratch,
+					   int n,
+					   int slot) {
+	const int lid = get_local_id(0);
+	float sum = 0;
+
+	for (int i = lid; i < n; i += get_local_size(0)) {
+		sum += partial[i];
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = get_local_size(0) / 2; step > 0; step /= 2) {
+		if (lid < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) result[slot] = scratch[0];
+}
+
+// y = alpha * x + beta * y
+__kernel void axpbyFloat(float alpha,
+						 __global const float* x,
+						 float beta,
+						 __global float* y,
+						 int n) {
+	const int i = get_global_id(0);
+	if (i < n) y[i] = alpha * x[i] + beta * y[i];
+}
+
+// Jacobi preconditioner: z = r / diag(A)
+__kernel void diagScaleFloat(__global const float* a,
+						     __global const float* r,
+						     __global float* z,
+						     int n) {
+	const int i = get_global_id(0);
+	if (i < n) z[i] = r[i] / a[(size_t)i * n + i];
+}
+
+// Kernels of the multiple right-hand side Jacobi (opencl_jacobi_multi).
+
+// upper bound of the columns of one solve
+#define MAX_RHS 32
+
+// One Jacobi sweep on the n x r block X (row-major): a work-group of local0 work-items owns row j,
+// every element of the row is loaded once and applied to all r columns. Columns with active[c] == 0
+// are copied and get delta = 0. scratch holds local0 * r sums.
+__kernel void jacobiMultiFloat(__global const float* a,
+							   __global const float* b,
+							   __global float* x0,
+							   __global float* x1,
+							   __global float* delta,
+							   __global const int* active,
+							   int n,
+							   int r,
+							   __local float* scratch) {
+	const int lid = get_local_id(0);
+	const int local0 = get_local_size(0);
+	const int j = get_group_id(0);
+	__global const float* row = a + (size_t)j * n;
+	float sum[MAX_RHS];
+
+	for (int c = 0; c < r; c++) sum[c] = 0;
+	for (int i = lid; i < n; i += local0) {
+		const float aji = row[i];
+		for (int c = 0; c < r; c++) sum[c] += aji * x0[i * r + c];
+	}
+	for (int c = 0; c < r; c++) scratch[c * local0 + lid] = sum[c];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = local0 / 2; step > 0; step /= 2) {
+		if (lid < step) {
+			for (int c = 0; c < r; c++) scratch[c * local0 + lid] += scratch[c * local0 + lid + step];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	for (int c = lid; c < r; c += local0) {
+		const int k = j * r + c;
+		const float old = x0[k];
+		const float dx = active[c] ? (b[k] - scratch[c * local0]) / row[j] : 0;
+		x1[k] = old + dx;
+		delta[k] = dx / old;
+	}
+}
+
+// Per column convergence: one work-group per column sums |delta| into residual[c], counts the
+// sweep in iterations[c] and clears active[c] once the column is below eps.
+__kernel void maskColumnsFloat(__global const float* delta,
+							   __global float* residual,
+							   __global int* active,
+							   __global int* iterations,
+							   __local float* scratch,
+							   int n,
+							   int r,
+							   float eps) {
+	const int lid = get_local_id(0);
+	const int c = get_group_id(0);
+	float sum = 0;
+
+	for (int j = lid; j < n; j += get_local_size(0)) {
+		sum += fabs(delta[j * r + c]);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = get_local_size(0) / 2; step > 0; step /= 2) {
+		if (lid < step) scratch[lid] += scratch[lid + step];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0 && active[c]) {
+		residual[c] = scratch[0];
+		iterations[c]++;
+		active[c] = scratch[0] > eps;
+	}
+}
+
+// Kernels of the mixed precision iterative refinement (opencl_refinement.h). Values carried beyond
+// float precision are unevaluated sums hi + lo of two floats.
+
+// s + e == a + b exactly
+inline float two_sum(float a, float b, float* e) {
+	const float s = a + b;
+	const float bb = s - a;
+	*e = (a - (s - bb)) + (b - bb);
+	return s;
+}
+
+// r = b - A * x with A = a_hi + a_lo, x = x_hi + x_lo, b = b_hi + b_lo, the products and sums
+// are compensated. A work-group of local0 work-items owns row j, scratch holds 2 * local0 floats.
+__kernel void residualSplitFloat(__global const float* a_hi,
+								 __global const float* a_lo,
+								 __global const float* b_hi,
+								 __global const float* b_lo,
+								 __global const float* x_hi,
+								 __global const float* x_lo,
+								 __global float* r,
+								 int n,
+								 __local float* scratch) {
+	const int lid = get_local_id(0);
+	const int local0 = get_local_size(0);
+	const int j = get_group_id(0);
+	const size_t row = (size_t)j * n;
+	float hi = 0, lo = 0, e;
+
+	for (int i = lid; i < n; i += local0) {
+		const float p = a_hi[row + i] * x_hi[i];
+		const float p_lo = fma(a_hi[row + i], x_hi[i], -p) + a_hi[row + i] * x_lo[i] + a_lo[row + i] * x_hi[i];
+		hi = two_sum(hi, p, &e);
+		lo += e + p_lo;
+	}
+	scratch[lid] = hi;
+	scratch[local0 + lid] = lo;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = local0 / 2; step > 0; step /= 2) {
+		if (lid < step) {
+			hi = two_sum(scratch[lid], scratch[lid + step], &e);
+			scratch[lid] = hi;
+			scratch[local0 + lid] += scratch[local0 + lid + step] + e;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) {
+		hi = two_sum(b_hi[j], -scratch[0], &e);
+		r[j] = hi + (e + b_lo[j] - scratch[local0]);
+	}
+}
+
+// x_hi + x_lo += d
+__kernel void refineFloat(__global float* x_hi,
+						  __global float* x_lo,
+						  __global const float* d,
+						  int n) {
+	const int i = get_global_id(0);
+	if (i >= n) return;
+	float e;
+	const float s = two_sum(x_hi[i], d[i], &e);
+	e += x_lo[i];
+	const float hi = s + e;
+	x_hi[i] = hi;
+	x_lo[i] = e - (hi - s);
+}
+
+// Double precision emulated with floats for devices with slow or no fp64 (opencl_split.h): a value
+// is the unevaluated sum x + y of a float2, about 48 significant bits.
+
+// s + e == a + b exactly, needs |a| >= |b|
+inline float2 quick_two_sum(float a, float b) {
+	const float s = a + b;
+	return (float2)(s, b - (s - a));
+}
+
+inline float2 df_add(float2 a, float2 b) {
+	float e, f;
+	const float s = two_sum(a.x, b.x, &e);
+	const float t = two_sum(a.y, b.y, &f);
+	const float2 r = quick_two_sum(s, e + t);
+	return quick_two_sum(r.x, r.y + f);
+}
+
+// the low part of a.x * b.x comes exactly from fma
+inline float2 df_mul(float2 a, float2 b) {
+	const float p = a.x * b.x;
+	return quick_two_sum(p, fma(a.x, b.x, -p) + (a.x * b.y + a.y * b.x));
+}
+
+// three float quotients, each one corrects the remainder of the previous ones
+inline float2 df_div(float2 a, float2 b) {
+	const float q1 = a.x / b.x;
+	float2 r = df_add(a, -df_mul(b, (float2)(q1, 0.0f)));
+	const float q2 = r.x / b.x;
+	r = df_add(r, -df_mul(b, (float2)(q2, 0.0f)));
+	const float q3 = r.x / b.x;
+	return df_add(quick_two_sum(q1, q2), (float2)(q3, 0.0f));
+}
+
+// jacobiRowFloat on float pairs: local0 work-items share a row and read it coalesced, x0 is staged
+// in tiles of 4 * local0 pairs. delta is the relative change as a plain float.
+__kernel void jacobiRowSplitFloat(__global const float2* a,
+								  __global const float2* b,
+								  __global float2* x0,
+								  __global float2* x1,
+								  __global float* delta,
+								  int n,
+								  __local float2* tile,
+								  __local float2* scratch) {
+	const int lid0 = get_local_id(0);
+	const int lid1 = get_local_id(1);
+	const int local0 = get_local_size(0);
+	const int local1 = get_local_size(1);
+	const int lid = lid1 * local0 + lid0;
+	const int j = get_global_id(1);
+	const int width = 4 * local0;
+	const bool valid = j < n;
+	__global const float2* row = a + (size_t)(valid ? j : 0) * n;
+	float2 sum = (float2)(0.0f, 0.0f);
+
+	for (int start = 0; start < n; start += width) {
+		for (int t = lid; t < width; t += local0 * local1) {
+			tile[t] = start + t < n ? x0[start + t] : (float2)(0.0f, 0.0f);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		if (valid) {
+			for (int t = lid0; t < width && start + t < n; t += local0) {
+				sum = df_add(sum, df_mul(row[start + t], tile[t]));
+			}
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	scratch[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int step = local0 / 2; step > 0; step /= 2) {
+		if (lid0 < step) scratch[lid] = df_add(scratch[lid], scratch[lid + step]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (valid && lid0 == 0) {
+		const float2 old = x0[j];
+		const float2 dx = df_div(df_add(b[j], -scratch[lid]), row[j]);
+		x1[j] = df_add(old, dx);
+		delta[j] = dx.x / old.x;
+	}
+}
+
+// Matrix-free Jacobi for structured grids (opencl_stencil.h). The operator is
+// center * u[p] + cx * (u[p - 1] + u[p + 1]) + cy * (u[p - nx] + u[p + nx]) (+ cz for the z neighbours),
+// points outside the grid are 0 (Dirichlet boundary). A work-group loads a tile with a halo of sweeps
+// points into local memory and makes sweeps Jacobi sweeps on it; the valid part shrinks by one point
+// per sweep, so only the interior of the tile is written back. delta is the change of the last sweep.
+__kernel void stencil2dFloat(__global const float* f,
+							 __global const float* u0,
+							 __global float* u1,
+							 __global float* delta,
+							 int nx,
+							 int ny,
+							 float center,
+							 float cx,
+							 float cy,
+							 int sweeps,
+							 __local float* tile) {
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int size_x = get_local_size(0);
+	const int size_y = get_local_size(1);
+	const int x = get_group_id(0) * (size_x - 2 * sweeps) + lx - sweeps;
+	const int y = get_group_id(1) * (size_y - 2 * sweeps) + ly - sweeps;
+	const bool inside = x >= 0 && x < nx && y >= 0 && y < ny;
+	const bool edge = lx == 0 || lx == size_x - 1 || ly == 0 || ly == size_y - 1;
+	const int l = ly * size_x + lx;
+	const size_t p = (size_t)y * nx + x;
+	const float rhs = inside ? f[p] : 0;
+	float u = inside ? u0[p] : 0;
+	float prev = u;
+
+	tile[l] = u;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (int s = 0; s < sweeps; s++) {
+		prev = u;
+		if (inside && !edge) {
+			u = (rhs - cx * (tile[l - 1] + tile[l + 1]) - cy * (tile[l - size_x] + tile[l + size_x])) / center;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		tile[l] = u;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (inside && lx >= sweeps && lx < size_x - sweeps && ly >= sweeps && ly < size_y - sweeps) {
+		u1[p] = u;
+		delta[p] = (u - prev) / prev;
+	}
+}
+
+__kernel void stencil3dFloat(__global const float* f,
+							 __global const float* u0,
+							 __global float* u1,
+							 __global float* delta,
+							 int nx,
+							 int ny,
+							 int nz,
+							 float center,
+							 float cx,
+							 float cy,
+							 float cz,
+							 int sweeps,
+							 __local float* tile) {
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lz = get_local_id(2);
+	const int size_x = get_local_size(0);
+	const int size_y = get_local_size(1);
+	const int size_z = get_local_size(2);
+	const int x = get_group_id(0) * (size_x - 2 * sweeps) + lx - sweeps;
+	const int y = get_group_id(1) * (size_y - 2 * sweeps) + ly - sweeps;
+	const int z = get_group_id(2) * (size_z - 2 * sweeps) + lz - sweeps;
+	const bool inside = x >= 0 && x < nx && y >= 0 && y < ny && z >= 0 && z < nz;
+	const bool edge = lx == 0 || lx == size_x - 1 || ly == 0 || ly == size_y - 1 || lz == 0 || lz == size_z - 1;
+	const int plane = size_x * size_y;
+	const int l = lz * plane + ly * size_x + lx;
+	const size_t p = ((size_t)z * ny + y) * nx + x;
+	const float rhs = inside ? f[p] : 0;
+	float u = inside ? u0[p] : 0;
+	float prev = u;
+
+	tile[l] = u;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (int s = 0; s < sweeps; s++) {
+		prev = u;
+		if (inside && !edge) {
+			u = (rhs - cx * (tile[l - 1] + tile[l + 1]) - cy * (tile[l - size_x] + tile[l + size_x])
+				- cz * (tile[l - plane] + tile[l + plane])) / center;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		tile[l] = u;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (inside && lx >= sweeps && lx < size_x - sweeps && ly >= sweeps && ly < size_y - sweeps
+		&& lz >= sweeps && lz < size_z - sweeps) {
+		u1[p] = u;
+		delta[p] = (u - prev) / prev;
+	}
+}
+
+// Sparse Jacobi sweeps (opencl_sparse.h), one work-item per row. The diagonal stays in the row
+// and is taken out as in jacobiRowFloat: x1 = x0 + (b - row . x0) / diag.
+
+// CSR: the entries of a row are contiguous, accesses of neighbouring work-items are not
+__kernel void jacobiCsrFloat(__global const float* val,
+							 __global const int* col,
+							 __global float* x0,
+							 __global float* x1,
+							 __global float* delta,
+							 __global const float* b,
+							 __global const float* diag,
+							 int n,
+							 __global const int* row_ptr) {
+	const int j = get_global_id(0);
+	if (j >= n) return;
+	float sum = 0;
+
+	for (int k = row_ptr[j]; k < row_ptr[j + 1]; k++) {
+		sum += val[k] * x0[col[k]];
+	}
+	const float dx = (b[j] - sum) / diag[j];
+	x1[j] = x0[j] + dx;
+	delta[j] = dx / x0[j];
+}
+
+// ELLPACK: entry k of row j at k * n + j, neighbouring work-items read neighbouring entries
+__kernel void jacobiEllFloat(__global const float* val,
+							 __global const int* col,
+							 __global float* x0,
+							 __global float* x1,
+							 __global float* delta,
+							 __global const float* b,
+							 __global const float* diag,
+							 int n,
+							 int width) {
+	const int j = get_global_id(0);
+	if (j >= n) return;
+	float sum = 0;
+
+	for (int k = 0; k < width; k++) {
+		const size_t p = (size_t)k * n + j;
+		sum += val[p] * x0[col[p]];
+	}
+	const float dx = (b[j] - sum) / diag[j];
+	x1[j] = x0[j] + dx;
+	delta[j] = dx / x0[j];
+}
+
+// SELL-C-sigma: work-item t handles the row perm[t] of slice t / c
+__kernel void jacobiSellFloat(__global const float* val,
+							  __global const int* col,
+							  __global float* x0,
+							  __global float* x1,
+							  __global float* delta,
+							  __global const float* b,
+							  __global const float* diag,
+							  int n,
+							  __global const int* slice_ptr,
+							  __global const int* perm,
+							  int c) {
+	const int t = get_global_id(0);
+	const int slice = t / c;
+	const int j = perm[t];
+	if (j < 0) return;
+	const int width = (slice_ptr[slice + 1] - slice_ptr[slice]) / c;
+	float sum = 0;
+
+	for (int k = 0; k < width; k++) {
+		const size_t p = slice_ptr[slice] + (size_t)k * c + t % c;
+		sum += val[p] * x0[col[p]];
+	}
+	const float dx = (b[j] - sum) / diag[j];
+	x1[j] = x0[j] + dx;
+	delta[j] = dx / x0[j];
+}
+
+// Kernels of the geometric multigrid (opencl_multigrid.h) on the grids of stencil3dFloat, one
+// work-item per point, x fastest. An axis is coarsened when the coarse size differs from the fine
+// one: fine point 2 * i + 1 lies on coarse point i. Values outside the grid are 0.
+
+inline float mg_at(__global const float* u, int x, int y, int z, int nx, int ny, int nz) {
+	return x >= 0 && x < nx && y >= 0 && y < ny && z >= 0 && z < nz ? u[((size_t)z * ny + y) * nx + x] : 0;
+}
+
+inline float mg_apply(__global const float* u, int x, int y, int z, int nx, int ny, int nz, float center, float cx, float cy, float cz) {
+	return center * mg_at(u, x, y, z, nx, ny, nz)
+		+ cx * (mg_at(u, x - 1, y, z, nx, ny, nz) + mg_at(u, x + 1, y, z, nx, ny, nz))
+		+ cy * (mg_at(u, x, y - 1, z, nx, ny, nz) + mg_at(u, x, y + 1, z, nx, ny, nz))
+		+ cz * (mg_at(u, x, y, z - 1, nx, ny, nz) + mg_at(u, x, y, z + 1, nx, ny, nz));
+}
+
+// weighted Jacobi: u1 = u0 + omega * (f - A u0) / center
+__kernel void mgSmoothFloat(__global const float* f,
+							__global const float* u0,
+							__global float* u1,
+							int nx,
+							int ny,
+							int nz,
+							float center,
+							float cx,
+							float cy,
+							float cz,
+							float omega) {
+	const int x = get_global_id(0), y = get_global_id(1), z = get_global_id(2);
+	if (x >= nx || y >= ny || z >= nz) return;
+	const size_t p = ((size_t)z * ny + y) * nx + x;
+	u1[p] = u0[p] + omega * (f[p] - mg_apply(u0, x, y, z, nx, ny, nz, center, cx, cy, cz)) / center;
+}
+
+// r = f - A u
+__kernel void mgResidualFloat(__global const float* f,
+							  __global const float* u,
+							  __global float* r,
+							  int nx,
+							  int ny,
+							  int nz,
+							  float center,
+							  float cx,
+							  float cy,
+							  float cz) {
+	const int x = get_global_id(0), y = get_global_id(1), z = get_global_id(2);
+	if (x >= nx || y >= ny || z >= nz) return;
+	const size_t p = ((size_t)z * ny + y) * nx + x;
+	r[p] = f[p] - mg_apply(u, x, y, z, nx, ny, nz, center, cx, cy, cz);
+}
+
+// full weighting, one work-item per coarse point: weights 1/4 1/2 1/4 along the coarsened axes
+__kernel void mgRestrictFloat(__global const float* r,
+							  __global float* f,
+							  int nx,
+							  int ny,
+							  int nz,
+							  int cnx,
+							  int cny,
+							  int cnz) {
+	const int x = get_global_id(0), y = get_global_id(1), z = get_global_id(2);
+	if (x >= cnx || y >= cny || z >= cnz) return;
+	const int sx = cnx != nx, sy = cny != ny, sz = cnz != nz;
+	const int fx = sx ? 2 * x + 1 : x, fy = sy ? 2 * y + 1 : y, fz = sz ? 2 * z + 1 : z;
+	float sum = 0;
+	for (int dz = -sz; dz <= sz; dz++) {
+		for (int dy = -sy; dy <= sy; dy++) {
+			for (int dx = -sx; dx <= sx; dx++) {
+				const float w = (dx ? 0.25f : (sx ? 0.5f : 1)) * (dy ? 0.25f : (sy ? 0.5f : 1)) * (dz ? 0.25f : (sz ? 0.5f : 1));
+				sum += w * mg_at(r, fx + dx, fy + dy, fz + dz, nx, ny, nz);
+			}
+		}
+	}
+	f[((size_t)z * cny + y) * cnx + x] = sum;
+}
+
+// u += linear interpolation of the coarse correction, one work-item per fine point
+__kernel void mgProlongFloat(__global const float* e,
+							 __global float* u,
+							 int nx,
+							 int ny,
+							 int nz,
+							 int cnx,
+							 int cny,
+							 int cnz) {
+	const int x = get_global_id(0), y = get_global_id(1), z = get_global_id(2);
+	if (x >= nx || y >= ny || z >= nz) return;
+	const int sx = cnx != nx, sy = cny != ny, sz = cnz != nz;
+	// coarse neighbours along every axis: one on a coarse point, two in between
+	const int x0 = sx ? (x - 1) >> 1 : x, y0 = sy ? (y - 1) >> 1 : y, z0 = sz ? (z - 1) >> 1 : z;
+	const int x1 = sx && !(x & 1) ? x0 + 1 : x0, y1 = sy && !(y & 1) ? y0 + 1 : y0, z1 = sz && !(z & 1) ? z0 + 1 : z0;
+	const float wx = x1 != x0 ? 0.5f : 1, wy = y1 != y0 ? 0.5f : 1, wz = z1 != z0 ? 0.5f : 1;
+	float sum = 0;
+	for (int cz = z0; cz <= z1; cz++) {
+		for (int cy = y0; cy <= y1; cy++) {
+			for (int cx = x0; cx <= x1; cx++) {
+				sum += mg_at(e, cx, cy, cz, cnx, cny, cnz);
+			}
+		}
+	}
+	u[((size_t)z * ny + y) * nx + x] += wx * wy * wz * sum;
+}
+
+// Global barrier of the persistent kernels: the work-groups must all be resident, which holds for
+// one work-group per compute unit. count is the number of arrived groups, generation flips
+// when the last one arrives; both start at 0.
+inline void global_barrier(volatile __global int* count, volatile __global int* generation) {
+	barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+	if (get_local_id(0) == 0) {
+		const int current = atomic_add(generation, 0);
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+		if (atomic_inc(count) == get_num_groups(0) - 1) {
+			atomic_xchg(count, 0);
+			atomic_inc(generation);
+		}
+		else {
+			while (atomic_add(generation, 0) == current);
+		}
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+}
+
+// A whole Jacobi solve in one launch: a fixed grid of work-groups loops over the sweeps, a
+// work-group computes every num_groups-th row with its work-items sharing the dot product.
+// After each sweep the groups meet at the global barrier, every group sums the per-group
+// residuals (double buffered by sweep parity) itself, so all of them stop at the same sweep
+// without a second barrier. x0 and x1 swap roles every sweep: after an odd number of sweeps the
+// answer is in x1. sync holds the barrier state (two ints, zero), iterations and accuracy
+// receive the number of sweeps and the last residual. All the groups must be resident at once
+// or the barrier never opens, the host launches at most one per compute unit.
+__kernel void jacobiPersistentFloat(__global const float* a,
+									__global const float* b,
+									__global float* x0,
+									__global float* x1,
+									__global float* partial,
+									volatile __global int* sync,
+									__global int* iterations,
+									__global float* accuracy,
+									__local float* scratch,
+									int n,
+									float eps,
+									int max_iter) {
+	const int lid = get_local_id(0);
+	const int group = get_group_id(0);
+	const int groups = get_num_groups(0);
+	__global float* from = x0;
+	__global float* to = x1;
+	__local int done;
+	float total = 0;
+	int iter = 0;
+
+	while (iter < max_iter) {
+		float residual = 0;
+		for (int row = group; row < n; row += groups) {
+			float sum = 0;
+			for (int i = lid; i < n; i += get_local_size(0)) {
+				sum += a[(size_t)row * n + i] * from[i];
+			}
+			scratch[lid] = sum;
+			barrier(CLK_LOCAL_MEM_FENCE);
+			for (int step = get_local_size(0) / 2; step > 0; step /= 2) {
+				if (lid < step) scratch[lid] += scratch[lid + step];
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+			if (lid == 0) {
+				// the diagonal term is in the sum, x = from + (b - sum) / diagonal takes it back out
+				const float x = from[row] + (b[row] - scratch[0]) / a[(size_t)row * n + row];
+				residual += fabs((x - from[row]) / from[row]);
+				to[row] = x;
+			}
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+		if (lid == 0) partial[(iter & 1) * groups + group] = residual;
+		global_barrier(sync, sync + 1);
+
+		iter++;
+		if (lid == 0) {
+			total = 0;
+			for (int g = 0; g < groups; g++) total += partial[((iter - 1) & 1) * groups + g];
+			done = !(total > eps);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		__global float* swap = from;
+		from = to;
+		to = swap;
+		if (done) break;
+	}
+	if (group == 0 && lid == 0) {
+		*iterations = iter;
+		*accuracy = total;
+	}
+}
+
+// Batched Jacobi for many independent systems of the same n, one work-group per system. System s
+// has A at a + s * n * n stored column-major (a[j * n + i] is A[i][j], so neighbouring work-items
+// read neighbouring addresses), b and x at s * n. x stays in local memory for the whole solve and
+// so does A when cache_a is set (la holds n * n values then). The work-group sweeps until
+// sum(|(x1 - x0) / x0|) <= eps or max_iter and leaves, a converged system frees its compute unit.
+__kernel void jacobiBatchFloat(__global const float* a,
+							   __global const float* b,
+							   __global float* x,
+							   __global int* iterations,
+							   __global float* accuracy,
+							   __local float* la,
+							   __local float* x0,
+							   __local float* x1,
+							   __local float* scratch,
+							   int n,
+							   int cache_a,
+							   float eps,
+							   int max_iter) {
+	const int s = get_group_id(0);
+	const int lid = get_local_id(0);
+	const int lsize = get_local_size(0);
+	__global const float* as = a + (size_t)s * n * n;
+	__global const float* bs = b + (size_t)s * n;
+	if (cache_a) {
+		for (int k = lid; k < n * n; k += lsize) la[k] = as[k];
+	}
+	for (int i = lid; i < n; i += lsize) x0[i] = x[(size_t)s * n + i];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	float total = 0;
+	int iter = 0;
+	while (iter < max_iter) {
+		float residual = 0;
+		for (int i = lid; i < n; i += lsize) {
+			float sum = 0;
+			for (int j = 0; j < n; j++) {
+				sum += (cache_a ? la[j * n + i] : as[j * n + i]) * x0[j];
+			}
+			const float diag = cache_a ? la[i * n + i] : as[i * n + i];
+			const float next = (bs[i] - sum + diag * x0[i]) / diag;
+			residual += fabs((next - x0[i]) / x0[i]);
+			x1[i] = next;
+		}
+		scratch[lid] = residual;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (int step = lsize / 2; step > 0; step /= 2) {
+			if (lid < step) scratch[lid] += scratch[lid + step];
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+		total = scratch[0];
+		barrier(CLK_LOCAL_MEM_FENCE);
+		__local float* swap = x0;
+		x0 = x1;
+		x1 = swap;
+		iter++;
+		if (!(total > eps)) break;
+	}
+
+	for (int i = lid; i < n; i += lsize) x[(size_t)s * n + i] = x0[i];
+	if (lid == 0) {
+		iterations[s] = iter;
+		accuracy[s] = total;
+	}
+}
+
+// Kernels of the blocked LU and Cholesky factorizations (opencl_lu.h), in place on the row-major
+// n x n matrix a. A step factors the w columns from k on.
+
+// Row interchanges of an LU step in every column outside [k, k + w): rows k + i and pivots[i]
+// swap for i = 0 .. w - 1 in order.
+__kernel void swapRowsFloat(__global float* a,
+							__global const int* pivots,
+							int n,
+							int k,
+							int w) {
+	const int c = get_global_id(0);
+	if (c >= n || (c >= k && c < k + w)) return;
+	for (int i = 0; i < w; i++) {
+		const int p = pivots[i];
+		if (p != k + i) {
+			const float tmp = a[(size_t)(k + i) * n + c];
+			a[(size_t)(k + i) * n + c] = a[(size_t)p * n + c];
+			a[(size_t)p * n + c] = tmp;
+		}
+	}
+}
+
+// Row panel of an LU step, U12 = L11^-1 A12: L11 is the unit lower w x w block at (k, k), every
+// work-item solves one column c >= k + w by forward substitution.
+__kernel void trsmLowerFloat(__global float* a,
+							 int n,
+							 int k,
+							 int w) {
+	const int c = k + w + get_global_id(0);
+	if (c >= n) return;
+	for (int i = 1; i < w; i++) {
+		float x = a[(size_t)(k + i) * n + c];
+		for (int j = 0; j < i; j++) x -= a[(size_t)(k + i) * n + k + j] * a[(size_t)(k + j) * n + c];
+		a[(size_t)(k + i) * n + c] = x;
+	}
+}
+
+// Trailing update in the tiling of gemmFloatBlock: C -= L U for the rows x cols block C at
+// (row0, col0), L is the rows x depth block at (row0, k) and U the depth x cols block at (k, col0).
+// Tiles past the edges are padded with zeros.
+#define GEMM_TILE 16
+__kernel void gemmUpdateFloat(__global float* a,
+							  int n,
+							  int row0,
+							  int col0,
+							  int k,
+							  int rows,
+							  int cols,
+							  int depth) {
+	__local float L[GEMM_TILE][GEMM_TILE];
+	__local float U[GEMM_TILE][GEMM_TILE];
+
+	const int local_row = get_local_id(1);
+	const int local_col = get_local_id(0);
+	const int row = get_global_id(1);
+	const int col = get_global_id(0);
+
+	float res = 0;
+	for (int p = 0; p < depth; p += GEMM_TILE) {
+		L[local_row][local_col] = row < rows && p + local_col < depth ? a[(size_t)(row0 + row) * n + k + p + local_col] : 0;
+		U[local_row][local_col] = p + local_row < depth && col < cols ? a[(size_t)(k + p + local_row) * n + col0 + col] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = 0; i < GEMM_TILE; i++) {
+			res += L[local_row][i] * U[i][local_col];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (row < rows && col < cols) a[(size_t)(row0 + row) * n + col0 + col] -= res;
+}
@@ -5,6 +5,21 @@
 #include <chrono>
 #include <cassert>
 #include "opencl_jacobi.h"
+#include "openmp_jacobi.h"
+#include "opencl_gauss_seidel.h"
+#include "opencl_krylov.h"
+#include "opencl_jacobi_multi.h"
+#include "opencl_refinement.h"
+#include "opencl_stencil.h"
+#include "opencl_sparse.h"
+#include "opencl_multigrid.h"
+#include "binary_matrix.h"
+#include "opencl_persistent.h"
+#include "opencl_chebyshev.h"
+#include "opencl_batched.h"
+#include "opencl_resident.h"
+#include "opencl_split.h"
+#include "opencl_lu.h"
 std::mt19937 gen(std::chrono::high_resolution_clock::now().time_since_epoch().count());
 const int n = 64 * 200;
 
@@ -64,6 +79,324 @@ void print_matrix(int n, int m, T* matrix, const char* message) {
 	}
 }
 
+// Single launch and Chebyshev Jacobi and Gauss-Seidel type solvers on the same system and starting point as Jacobi
+template<typename T>
+void compare_solvers(int platform_index, T* a, T* b, T* x0, T* x1, T* delta, char* filename, T eps, const char* device) {
+	std::cout << "\npersistent jacobi\n";
+	for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
+	auto persistent_time = opencl_jacobi_persistent(platform_index, n, a, b, x0, x1, delta, filename, eps);
+	std::cout << "opencl persistent jacobi " << device << " = \t" << persistent_time << '\n';
+
+	std::cout << "\nchebyshev jacobi\n";
+	for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
+	auto chebyshev_time = opencl_chebyshev(platform_index, n, a, b, x0, x1, delta, filename, eps);
+	std::cout << "opencl chebyshev jacobi " << device << " = \t" << chebyshev_time << '\n';
+
+	std::cout << "\ngauss-seidel\n";
+	for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
+	auto time = opencl_gauss_seidel(platform_index, n, a, b, x0, x1, delta, filename, eps);
+	std::cout << "opencl gauss-seidel " << device << " = \t" << time << '\n';
+
+	std::cout << "\nsor omega = 1.2\n";
+	for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
+	time = opencl_sor(platform_index, n, a, b, x0, x1, delta, filename, T(1.2), eps);
+	std::cout << "opencl sor " << device << " = \t" << time << '\n';
+
+	std::cout << "\nred-black\n";
+	for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
+	time = opencl_red_black(platform_index, n, a, b, x0, x1, delta, filename, T(1), eps);
+	std::cout << "opencl red-black " << device << " = \t" << time << '\n';
+}
+
+// Iterative refinement solves double systems with float sweeps, nothing to compare for float.
+void compare_refinement(float* a, float* b, float* x) {}
+
+void compare_refinement(double* a, double* b, double* x) {
+	std::cout << "\nMIXED PRECISION REFINEMENT\n******************************************************************\n";
+	const int platforms[2] = { 2, 1 };
+	const char* devices[2] = { "cpu", "gpu" };
+	for (int d = 0; d < 2; d++) {
+		if (!has_platform(platforms[d])) continue;
+		for (int i = 0; i < n; i++) x[i] = 0;
+		auto time = opencl_refinement(platforms[d], n, a, b, x, (char*)"jacobi_float.cl", 1e-12);
+		std::cout << "opencl refinement " << devices[d] << " = \t" << time << '\n';
+	}
+}
+
+// Poisson problems without a matrix: 5-point 2D and 7-point 3D Laplacian
+template<typename T>
+void compare_stencil(char* filename, T eps) {
+	std::cout << "\nSTENCIL\n******************************************************************\n";
+	const stencil grids[2] = { { 2048, 2048, 1, 4, -1, -1, 0 }, { 128, 128, 128, 6, -1, -1, -1 } };
+	const int platforms[2] = { 2, 1 };
+	const char* devices[2] = { "cpu", "gpu" };
+	for (const stencil& grid : grids) {
+		int size = grid.nx * grid.ny * grid.nz;
+		T* f = new T[size];
+		T* u0 = new T[size];
+		T* u1 = new T[size];
+		T* delta = new T[size];
+		for (int i = 0; i < size; i++) f[i] = T(gen()) / size, delta[i] = 0;
+		for (int d = 0; d < 2; d++) {
+			if (!has_platform(platforms[d])) continue;
+			std::cout << '\n' << grid.nx << 'x' << grid.ny << 'x' << grid.nz << '\n';
+			for (int i = 0; i < size; i++) u0[i] = gen(), u1[i] = 0;
+			auto time = opencl_stencil_jacobi(platforms[d], grid, f, u0, u1, delta, filename, eps);
+			std::cout << "opencl stencil jacobi " << devices[d] << " = \t" << time << '\n';
+		}
+		delete[] f;
+		delete[] u0;
+		delete[] u1;
+		delete[] delta;
+	}
+}
+
+// The same Poisson problems by multigrid, sizes 2^k - 1 so that every level coarsens exactly
+template<typename T>
+void compare_multigrid(char* filename, T eps) {
+	std::cout << "\nMULTIGRID\n******************************************************************\n";
+	const stencil grids[2] = { { 2047, 2047, 1, 4, -1, -1, 0 }, { 127, 127, 127, 6, -1, -1, -1 } };
+	const int platforms[2] = { 2, 1 };
+	const char* devices[2] = { "cpu", "gpu" };
+	const char* cycles[2] = { "V", "W" };
+	for (const stencil& grid : grids) {
+		int size = grid.nx * grid.ny * grid.nz;
+		T* f = new T[size];
+		T* u0 = new T[size];
+		T* u1 = new T[size];
+		T* r = new T[size];
+		for (int i = 0; i < size; i++) f[i] = T(gen()) / size, r[i] = 0;
+		for (int d = 0; d < 2; d++) {
+			if (!has_platform(platforms[d])) continue;
+			for (int gamma = 1; gamma <= 2; gamma++) {
+				std::cout << '\n' << grid.nx << 'x' << grid.ny << 'x' << grid.nz << ' ' << cycles[gamma - 1] << "-cycle\n";
+				for (int i = 0; i < size; i++) u0[i] = 0, u1[i] = 0;
+				auto time = opencl_multigrid(platforms[d], grid, f, u0, u1, r, filename, eps, gamma);
+				std::cout << "opencl multigrid " << devices[d] << " = \t" << time << '\n';
+			}
+		}
+		delete[] f;
+		delete[] u0;
+		delete[] u1;
+		delete[] r;
+	}
+}
+
+// Emulated double only makes sense against native double, nothing to compare for float.
+void compare_split(float* a, float* b, float* x0, float* x1) {}
+
+// Double Jacobi on both devices, as float pairs or native as the probe picks, checked against
+// omp_jacobi
+void compare_split(double* a, double* b, double* x0, double* x1) {
+	std::cout << "\nEMULATED DOUBLE\n******************************************************************\n";
+	const double eps = n * 1e-14;
+	const int platforms[2] = { 2, 1 };
+	const char* devices[2] = { "cpu", "gpu" };
+	std::vector<double> reference(n), unused(n, 0), delta(n, 0);
+	for (int i = 0; i < n; i++) reference[i] = gen();
+	omp_jacobi(n, a, b, reference.data(), unused.data(), 1e-12);
+	for (int d = 0; d < 2; d++) {
+		if (!has_platform(platforms[d])) continue;
+		bool split;
+		for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
+		auto time = opencl_jacobi_fp64(platforms[d], n, a, b, x0, x1, delta.data(), (char*)"jacobi_double.cl", (char*)"jacobi_float.cl", eps, split);
+		std::cout << (split ? "opencl jacobi split " : "opencl jacobi native ") << devices[d] << " = \t" << time << '\n';
+		double error = 0, size = 0;
+		for (int i = 0; i < n; i++) {
+			error += std::abs(x0[i] - reference[i]);
+			size += std::abs(reference[i]);
+		}
+		std::cout << "relative error = \t" << error / size << (error <= size * 1e-12 ? " GOOD\n" : " BAD\n");
+	}
+}
+
+// Thousands of small independent systems, one work-group each
+template<typename T>
+void compare_batched(char* filename, T eps) {
+	std::cout << "\nBATCHED\n******************************************************************\n";
+	const int sizes[4] = { 32, 64, 256, 512 };
+	const int counts[4] = { 8192, 4096, 512, 128 };
+	const int platforms[2] = { 2, 1 };
+	const char* devices[2] = { "cpu", "gpu" };
+	for (int k = 0; k < 4; k++) {
+		const int m = sizes[k], count = counts[k];
+		T* a = new T[(size_t)count * m * m];
+		T* b = new T[count * m];
+		T* x = new T[count * m];
+		for (size_t i = 0; i < (size_t)count * m * m; i++) {
+			const size_t row = i / m % m, col = i % m;
+			T tmp = T(gen() % 50000) / m;
+			a[i] = (row == col ? tmp + 100000 : tmp);
+		}
+		for (int i = 0; i < count * m; i++) b[i] = T(gen()) / m;
+		for (int d = 0; d < 2; d++) {
+			if (!has_platform(platforms[d])) continue;
+			std::cout << '\n';
+			for (int i = 0; i < count * m; i++) x[i] = gen();
+			auto time = opencl_jacobi_batched(platforms[d], count, m, a, b, x, filename, eps);
+			std::cout << "opencl jacobi batched " << devices[d] << " = \t" << time << '\n';
+		}
+		delete[] a;
+		delete[] b;
+		delete[] x;
+	}
+}
+
+// Systems Jacobi cannot solve: LU on a random matrix and Cholesky on the Kac-Murdock-Szego matrix
+// 0.9^|i - j|, both without diagonal dominance. Reports ||b - Ax|| / ||b||.
+template<typename T>
+void compare_direct(char* filename) {
+	std::cout << "\nDIRECT\n******************************************************************\n";
+	const int m = 64 * 32;
+	const int platforms[2] = { 2, 1 };
+	const char* devices[2] = { "cpu", "gpu" };
+	const char* methods[2] = { "lu", "cholesky" };
+	std::vector<T> a((size_t)m * m), b(m), x(m);
+	for (int i = 0; i < m; i++) b[i] = T(gen() % 2001) / 1000 - 1;
+	for (int method = 0; method < 2; method++) {
+		for (int i = 0; i < m; i++) {
+			for (int j = 0; j < m; j++) {
+				a[(size_t)i * m + j] = method == 0 ? T(gen() % 2001) / 1000 - 1 : T(std::pow(0.9, std::abs(i - j)));
+			}
+		}
+		for (int d = 0; d < 2; d++) {
+			if (!has_platform(platforms[d])) continue;
+			std::cout << '\n';
+			auto time = opencl_lu(platforms[d], m, a.data(), b.data(), x.data(), filename, method == 1);
+			T residual = 0, norm_b = 0;
+			for (int i = 0; i < m; i++) {
+				T sum = 0;
+				for (int j = 0; j < m; j++) sum += a[(size_t)i * m + j] * x[j];
+				residual += (b[i] - sum) * (b[i] - sum);
+				norm_b += b[i] * b[i];
+			}
+			std::cout << "Accuracy: " << std::sqrt(residual / norm_b) << '\n';
+			std::cout << "opencl " << methods[method] << ' ' << devices[d] << " = \t" << time << '\n';
+		}
+	}
+}
+
+// Diagonally dominant sparse matrix with about per_row nonzeros per row as a Matrix Market file
+void generate_matrix_market(const char* path, int size, int per_row) {
+	std::ofstream os(path);
+	os << "%%MatrixMarket matrix coordinate real general\n";
+	os << size << ' ' << size << ' ' << (long long)size * per_row << '\n';
+	for (int i = 0; i < size; i++) {
+		os << i + 1 << ' ' << i + 1 << ' ' << 2.0 * per_row << '\n';
+		for (int k = 1; k < per_row; k++) {
+			os << i + 1 << ' ' << gen() % size + 1 << ' ' << (double)(gen() % 1000) / 1000 << '\n';
+		}
+	}
+}
+
+// Jacobi on the sparse formats, the .mtx is parsed once and read from its cache afterwards
+template<typename T>
+void compare_sparse(char* filename, T eps) {
+	std::cout << "\nSPARSE\n******************************************************************\n";
+	const char* path = "random.mtx";
+	generate_matrix_market(path, 1 << 18, 16);
+	double time = omp_get_wtime();
+	csr_matrix<T> a = load_matrix_market<T>(path);
+	std::cout << "parse .mtx = \t" << omp_get_wtime() - time << '\n';
+	time = omp_get_wtime();
+	a = load_matrix_market<T>(path);
+	std::cout << "read cache = \t" << omp_get_wtime() - time << '\n';
+
+	std::vector<T> b(a.n), x0(a.n), x1(a.n), delta(a.n, 0);
+	for (int i = 0; i < a.n; i++) b[i] = T(gen()) / a.n;
+	const sparse_format formats[3] = { SPARSE_CSR, SPARSE_ELL, SPARSE_SELL };
+	const char* names[3] = { "csr", "ell", "sell" };
+	const int platforms[2] = { 2, 1 };
+	const char* devices[2] = { "cpu", "gpu" };
+	for (int d = 0; d < 2; d++) {
+		if (!has_platform(platforms[d])) continue;
+		for (int f = 0; f < 3; f++) {
+			std::cout << '\n' << names[f] << '\n';
+			for (int i = 0; i < a.n; i++) x0[i] = gen(), x1[i] = 0;
+			auto solve_time = opencl_sparse_jacobi(platforms[d], a, formats[f], b.data(), x0.data(), x1.data(), delta.data(), filename, eps);
+			std::cout << "opencl " << names[f] << " jacobi " << devices[d] << " = \t" << solve_time << '\n';
+		}
+	}
+
+	// CSR uploaded straight from the mapped binary file
+	write_binary_csr("random.bin", view(a));
+	for (int d = 0; d < 2; d++) {
+		if (!has_platform(platforms[d])) continue;
+		std::cout << "\nmapped csr\n";
+		time = omp_get_wtime();
+		binary_matrix<T> mapped = map_binary<T>("random.bin");
+		for (int i = 0; i < a.n; i++) x0[i] = gen(), x1[i] = 0;
+		opencl_sparse_jacobi(platforms[d], mapped.csr, SPARSE_CSR, b.data(), x0.data(), x1.data(), delta.data(), filename, eps);
+		unmap_binary(mapped);
+		std::cout << "opencl mapped csr jacobi " << devices[d] << " = \t" << omp_get_wtime() - time << '\n';
+	}
+}
+
+// A written once as a binary file, then mapped and uploaded from the mapping for every solve:
+// no host copy of A, the time includes reading it from disk.
+template<typename T>
+void compare_binary(T* a, T* b, T* x0, T* x1, T* delta, char* filename, char* kernelname, sweep_layout layout, T eps) {
+	std::cout << "\nBINARY\n******************************************************************\n";
+	const char* path = sizeof(T) == 4 ? "a_float.bin" : "a_double.bin";
+	double time = omp_get_wtime();
+	write_binary_dense(path, n, a);
+	std::cout << "write A = \t" << omp_get_wtime() - time << '\n';
+	const int platforms[2] = { 2, 1 };
+	const char* devices[2] = { "cpu", "gpu" };
+	for (int d = 0; d < 2; d++) {
+		if (!has_platform(platforms[d])) continue;
+		time = omp_get_wtime();
+		binary_matrix<T> mapped = map_binary<T>(path);
+		for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
+		opencl_jacobi(platforms[d], n, mapped.dense, b, x0, x1, delta, filename, kernelname, layout, eps);
+		unmap_binary(mapped);
+		std::cout << "opencl mapped jacobi " << devices[d] << " = \t" << omp_get_wtime() - time << '\n';
+	}
+	write_binary_vector(sizeof(T) == 4 ? "x_float.bin" : "x_double.bin", n, x0);
+}
+
+// Time stepping: every step b drifts a little and a few rows of A change. The resident solver
+// uploads only those and starts from the previous solution, the cold solve is the first step.
+template<typename T>
+void compare_resident(T* a, T* b, T* x0, T* x1, T* delta, char* filename, char* kernelname, sweep_layout layout, T eps) {
+	std::cout << "\nRESIDENT\n******************************************************************\n";
+	const int steps = 10;
+	const int platforms[2] = { 2, 1 };
+	const char* devices[2] = { "cpu", "gpu" };
+	std::vector<T> a_saved(a, a + (size_t)n * n);
+	std::vector<T> b_step(b, b + n);
+	for (int d = 0; d < 2; d++) {
+		if (!has_platform(platforms[d])) continue;
+		for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
+		double time = omp_get_wtime();
+		resident_jacobi solver = create_resident_jacobi(platforms[d], n, a, b, x0, x1, delta, filename, kernelname, layout);
+		T accuracy;
+		int iter = solve(solver, eps, accuracy);
+		std::cout << "cold: " << iter << " iterations, accuracy " << accuracy << '\n';
+		for (int step = 1; step <= steps; step++) {
+			for (int i = 0; i < n; i++) b_step[i] *= 1 + T(int(gen() % 2001) - 1000) / 1000000;
+			std::vector<int> rows = { (int)(gen() % n) };
+			const int block = gen() % (n - 4);
+			for (int i = block; i < block + 4; i++) rows.push_back(i);
+			std::sort(rows.begin(), rows.end());
+			rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+			for (int i : rows) {
+				for (int j = 0; j < n; j++) {
+					if (j != i) a[(size_t)i * n + j] *= T(1.01);
+				}
+			}
+			update_b(solver, b_step.data());
+			update_rows(solver, a, rows);
+			iter = solve(solver, eps, accuracy);
+			std::cout << "step " << step << ": " << iter << " iterations, accuracy " << accuracy << '\n';
+		}
+		release_resident_jacobi(solver, x0, x1);
+		std::cout << "opencl resident jacobi " << devices[d] << ", " << steps << " steps = \t" << omp_get_wtime() - time << '\n';
+		std::copy(a_saved.begin(), a_saved.end(), a);
+		std::copy(b, b + n, b_step.begin());
+	}
+}
+
 template<typename T>
 void lets_go(const char* message) {
 	std::cout << message << '\n';
@@ -75,34 +408,103 @@ void lets_go(const char* message) {
 
 	generateA(a);
 
+	generateB(b);
 	if (!check(a)){
-		std::cout << "CAN NOT CONVERGE\n";
+		std::cout << "CAN NOT CONVERGE, direct LU instead\n";
+		auto time = opencl_lu(1, n, a, b, x0, (char*)(sizeof(T) == 4 ? "jacobi_float.cl" : "jacobi_double.cl"));
+		std::cout << "opencl lu gpu = \t" << time << '\n';
 		return;
 	}
-	generateB(b);
 	
 	char* filename;
 	char* kernelname;
+	sweep_layout layout = SWEEP_ROW_PER_GROUP;
 
 	if (message == "FLOAT") {
 		filename = (char*)"jacobi_float.cl";
-		kernelname = (char*)"jacobiFloat";
+		kernelname = (char*)"jacobiRowFloat";
 	}
 	else {
 		filename = (char*)"jacobi_double.cl";
-		kernelname = (char*)"jacobiDouble";
+		kernelname = (char*)"jacobiRowDouble";
 	}
+	T eps = (sizeof(a[0]) == 4 ? T(1e-6) : T(1e-12));
 	for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
 	std::cout << "CPU\n******************************************************************\n";
-	auto opencl_cpu_time = opencl_jacobi(2, n, a, b, x0, x1, delta, filename, kernelname, (sizeof(a[0]) == 4 ? T(1e-6) : T(1e-12)));
-	std::cout << "opencl jacobi cpu = \t" << opencl_cpu_time << '\n';
-	// std::cout << (check_solution(a, b, x1) ? "GOOD\n" : "BAD\n");
+	auto omp_time = omp_jacobi(n, a, b, x0, x1, eps);
+	std::cout << "omp jacobi = \t\t" << omp_time << '\n';
+	if (has_platform(2)) {
+		for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
+		auto opencl_cpu_time = opencl_jacobi(2, n, a, b, x0, x1, delta, filename, kernelname, layout, eps);
+		std::cout << "opencl jacobi cpu = \t" << opencl_cpu_time << '\n';
+		// std::cout << (check_solution(a, b, x0) ? "GOOD\n" : "BAD\n");
+		compare_solvers(2, a, b, x0, x1, delta, filename, eps, "cpu");
+	}
+	else {
+		std::cout << "no OpenCL CPU platform, omp jacobi is the CPU result\n";
+	}
 
 	for (int i = 0; i < n; i++) x0[i] = gen(), x1[i] = 0;
 	std::cout << "\nGPU\n******************************************************************\n";
-	auto opencl_gpu_time = opencl_jacobi(1, n, a, b, x0, x1, delta, filename, kernelname, (sizeof(a[0]) == 4 ? T(1e-6) : T(1e-12)));
+	auto opencl_gpu_time = opencl_jacobi(1, n, a, b, x0, x1, delta, filename, kernelname, layout, eps);
 	std::cout << "opencl jacobi gpu = \t" << opencl_gpu_time << '\n';
-	// std::cout << (check_solution(a, b, x1) ? "GOOD\n" : "BAD\n");
+	// std::cout << (check_solution(a, b, x0) ? "GOOD\n" : "BAD\n");
+	compare_solvers(1, a, b, x0, x1, delta, filename, eps, "gpu");
+
+	// the same A for r right-hand sides
+	const int r = 8;
+	T* b_multi = new T[n * r];
+	T* x0_multi = new T[n * r];
+	T* x1_multi = new T[n * r];
+	T* delta_multi = new T[n * r];
+	for (int i = 0; i < n * r; i++) b_multi[i] = T(gen()) / n, delta_multi[i] = 0;
+	std::cout << "\nMULTIPLE RHS, r = " << r << "\n******************************************************************\n";
+	for (int i = 0; i < n * r; i++) x0_multi[i] = gen(), x1_multi[i] = 0;
+	if (has_platform(2)) {
+		auto multi_time = opencl_jacobi_multi(2, n, r, a, b_multi, x0_multi, x1_multi, delta_multi, filename, eps);
+		std::cout << "opencl jacobi multi cpu = \t" << multi_time << '\n';
+	}
+	for (int i = 0; i < n * r; i++) x0_multi[i] = gen(), x1_multi[i] = 0;
+	auto multi_time = opencl_jacobi_multi(1, n, r, a, b_multi, x0_multi, x1_multi, delta_multi, filename, eps);
+	std::cout << "opencl jacobi multi gpu = \t" << multi_time << '\n';
+	delete[] b_multi;
+	delete[] x0_multi;
+	delete[] x1_multi;
+	delete[] delta_multi;
+
+	compare_binary(a, b, x0, x1, delta, filename, kernelname, layout, eps);
+	compare_resident(a, b, x0, x1, delta, filename, kernelname, layout, eps);
+	compare_refinement(a, b, x0);
+	compare_split(a, b, x0, x1);
+	compare_stencil(filename, eps);
+	compare_multigrid(filename, eps);
+	compare_sparse(filename, eps);
+	compare_batched(filename, eps);
+	compare_direct<T>(filename);
+
+	std::cout << "\nKRYLOV\n******************************************************************\n";
+	const int platforms[2] = { 2, 1 };
+	const char* devices[2] = { "cpu", "gpu" };
+	for (int d = 0; d < 2; d++) {
+		if (!has_platform(platforms[d])) continue;
+		std::cout << "\nbicgstab\n";
+		for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
+		auto time = opencl_bicgstab(platforms[d], n, a, b, x0, x1, delta, filename, eps);
+		std::cout << "opencl bicgstab " << devices[d] << " = \t" << time << '\n';
+	}
+	// CG needs a symmetric matrix: (A + A^T) / 2 keeps the diagonal dominance
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < i; j++) {
+			a[i * n + j] = a[j * n + i] = (a[i * n + j] + a[j * n + i]) / 2;
+		}
+	}
+	for (int d = 0; d < 2; d++) {
+		if (!has_platform(platforms[d])) continue;
+		std::cout << "\ncg\n";
+		for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
+		auto time = opencl_cg(platforms[d], n, a, b, x0, x1, delta, filename, eps);
+		std::cout << "opencl cg " << devices[d] << " = \t" << time << '\n';
+	}
 	std::cout << '\n';
 }
 
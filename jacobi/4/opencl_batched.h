@@ -0,0 +1,103 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include <algorithm>
+#include "opencl_jacobi.h"
+
+// Jacobi for count independent systems of size n (small, up to a few hundred) in one launch of
+// jacobiBatch: a system per work-group of BLOCK_SIZE, x in local memory and A as well when n * n
+// values fit next to it, otherwise A is read from global memory column by column. Every system
+// stops on its own at sum(|(x1 - x0) / x0|) <= eps or nIter sweeps.
+// a holds the systems one after another, each row-major like for opencl_jacobi; b and x hold count
+// vectors of n. The answers are returned in x.
+template<typename T>
+double opencl_jacobi_batched(int platform_index, int count, int n, const T* a, T* b, T* x, char* filename, T eps, int nIter = 100) {
+	const int size = count * n;
+	solver_env env = create_solver_env<T>(platform_index, size, nullptr, b, x, x, x, filename);
+	cl_int ret;
+	cl_kernel kernel = clCreateKernel(env.program, kernel_name<T>("jacobiBatch").c_str(), &ret);
+	check_ret(ret, "create kernel jacobiBatch");
+
+	cl_ulong local_size;
+	clGetDeviceInfo(env.device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_size), &local_size, nullptr);
+	const size_t vectors = sizeof(T) * (2 * n + BLOCK_SIZE);
+	if (vectors > local_size) {
+		std::cout << "system too large for local memory\n";
+		exit(1);
+	}
+	int cache_a = sizeof(T) * n * n + vectors <= local_size;
+
+	// column-major per system, see jacobiBatch
+	std::vector<T> packed((size_t)count * n * n);
+	#pragma omp parallel for
+	for (int s = 0; s < count; s++) {
+		const T* as = a + (size_t)s * n * n;
+		T* ps = packed.data() + (size_t)s * n * n;
+		for (int i = 0; i < n; i++) {
+			for (int j = 0; j < n; j++) ps[(size_t)j * n + i] = as[(size_t)i * n + j];
+		}
+	}
+	env.memObjA = clCreateBuffer(env.context, CL_MEM_READ_ONLY, sizeof(T) * packed.size(), nullptr, &ret);
+	check_ret(ret, "create buffer A");
+	write_chunked(env.queue, env.memObjA, packed.data(), sizeof(T) * packed.size(), "EnqueueWriteBuffer A");
+	cl_mem memObjIterations = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY, sizeof(int) * count, nullptr, &ret);
+	check_ret(ret, "create buffer iterations");
+	cl_mem memObjAccuracy = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY, sizeof(T) * count, nullptr, &ret);
+	check_ret(ret, "create buffer accuracy");
+
+	cl_mem args[5] = { env.memObjA, env.memObjB, env.memObjX0, memObjIterations, memObjAccuracy };
+	for (int i = 0; i < 5; i++) {
+		ret = clSetKernelArg(kernel, i, sizeof(cl_mem), &args[i]);
+		check_ret(ret, "set kernel arg");
+	}
+	// a local argument may not be empty, without the cache la is a single unused value
+	ret = clSetKernelArg(kernel, 5, cache_a ? sizeof(T) * n * n : sizeof(T), nullptr);
+	check_ret(ret, "set kernel arg 5");
+	ret = clSetKernelArg(kernel, 6, sizeof(T) * n, nullptr);
+	check_ret(ret, "set kernel arg 6");
+	ret = clSetKernelArg(kernel, 7, sizeof(T) * n, nullptr);
+	check_ret(ret, "set kernel arg 7");
+	ret = clSetKernelArg(kernel, 8, sizeof(T) * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set kernel arg 8");
+	ret = clSetKernelArg(kernel, 9, sizeof(int), &n);
+	check_ret(ret, "set kernel arg 9");
+	ret = clSetKernelArg(kernel, 10, sizeof(int), &cache_a);
+	check_ret(ret, "set kernel arg 10");
+	ret = clSetKernelArg(kernel, 11, sizeof(T), &eps);
+	check_ret(ret, "set kernel arg 11");
+	ret = clSetKernelArg(kernel, 12, sizeof(int), &nIter);
+	check_ret(ret, "set kernel arg 12");
+
+	double time = omp_get_wtime();
+	size_t group_size = BLOCK_SIZE;
+	size_t global_work_size = (size_t)count * BLOCK_SIZE;
+	ret = clEnqueueNDRangeKernel(env.queue, kernel, 1, nullptr, &global_work_size, &group_size, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueNDRangeKernel");
+	std::vector<int> iterations(count);
+	std::vector<T> accuracy(count);
+	ret = clEnqueueReadBuffer(env.queue, memObjIterations, CL_TRUE, 0, sizeof(int) * count, iterations.data(), 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer");
+	ret = clEnqueueReadBuffer(env.queue, memObjAccuracy, CL_TRUE, 0, sizeof(T) * count, accuracy.data(), 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer");
+	time = omp_get_wtime() - time;
+
+	long long total = 0;
+	int converged = 0;
+	for (int s = 0; s < count; s++) {
+		total += iterations[s];
+		if (!(accuracy[s] > eps)) converged++;
+	}
+	std::cout << "Systems: " << count << " x " << n << (cache_a ? ", A in local memory\n" : ", A in global memory\n");
+	std::cout << "Iterations: " << *std::min_element(iterations.begin(), iterations.end()) << " - "
+		<< *std::max_element(iterations.begin(), iterations.end()) << ", mean " << double(total) / count << '\n';
+	std::cout << "Converged: " << converged << " of " << count << ", worst accuracy "
+		<< *std::max_element(accuracy.begin(), accuracy.end()) << '\n';
+
+	// the kernel works on X0 in place, X1 is only read back
+	std::vector<T> unused(size);
+	finish_solver_env(env, size, x, unused.data());
+	clReleaseMemObject(memObjIterations);
+	clReleaseMemObject(memObjAccuracy);
+	clReleaseKernel(kernel);
+	return time;
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include <cmath>
+#include <random>
+#include "opencl_jacobi.h"
+#include "opencl_krylov.h"
+
+// power iterations per spectral bound and the relative change of the estimate taken as settled
+#define CHEBYSHEV_POWER_STEPS 30
+#define CHEBYSHEV_POWER_TOLERANCE 1e-3
+
+// Dominant eigenvalue of D^-1 A - shift * I by power iteration from v, with the Rayleigh quotient
+// v . (D^-1 A - shift) v / v . v as the estimate. w and z are scratch. Returns false when the
+// estimate has not settled, e.g. for complex dominant eigenvalues.
+template<typename T>
+bool power_bound(solver_env& env, krylov_env& krylov, int n, T shift, cl_mem v, cl_mem w, cl_mem z, T& lambda) {
+	T scalars[KRYLOV_SCALARS];
+	T last = 0;
+	for (int k = 0; k < CHEBYSHEV_POWER_STEPS; k++) {
+		krylov_matvec(env, krylov, v, w);
+		krylov_precondition<T>(env, krylov, true, n, w, z);
+		krylov_axpby(env, krylov, -shift, v, T(1), z);
+		krylov_dot(env, krylov, v, z, 0);
+		krylov_dot(env, krylov, v, v, 1);
+		krylov_dot(env, krylov, z, z, 2);
+		read_scalars(env, krylov, 3, scalars);
+		last = lambda;
+		lambda = scalars[0] / scalars[1];
+		if (!(scalars[2] > 0)) return false;
+		krylov_axpby(env, krylov, T(1) / std::sqrt(scalars[2]), z, T(0), v);
+	}
+	return std::abs(lambda - last) <= CHEBYSHEV_POWER_TOLERANCE * std::abs(lambda);
+}
+
+// Jacobi with Chebyshev acceleration: the eigenvalues of D^-1 A are bounded on the device by power
+// iteration, lambda_max directly and lambda_min from D^-1 A - lambda_max * I, both widened by a
+// tenth of the interval. Chebyshev semi-iteration over [lambda_min, lambda_max] then costs one
+// matvec per iteration like a Jacobi sweep but converges with sqrt of the condition number.
+// When the estimate does not settle or the interval is not positive, plain Jacobi (jacobiRow) runs
+// instead. Stops at ||b - Ax|| <= eps * ||b||, checked every check_every iterations.
+template<typename T>
+double opencl_chebyshev(int platform_index, int n, T* a, T* b, T* x0, T* x1, T* delta, char* filename, T eps, int check_every = 8) {
+	solver_env env = create_solver_env(platform_index, n, a, b, x0, x1, delta, filename);
+	krylov_env krylov = create_krylov_env<T>(env, n, 4);
+	cl_mem x = env.memObjX0;
+	cl_mem r = krylov.vectors[0];
+	cl_mem z = krylov.vectors[1];
+	cl_mem p = krylov.vectors[2];
+	cl_mem w = krylov.vectors[3];
+	cl_int ret;
+
+	double time = omp_get_wtime();
+	std::mt19937 start(1);
+	std::vector<T> v(n);
+	for (int i = 0; i < n; i++) v[i] = T(1) + T(start() % 1000) / 1000;
+	ret = clEnqueueWriteBuffer(env.queue, p, CL_TRUE, 0, sizeof(T) * n, v.data(), 0, nullptr, nullptr);
+	check_ret(ret, "EnqueueWriteBuffer start vector");
+	T lambda_max = 0, shifted = 0;
+	bool reliable = power_bound(env, krylov, n, T(0), p, w, z, lambda_max);
+	ret = clEnqueueWriteBuffer(env.queue, p, CL_TRUE, 0, sizeof(T) * n, v.data(), 0, nullptr, nullptr);
+	check_ret(ret, "EnqueueWriteBuffer start vector");
+	reliable = reliable && power_bound(env, krylov, n, lambda_max, p, w, z, shifted);
+	T lambda_min = lambda_max + shifted;
+	T margin = (lambda_max - lambda_min) / 10;
+	lambda_max += margin;
+	lambda_min -= margin;
+	std::cout << "Spectrum of D^-1 A: [" << lambda_min << ", " << lambda_max << "]\n";
+	if (!reliable || !(lambda_min > 0) || !(lambda_max > lambda_min)) {
+		std::cout << "unreliable spectral bounds, plain Jacobi\n";
+		release_krylov_env(krylov);
+		finish_solver_env(env, n, x0, x1);
+		return opencl_jacobi(platform_index, n, a, b, x0, x1, delta, filename, (char*)kernel_name<T>("jacobiRow").c_str(), SWEEP_ROW_PER_GROUP, eps, check_every);
+	}
+
+	const T d = (lambda_max + lambda_min) / 2;
+	const T c = (lambda_max - lambda_min) / 2;
+	const int nIter = 100;
+	int iter = 0;
+	T alpha = 0, beta = 0;
+	T scalars[KRYLOV_SCALARS];
+	krylov_dot(env, krylov, env.memObjB, env.memObjB, 0);
+	read_scalars(env, krylov, 1, scalars);
+	T norm_b = std::sqrt(scalars[0]);
+	T accuracy = 1;
+	while (accuracy > eps && iter < nIter) {
+		krylov_residual<T>(env, krylov, n, x, r);
+		if (iter % check_every == 0) {
+			krylov_dot(env, krylov, r, r, 0);
+			read_scalars(env, krylov, 1, scalars);
+			accuracy = std::sqrt(scalars[0]) / norm_b;
+			if (!(accuracy > eps)) break;
+		}
+		krylov_precondition<T>(env, krylov, true, n, r, z);
+		if (iter == 0) {
+			copy_vector<T>(env, n, z, p);
+			alpha = 1 / d;
+		}
+		else {
+			beta = iter == 1 ? (c * alpha) * (c * alpha) / 2 : (c * alpha / 2) * (c * alpha / 2);
+			alpha = 1 / (d - beta / alpha);
+			krylov_axpby(env, krylov, T(1), z, beta, p);
+		}
+		krylov_axpby(env, krylov, alpha, p, T(1), x);
+		iter++;
+	}
+	if (accuracy > eps) {
+		krylov_residual<T>(env, krylov, n, x, r);
+		krylov_dot(env, krylov, r, r, 0);
+		read_scalars(env, krylov, 1, scalars);
+		accuracy = std::sqrt(scalars[0]) / norm_b;
+	}
+
+	std::cout << "Iterations: " << iter << " (Chebyshev)\n";
+	std::cout << "Accuracy: " << accuracy << '\n';
+
+	release_krylov_env(krylov);
+	finish_solver_env(env, n, x0, x1);
+	time = omp_get_wtime() - time;
+	return time;
+}
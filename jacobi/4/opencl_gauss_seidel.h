@@ -0,0 +1,121 @@
+#pragma once
+#include <CL/cl.h>
+#include "opencl_jacobi.h"
+
+// columns of the A tile in blockSorFloat / blockSorDouble
+#define SOR_TILE 32
+
+// Gauss-Seidel type solvers on the same buffers and convergence check as opencl_jacobi.
+// Kernels are taken from filename by name: blockSorFloat / redBlackFloat and the Double variants.
+
+// Block SOR, omega == 1 is block Gauss-Seidel. Blocks of BLOCK_SIZE rows are relaxed in parallel,
+// the rows of a block one after another.
+template<typename T>
+double opencl_sor(int platform_index, int n, T* a, T* b, T* x0, T* x1, T* delta, char* filename, T omega, T eps, int check_every = 8) {
+	solver_env env = create_solver_env(platform_index, n, a, b, x0, x1, delta, filename);
+	cl_int ret;
+	cl_kernel kernel = clCreateKernel(env.program, kernel_name<T>("blockSor").c_str(), &ret);
+	check_ret(ret, "create kernel");
+	ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &env.memObjA);
+	check_ret(ret, "set kernel arg 0");
+	ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &env.memObjB);
+	check_ret(ret, "set kernel arg 1");
+	ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &env.memObjDelta);
+	check_ret(ret, "set kernel arg 4");
+	ret = clSetKernelArg(kernel, 5, sizeof(int), &n);
+	check_ret(ret, "set kernel arg 5");
+	ret = clSetKernelArg(kernel, 6, sizeof(T), &omega);
+	check_ret(ret, "set kernel arg 6");
+	ret = clSetKernelArg(kernel, 7, sizeof(T) * BLOCK_SIZE * (SOR_TILE + 1), nullptr);
+	check_ret(ret, "set kernel arg 7");
+	ret = clSetKernelArg(kernel, 8, sizeof(T) * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set kernel arg 8");
+
+	size_t global_work_size[1] = { (n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE };
+	size_t group_size = BLOCK_SIZE;
+
+	T numerator;
+	double time = omp_get_wtime();
+	int iter = iterate(env, [&](solver_env& env) {
+		ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &env.memObjX0);
+		check_ret(ret, "set kernel arg 2");
+		ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &env.memObjX1);
+		check_ret(ret, "set kernel arg 3");
+
+		ret = clEnqueueNDRangeKernel(env.queue, kernel, 1, nullptr, global_work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel");
+		std::swap(env.memObjX0, env.memObjX1);
+	}, eps, 100, check_every, numerator);
+
+	std::cout << "Iterations: " << iter << '\n';
+	std::cout << "Accuracy: " << numerator << '\n';
+
+	finish_solver_env(env, n, x0, x1);
+	time = omp_get_wtime() - time;
+
+	clReleaseKernel(kernel);
+	return time;
+}
+
+template<typename T>
+double opencl_gauss_seidel(int platform_index, int n, T* a, T* b, T* x0, T* x1, T* delta, char* filename, T eps, int check_every = 8) {
+	return opencl_sor(platform_index, n, a, b, x0, x1, delta, filename, T(1), eps, check_every);
+}
+
+// Red-black ordered SOR: one sweep is the red half-sweep from X0 into X1 and the black one back
+// into X0, both fully parallel.
+template<typename T>
+double opencl_red_black(int platform_index, int n, T* a, T* b, T* x0, T* x1, T* delta, char* filename, T omega, T eps, int check_every = 8) {
+	solver_env env = create_solver_env(platform_index, n, a, b, x0, x1, delta, filename);
+	cl_int ret;
+	cl_kernel kernel[2];
+	for (int color = 0; color < 2; color++) {
+		kernel[color] = clCreateKernel(env.program, kernel_name<T>("redBlack").c_str(), &ret);
+		check_ret(ret, "create kernel");
+		cl_mem x_in = color == 0 ? env.memObjX0 : env.memObjX1;
+		cl_mem x_out = color == 0 ? env.memObjX1 : env.memObjX0;
+		ret = clSetKernelArg(kernel[color], 0, sizeof(cl_mem), &env.memObjA);
+		check_ret(ret, "set kernel arg 0");
+		ret = clSetKernelArg(kernel[color], 1, sizeof(cl_mem), &env.memObjB);
+		check_ret(ret, "set kernel arg 1");
+		ret = clSetKernelArg(kernel[color], 2, sizeof(cl_mem), &x_in);
+		check_ret(ret, "set kernel arg 2");
+		ret = clSetKernelArg(kernel[color], 3, sizeof(cl_mem), &x_out);
+		check_ret(ret, "set kernel arg 3");
+		ret = clSetKernelArg(kernel[color], 4, sizeof(cl_mem), &env.memObjDelta);
+		check_ret(ret, "set kernel arg 4");
+		ret = clSetKernelArg(kernel[color], 5, sizeof(int), &n);
+		check_ret(ret, "set kernel arg 5");
+		ret = clSetKernelArg(kernel[color], 6, sizeof(T), &omega);
+		check_ret(ret, "set kernel arg 6");
+		ret = clSetKernelArg(kernel[color], 7, sizeof(int), &color);
+		check_ret(ret, "set kernel arg 7");
+		ret = clSetKernelArg(kernel[color], 8, sizeof(T) * 4 * BLOCK_SIZE, nullptr);
+		check_ret(ret, "set kernel arg 8");
+		ret = clSetKernelArg(kernel[color], 9, sizeof(T) * BLOCK_SIZE * ROWS_PER_GROUP, nullptr);
+		check_ret(ret, "set kernel arg 9");
+	}
+
+	int half = (n + 1) / 2;
+	size_t global_work_size[2] = { BLOCK_SIZE, (half + ROWS_PER_GROUP - 1) / ROWS_PER_GROUP * ROWS_PER_GROUP };
+	size_t group_size[2] = { BLOCK_SIZE, ROWS_PER_GROUP };
+
+	T numerator;
+	double time = omp_get_wtime();
+	int iter = iterate(env, [&](solver_env& env) {
+		for (int color = 0; color < 2; color++) {
+			ret = clEnqueueNDRangeKernel(env.queue, kernel[color], 2, nullptr, global_work_size, group_size, 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueNDRangeKernel");
+		}
+	}, eps, 100, check_every, numerator);
+
+	std::cout << "Iterations: " << iter << '\n';
+	std::cout << "Accuracy: " << numerator << '\n';
+
+	finish_solver_env(env, n, x0, x1);
+	time = omp_get_wtime() - time;
+
+	clReleaseKernel(kernel[0]);
+	clReleaseKernel(kernel[1]);
+	return time;
+}
@@ -1,18 +1,41 @@
+#pragma once
 #include <CL/cl.h>
 #include <istream>
 #include <fstream>
+#include <string>
+#include <algorithm>
+#include <vector>
 
 #define BLOCK_SIZE 64
+// work-groups of the first reduction pass
+#define REDUCE_GROUPS 64
+// rows of a work-group for the row per work-group kernels (jacobiRowFloat, jacobiRowDouble)
+#define ROWS_PER_GROUP 4
+// bytes of one write when a large host array goes to the device
+#define UPLOAD_CHUNK (64 << 20)
 
 void initialize(int platform_index, cl_device_id& device) {
-	cl_platform_id* platforms = new cl_platform_id[3];
-	clGetPlatformIDs(3, platforms, nullptr);
+	cl_uint count = 0;
+	clGetPlatformIDs(0, nullptr, &count);
+	if (platform_index >= (int)count) {
+		std::cout << "no OpenCL platform " << platform_index << '\n';
+		exit(1);
+	}
+	std::vector<cl_platform_id> platforms(count);
+	clGetPlatformIDs(count, platforms.data(), nullptr);
 
 	cl_device_id* devices = new cl_device_id[1];
 	clGetDeviceIDs(platforms[platform_index], CL_DEVICE_TYPE_ALL, 1, devices, nullptr);
 	device = devices[0];
 }
 
+// Whether the machine has an OpenCL platform with this index, the CPU one (2) is often missing.
+bool has_platform(int platform_index) {
+	cl_uint count = 0;
+	clGetPlatformIDs(0, nullptr, &count);
+	return platform_index < (int)count;
+}
+
 char* get_device_name(cl_device_id& device) {
 	char ans[128];
 	clGetDeviceInfo(device, CL_DEVICE_NAME, 128, ans, nullptr);
@@ -37,112 +60,264 @@ void check_ret(cl_int ret, const char* message) {
 	}
 }
 
+// Name of the float or double variant of a kernel: kernel_name<float>("reduce") == "reduceFloat".
 template<typename T>
-double opencl_jacobi(int platform_index, int n, T* a, T* b, T* x0, T* x1, T* delta, char* filename, char* kernelname, T eps) {
+std::string kernel_name(const char* base) {
+	return std::string(base) + (sizeof(T) == 4 ? "Float" : "Double");
+}
+
+// Writes bytes from data to buffer in UPLOAD_CHUNK pieces enqueued without blocking. With data in a
+// mapped file the pages are read from disk chunk by chunk while the previous chunks are transferred,
+// and the driver never pins the whole array at once.
+void write_chunked(cl_command_queue queue, cl_mem buffer, const void* data, size_t bytes, const char* message) {
+	for (size_t offset = 0; offset < bytes; offset += UPLOAD_CHUNK) {
+		size_t size = std::min((size_t)UPLOAD_CHUNK, bytes - offset);
+		cl_int ret = clEnqueueWriteBuffer(queue, buffer, CL_FALSE, offset, size, (const char*)data + offset, 0, nullptr, nullptr);
+		check_ret(ret, message);
+	}
+	clFinish(queue);
+}
+
+// Work layout of a sweep kernel: a row per work-item (jacobiFloat) or ROWS_PER_GROUP rows per
+// work-group (jacobiRowFloat, jacobiRowSplitFloat), which take n and two local buffers after the
+// five arguments of jacobiFloat.
+enum sweep_layout {
+	SWEEP_ROW_PER_ITEM,
+	SWEEP_ROW_PER_GROUP
+};
+
+// Buffers and kernels shared by the iterative solvers. X0 holds the current approximation between
+// sweeps, delta is written by every sweep and reduced on the device to the residual. B, X0, X1 and
+// delta are n x columns blocks, row-major.
+struct solver_env {
 	cl_device_id device;
-	initialize(platform_index, device);
+	cl_context context;
+	cl_command_queue queue;
+	cl_program program;
+	cl_mem memObjA;
+	cl_mem memObjB;
+	cl_mem memObjX0;
+	cl_mem memObjX1;
+	cl_mem memObjDelta;
+	cl_mem memObjPartial;
+	cl_mem memObjResidual;
+	// the first pass reduces delta to REDUCE_GROUPS partial sums, the second one to the residual
+	cl_kernel reduce_delta;
+	cl_kernel reduce_partial;
+};
+
+template<typename T>
+solver_env create_solver_env(int platform_index, int n, const T* a, T* b, T* x0, T* x1, T* delta, char* filename, int columns = 1) {
+	solver_env env;
+	initialize(platform_index, env.device);
 	std::string kernel_code = read_kernel(filename);
 	size_t kernel_len = kernel_code.size();
 
 	cl_int ret;
-	cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &ret);
+	env.context = clCreateContext(nullptr, 1, &env.device, nullptr, nullptr, &ret);
 	check_ret(ret, "create context");
-	cl_command_queue command_queue = clCreateCommandQueueWithProperties(context, device, nullptr, &ret);
+	env.queue = clCreateCommandQueueWithProperties(env.context, env.device, nullptr, &ret);
 	check_ret(ret, "create command queue");
-	cl_program program = clCreateProgramWithSource(context, 1, (const char**)&kernel_code, &kernel_len, &ret);
+	env.program = clCreateProgramWithSource(env.context, 1, (const char**)&kernel_code, &kernel_len, &ret);
 	check_ret(ret, "create program");
-	ret = clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr);
+	ret = clBuildProgram(env.program, 1, &env.device, nullptr, nullptr, nullptr);
 
 	/*size_t logSize = 1000, actualLogSize;
 	char *log = new char[logSize];
-	clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, logSize, log, &actualLogSize);
+	clGetProgramBuildInfo(env.program, env.device, CL_PROGRAM_BUILD_LOG, logSize, log, &actualLogSize);
 	printf("\n-------------------------------------\n");
 	printf("log:\n%s", log);
 	printf("-------------------------------------\n\n");*/
 
 	check_ret(ret, "build program");
-	cl_kernel kernel = clCreateKernel(program, kernelname, &ret);
-	check_ret(ret, "create kernel");
+	env.reduce_delta = clCreateKernel(env.program, kernel_name<T>("reduce").c_str(), &ret);
+	check_ret(ret, "create kernel reduce");
+	env.reduce_partial = clCreateKernel(env.program, kernel_name<T>("reduce").c_str(), &ret);
+	check_ret(ret, "create kernel reduce");
 
-	cl_mem memObjA = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(T) * n * n, nullptr, &ret);
-	check_ret(ret, "create buffer A");
-	ret = clEnqueueWriteBuffer(command_queue, memObjA, CL_TRUE, 0, sizeof(T) * n * n, a, 0, nullptr, nullptr);
-	check_ret(ret, "EnqueueWriteBuffer A");
-	ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &memObjA);
-	check_ret(ret, "set kernel arg 0");
+	// matrix-free solvers pass a == nullptr
+	env.memObjA = nullptr;
+	if (a != nullptr) {
+		env.memObjA = clCreateBuffer(env.context, CL_MEM_READ_ONLY, sizeof(T) * n * n, nullptr, &ret);
+		check_ret(ret, "create buffer A");
+		write_chunked(env.queue, env.memObjA, a, sizeof(T) * n * n, "EnqueueWriteBuffer A");
+	}
 
-	cl_mem memObjB = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(T) * n, nullptr, &ret);
+	env.memObjB = clCreateBuffer(env.context, CL_MEM_READ_ONLY, sizeof(T) * n * columns, nullptr, &ret);
 	check_ret(ret, "create buffer B");
-	ret = clEnqueueWriteBuffer(command_queue, memObjB, CL_TRUE, 0, sizeof(T) * n, b, 0, nullptr, nullptr);
+	ret = clEnqueueWriteBuffer(env.queue, env.memObjB, CL_TRUE, 0, sizeof(T) * n * columns, b, 0, nullptr, nullptr);
 	check_ret(ret, "EnqueueWriteBuffer B");
-	ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &memObjB);
-	check_ret(ret, "set kernel arg 1");
 
-	cl_mem memObjX0 = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(T) * n, nullptr, &ret);
+	env.memObjX0 = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * n * columns, nullptr, &ret);
 	check_ret(ret, "create buffer X0");
-	ret = clEnqueueWriteBuffer(command_queue, memObjX0, CL_TRUE, 0, sizeof(T) * n, x0, 0, nullptr, nullptr);
+	ret = clEnqueueWriteBuffer(env.queue, env.memObjX0, CL_TRUE, 0, sizeof(T) * n * columns, x0, 0, nullptr, nullptr);
 	check_ret(ret, "EnqueueWriteBuffer X0");
 
-	cl_mem memObjX1 = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(T) * n, nullptr, &ret);
+	env.memObjX1 = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * n * columns, nullptr, &ret);
 	check_ret(ret, "create buffer X1");
-	ret = clEnqueueWriteBuffer(command_queue, memObjX1, CL_TRUE, 0, sizeof(T) * n, x1, 0, nullptr, nullptr);
+	ret = clEnqueueWriteBuffer(env.queue, env.memObjX1, CL_TRUE, 0, sizeof(T) * n * columns, x1, 0, nullptr, nullptr);
 	check_ret(ret, "EnqueueWriteBuffer X1");
 
-	cl_mem memObjDelta = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(T) * n, nullptr, &ret);
+	env.memObjDelta = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * n * columns, nullptr, &ret);
 	check_ret(ret, "create buffer delta");
-	ret = clEnqueueWriteBuffer(command_queue, memObjDelta, CL_TRUE, 0, sizeof(T) * n, delta, 0, nullptr, nullptr);
+	ret = clEnqueueWriteBuffer(env.queue, env.memObjDelta, CL_TRUE, 0, sizeof(T) * n * columns, delta, 0, nullptr, nullptr);
 	check_ret(ret, "EnqueueWriteBuffer delta");
-	ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &memObjDelta);
-	check_ret(ret, "set kernel arg 4");
 
-	size_t global_work_size[1] =  { n };
+	env.memObjPartial = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * REDUCE_GROUPS, nullptr, &ret);
+	check_ret(ret, "create buffer partial");
+	env.memObjResidual = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY, sizeof(T), nullptr, &ret);
+	check_ret(ret, "create buffer residual");
+	int partial_n = REDUCE_GROUPS;
+	int delta_n = n * columns;
+	ret = clSetKernelArg(env.reduce_delta, 0, sizeof(cl_mem), &env.memObjDelta);
+	check_ret(ret, "set reduce arg 0");
+	ret = clSetKernelArg(env.reduce_delta, 1, sizeof(cl_mem), &env.memObjPartial);
+	check_ret(ret, "set reduce arg 1");
+	ret = clSetKernelArg(env.reduce_delta, 2, sizeof(T) * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set reduce arg 2");
+	ret = clSetKernelArg(env.reduce_delta, 3, sizeof(int), &delta_n);
+	check_ret(ret, "set reduce arg 3");
+	ret = clSetKernelArg(env.reduce_partial, 0, sizeof(cl_mem), &env.memObjPartial);
+	check_ret(ret, "set reduce arg 0");
+	ret = clSetKernelArg(env.reduce_partial, 1, sizeof(cl_mem), &env.memObjResidual);
+	check_ret(ret, "set reduce arg 1");
+	ret = clSetKernelArg(env.reduce_partial, 2, sizeof(T) * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set reduce arg 2");
+	ret = clSetKernelArg(env.reduce_partial, 3, sizeof(int), &partial_n);
+	check_ret(ret, "set reduce arg 3");
+	return env;
+}
+
+// Reads X0 and X1 back and releases everything.
+template<typename T>
+void finish_solver_env(solver_env& env, int n, T* x0, T* x1, int columns = 1) {
+	cl_int ret = clEnqueueReadBuffer(env.queue, env.memObjX0, CL_TRUE, 0, sizeof(T) * n * columns, x0, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer");
+	ret = clEnqueueReadBuffer(env.queue, env.memObjX1, CL_TRUE, 0, sizeof(T) * n * columns, x1, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer");
+
+	clFinish(env.queue);
+	if (env.memObjA != nullptr) clReleaseMemObject(env.memObjA);
+	clReleaseMemObject(env.memObjB);
+	clReleaseMemObject(env.memObjX0);
+	clReleaseMemObject(env.memObjX1);
+	clReleaseMemObject(env.memObjDelta);
+	clReleaseMemObject(env.memObjPartial);
+	clReleaseMemObject(env.memObjResidual);
+	clReleaseKernel(env.reduce_delta);
+	clReleaseKernel(env.reduce_partial);
+	clReleaseProgram(env.program);
+	clReleaseCommandQueue(env.queue);
+	clReleaseContext(env.context);
+}
+
+// Runs sweep(env) until sum(|delta|) <= eps or nIter sweeps. The sweeps are enqueued back to back
+// and the residual is read without blocking every check_every sweeps; at most one batch runs past
+// convergence. Returns the number of sweeps, the latest residual is written to accuracy.
+template<typename T, typename Sweep>
+int iterate(solver_env& env, Sweep sweep, T eps, int nIter, int check_every, T& accuracy) {
+	cl_int ret;
 	size_t group_size = BLOCK_SIZE;
+	size_t reduce_work_size[1] = { REDUCE_GROUPS * BLOCK_SIZE };
 
-	int nIter = 100;
-	T numerator, denominator;
-	double time = omp_get_wtime();
-	cl_event event;
-	do{
-		ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &memObjX0);
-		check_ret(ret, "set kernel arg 2");
-		ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &memObjX1);
-		check_ret(ret, "set kernel arg 3");
-
-		ret = clEnqueueNDRangeKernel(command_queue, kernel, 1, nullptr, global_work_size, &group_size, 0, nullptr, &event);
-		check_ret(ret, "clEnqueueNDRangeKernel");
-		clWaitForEvents(1, &event);
-
-		ret = clEnqueueReadBuffer(command_queue, memObjDelta, CL_TRUE, 0, sizeof(T) * n, delta, 0, nullptr, nullptr);
+	int iter = 0;
+	// two residual slots: the check of the previous batch is read while the next batch runs
+	T residual[2];
+	cl_event check[2] = { nullptr, nullptr };
+	int slot = 0;
+	bool converged = false;
+	while (!converged && iter < nIter) {
+		int batch = std::min(check_every, nIter - iter);
+		for (int i = 0; i < batch; i++, iter++) {
+			sweep(env);
+		}
+		ret = clEnqueueNDRangeKernel(env.queue, env.reduce_delta, 1, nullptr, reduce_work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel reduce");
+		ret = clEnqueueNDRangeKernel(env.queue, env.reduce_partial, 1, nullptr, &group_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel reduce");
+		ret = clEnqueueReadBuffer(env.queue, env.memObjResidual, CL_FALSE, 0, sizeof(T), &residual[slot], 0, nullptr, &check[slot]);
 		check_ret(ret, "clEnqueueReadBuffer");
+		clFlush(env.queue);
 
-		numerator = 0;
-		for(int i = 0;i < n;i++){
-			numerator += fabs(delta[i]);
+		slot ^= 1;
+		if (check[slot] != nullptr) {
+			clWaitForEvents(1, &check[slot]);
+			clReleaseEvent(check[slot]);
+			check[slot] = nullptr;
+			converged = !(residual[slot] > eps);
 		}
-		std::swap(x0, x1);
-		std::swap(memObjX0, memObjX1);
-	} while (nIter-- && numerator > eps);
+	}
+	clFinish(env.queue);
+	// the latest check
+	accuracy = residual[slot ^ 1];
+	for (int i = 0; i < 2; i++) {
+		if (check[i] != nullptr) clReleaseEvent(check[i]);
+	}
+	return iter;
+}
+
+// The sweep kernel kernelname with A, b and delta of env bound and its work sizes for layout; the
+// row per group kernels get their local memory as well. x0 and x1 are bound per sweep.
+template<typename T>
+cl_kernel create_sweep_kernel(solver_env& env, int n, const char* kernelname, sweep_layout layout, size_t global_work_size[2], size_t group_size[2]) {
+	cl_int ret;
+	cl_kernel kernel = clCreateKernel(env.program, kernelname, &ret);
+	check_ret(ret, "create kernel");
+	ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &env.memObjA);
+	check_ret(ret, "set kernel arg 0");
+	ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &env.memObjB);
+	check_ret(ret, "set kernel arg 1");
+	ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &env.memObjDelta);
+	check_ret(ret, "set kernel arg 4");
+
+	global_work_size[0] = n;
+	global_work_size[1] = 1;
+	group_size[0] = BLOCK_SIZE;
+	group_size[1] = 1;
+	if (layout == SWEEP_ROW_PER_GROUP) {
+		global_work_size[0] = BLOCK_SIZE;
+		global_work_size[1] = (n + ROWS_PER_GROUP - 1) / ROWS_PER_GROUP * ROWS_PER_GROUP;
+		group_size[1] = ROWS_PER_GROUP;
+		ret = clSetKernelArg(kernel, 5, sizeof(int), &n);
+		check_ret(ret, "set kernel arg 5");
+		ret = clSetKernelArg(kernel, 6, sizeof(T) * 4 * BLOCK_SIZE, nullptr);
+		check_ret(ret, "set kernel arg 6");
+		ret = clSetKernelArg(kernel, 7, sizeof(T) * BLOCK_SIZE * ROWS_PER_GROUP, nullptr);
+		check_ret(ret, "set kernel arg 7");
+	}
+	return kernel;
+}
+
+// One Jacobi sweep X1 = f(X0) with the kernel of create_sweep_kernel, X0 and X1 swap afterwards
+inline void jacobi_sweep(solver_env& env, cl_kernel kernel, const size_t global_work_size[2], const size_t group_size[2]) {
+	cl_int ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &env.memObjX0);
+	check_ret(ret, "set kernel arg 2");
+	ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &env.memObjX1);
+	check_ret(ret, "set kernel arg 3");
+
+	ret = clEnqueueNDRangeKernel(env.queue, kernel, 2, nullptr, global_work_size, group_size, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueNDRangeKernel");
+	std::swap(env.memObjX0, env.memObjX1);
+}
+
+template<typename T>
+double opencl_jacobi(int platform_index, int n, const T* a, T* b, T* x0, T* x1, T* delta, char* filename, char* kernelname, sweep_layout layout, T eps, int check_every = 8) {
+	solver_env env = create_solver_env(platform_index, n, a, b, x0, x1, delta, filename);
+	size_t global_work_size[2], group_size[2];
+	cl_kernel kernel = create_sweep_kernel<T>(env, n, kernelname, layout, global_work_size, group_size);
+
+	T numerator;
+	double time = omp_get_wtime();
+	int iter = iterate(env, [&](solver_env& env) {
+		jacobi_sweep(env, kernel, global_work_size, group_size);
+	}, eps, 100, check_every, numerator);
 	
-	std::cout << "Iterations: " << 100 - nIter << '\n';
+	std::cout << "Iterations: " << iter << '\n';
 	std::cout << "Accuracy: " << numerator << '\n';
 
-	ret = clEnqueueReadBuffer(command_queue, memObjX0, CL_TRUE, 0, sizeof(T) * n, x0, 0, nullptr, nullptr);
-	check_ret(ret, "clEnqueueReadBuffer");
-	ret = clEnqueueReadBuffer(command_queue, memObjX1, CL_TRUE, 0, sizeof(T) * n, x1, 0, nullptr, nullptr);
-	check_ret(ret, "clEnqueueReadBuffer");
-	
+	finish_solver_env(env, n, x0, x1);
 	time = omp_get_wtime() - time;
-	
-	clFinish(command_queue);
-	clReleaseMemObject(memObjA);
-	clReleaseMemObject(memObjB);
-	clReleaseMemObject(memObjX0);
-	clReleaseMemObject(memObjX1);
-	clReleaseMemObject(memObjDelta);
-	clReleaseProgram(program);
+
 	clReleaseKernel(kernel);
-	clReleaseCommandQueue(command_queue);
-	clReleaseContext(context);
 	return time;
 }
-
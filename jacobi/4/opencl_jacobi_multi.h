@@ -0,0 +1,130 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include <algorithm>
+#include "opencl_jacobi.h"
+
+// columns of one device solve, MAX_RHS in jacobi_*.cl
+#define MAX_RHS 32
+
+// Jacobi for AX = B with r right-hand sides: b, x0, x1 and delta are n x r, row-major. A sweep
+// streams A once for all the columns, a column stops changing once its own sum(|delta|) <= eps.
+// More than MAX_RHS columns are solved in groups of MAX_RHS.
+template<typename T>
+double opencl_jacobi_multi(int platform_index, int n, int r, T* a, T* b, T* x0, T* x1, T* delta, char* filename, T eps, int check_every = 8) {
+	if (r > MAX_RHS) {
+		double time = 0;
+		std::vector<T> group_b, group_x0, group_x1, group_delta;
+		for (int c0 = 0; c0 < r; c0 += MAX_RHS) {
+			int columns = std::min(MAX_RHS, r - c0);
+			group_b.resize(n * columns);
+			group_x0.resize(n * columns);
+			group_x1.resize(n * columns);
+			group_delta.resize(n * columns);
+			for (int i = 0; i < n; i++) {
+				for (int c = 0; c < columns; c++) {
+					group_b[i * columns + c] = b[i * r + c0 + c];
+					group_x0[i * columns + c] = x0[i * r + c0 + c];
+					group_x1[i * columns + c] = x1[i * r + c0 + c];
+					group_delta[i * columns + c] = delta[i * r + c0 + c];
+				}
+			}
+			time += opencl_jacobi_multi(platform_index, n, columns, a, group_b.data(), group_x0.data(), group_x1.data(), group_delta.data(), filename, eps, check_every);
+			for (int i = 0; i < n; i++) {
+				for (int c = 0; c < columns; c++) {
+					x0[i * r + c0 + c] = group_x0[i * columns + c];
+					x1[i * r + c0 + c] = group_x1[i * columns + c];
+				}
+			}
+		}
+		return time;
+	}
+
+	solver_env env = create_solver_env(platform_index, n, a, b, x0, x1, delta, filename, r);
+	cl_int ret;
+	cl_kernel kernel = clCreateKernel(env.program, kernel_name<T>("jacobiMulti").c_str(), &ret);
+	check_ret(ret, "create kernel");
+	cl_kernel mask = clCreateKernel(env.program, kernel_name<T>("maskColumns").c_str(), &ret);
+	check_ret(ret, "create kernel maskColumns");
+
+	std::vector<int> active(r, 1);
+	std::vector<int> iterations(r, 0);
+	std::vector<T> residual(r, 0);
+	cl_mem memObjActive = clCreateBuffer(env.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(int) * r, active.data(), &ret);
+	check_ret(ret, "create buffer active");
+	cl_mem memObjIterations = clCreateBuffer(env.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(int) * r, iterations.data(), &ret);
+	check_ret(ret, "create buffer iterations");
+	cl_mem memObjColumnResidual = clCreateBuffer(env.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(T) * r, residual.data(), &ret);
+	check_ret(ret, "create buffer column residual");
+
+	ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &env.memObjA);
+	check_ret(ret, "set kernel arg 0");
+	ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &env.memObjB);
+	check_ret(ret, "set kernel arg 1");
+	ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &env.memObjDelta);
+	check_ret(ret, "set kernel arg 4");
+	ret = clSetKernelArg(kernel, 5, sizeof(cl_mem), &memObjActive);
+	check_ret(ret, "set kernel arg 5");
+	ret = clSetKernelArg(kernel, 6, sizeof(int), &n);
+	check_ret(ret, "set kernel arg 6");
+	ret = clSetKernelArg(kernel, 7, sizeof(int), &r);
+	check_ret(ret, "set kernel arg 7");
+	ret = clSetKernelArg(kernel, 8, sizeof(T) * BLOCK_SIZE * r, nullptr);
+	check_ret(ret, "set kernel arg 8");
+
+	ret = clSetKernelArg(mask, 0, sizeof(cl_mem), &env.memObjDelta);
+	check_ret(ret, "set mask arg 0");
+	ret = clSetKernelArg(mask, 1, sizeof(cl_mem), &memObjColumnResidual);
+	check_ret(ret, "set mask arg 1");
+	ret = clSetKernelArg(mask, 2, sizeof(cl_mem), &memObjActive);
+	check_ret(ret, "set mask arg 2");
+	ret = clSetKernelArg(mask, 3, sizeof(cl_mem), &memObjIterations);
+	check_ret(ret, "set mask arg 3");
+	ret = clSetKernelArg(mask, 4, sizeof(T) * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set mask arg 4");
+	ret = clSetKernelArg(mask, 5, sizeof(int), &n);
+	check_ret(ret, "set mask arg 5");
+	ret = clSetKernelArg(mask, 6, sizeof(int), &r);
+	check_ret(ret, "set mask arg 6");
+	ret = clSetKernelArg(mask, 7, sizeof(T), &eps);
+	check_ret(ret, "set mask arg 7");
+
+	size_t global_work_size[1] = { (size_t)n * BLOCK_SIZE };
+	size_t mask_work_size[1] = { (size_t)r * BLOCK_SIZE };
+	size_t group_size = BLOCK_SIZE;
+
+	// the masked columns add nothing to sum(|delta|), so iterate stops once every column is done
+	T numerator;
+	double time = omp_get_wtime();
+	int iter = iterate(env, [&](solver_env& env) {
+		ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &env.memObjX0);
+		check_ret(ret, "set kernel arg 2");
+		ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &env.memObjX1);
+		check_ret(ret, "set kernel arg 3");
+
+		ret = clEnqueueNDRangeKernel(env.queue, kernel, 1, nullptr, global_work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel");
+		ret = clEnqueueNDRangeKernel(env.queue, mask, 1, nullptr, mask_work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel mask");
+		std::swap(env.memObjX0, env.memObjX1);
+	}, eps, 100, check_every, numerator);
+
+	ret = clEnqueueReadBuffer(env.queue, memObjIterations, CL_TRUE, 0, sizeof(int) * r, iterations.data(), 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer iterations");
+	ret = clEnqueueReadBuffer(env.queue, memObjColumnResidual, CL_TRUE, 0, sizeof(T) * r, residual.data(), 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer column residual");
+
+	std::cout << "Iterations: " << iter << " (columns " << *std::min_element(iterations.begin(), iterations.end())
+		<< " - " << *std::max_element(iterations.begin(), iterations.end()) << ")\n";
+	std::cout << "Accuracy: " << *std::max_element(residual.begin(), residual.end()) << '\n';
+
+	finish_solver_env(env, n, x0, x1, r);
+	time = omp_get_wtime() - time;
+
+	clReleaseMemObject(memObjActive);
+	clReleaseMemObject(memObjIterations);
+	clReleaseMemObject(memObjColumnResidual);
+	clReleaseKernel(kernel);
+	clReleaseKernel(mask);
+	return time;
+}
@@ -0,0 +1,301 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include <cmath>
+#include "opencl_jacobi.h"
+
+// Conjugate Gradient and BiCGSTAB on the buffers of solver_env: x is X0, all vectors stay on the
+// device and only the dot products are read back. With preconditioned == true z = r / diag(A)
+// (Jacobi preconditioner). The iteration stops when ||b - Ax|| <= eps * ||b||.
+
+// dot products written by sumFloat / sumDouble, read back together
+#define KRYLOV_SCALARS 4
+
+struct krylov_env {
+	cl_kernel matvec;
+	cl_kernel dot;
+	cl_kernel sum;
+	cl_kernel axpby;
+	cl_kernel diag_scale;
+	cl_mem memObjScalars;
+	std::vector<cl_mem> vectors;
+	size_t vector_size;
+	size_t matvec_work_size[2];
+	size_t matvec_group_size[2];
+};
+
+template<typename T>
+krylov_env create_krylov_env(solver_env& env, int n, int vectors) {
+	krylov_env krylov;
+	cl_int ret;
+	krylov.matvec = clCreateKernel(env.program, kernel_name<T>("matvec").c_str(), &ret);
+	check_ret(ret, "create kernel matvec");
+	krylov.dot = clCreateKernel(env.program, kernel_name<T>("dot").c_str(), &ret);
+	check_ret(ret, "create kernel dot");
+	krylov.sum = clCreateKernel(env.program, kernel_name<T>("sum").c_str(), &ret);
+	check_ret(ret, "create kernel sum");
+	krylov.axpby = clCreateKernel(env.program, kernel_name<T>("axpby").c_str(), &ret);
+	check_ret(ret, "create kernel axpby");
+	krylov.diag_scale = clCreateKernel(env.program, kernel_name<T>("diagScale").c_str(), &ret);
+	check_ret(ret, "create kernel diagScale");
+
+	krylov.memObjScalars = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * KRYLOV_SCALARS, nullptr, &ret);
+	check_ret(ret, "create buffer scalars");
+	for (int i = 0; i < vectors; i++) {
+		krylov.vectors.push_back(clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * n, nullptr, &ret));
+		check_ret(ret, "create buffer krylov vector");
+	}
+
+	ret = clSetKernelArg(krylov.matvec, 0, sizeof(cl_mem), &env.memObjA);
+	check_ret(ret, "set matvec arg 0");
+	ret = clSetKernelArg(krylov.matvec, 3, sizeof(int), &n);
+	check_ret(ret, "set matvec arg 3");
+	ret = clSetKernelArg(krylov.matvec, 4, sizeof(T) * 4 * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set matvec arg 4");
+	ret = clSetKernelArg(krylov.matvec, 5, sizeof(T) * BLOCK_SIZE * ROWS_PER_GROUP, nullptr);
+	check_ret(ret, "set matvec arg 5");
+
+	int partial_n = REDUCE_GROUPS;
+	ret = clSetKernelArg(krylov.dot, 2, sizeof(cl_mem), &env.memObjPartial);
+	check_ret(ret, "set dot arg 2");
+	ret = clSetKernelArg(krylov.dot, 3, sizeof(T) * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set dot arg 3");
+	ret = clSetKernelArg(krylov.dot, 4, sizeof(int), &n);
+	check_ret(ret, "set dot arg 4");
+	ret = clSetKernelArg(krylov.sum, 0, sizeof(cl_mem), &env.memObjPartial);
+	check_ret(ret, "set sum arg 0");
+	ret = clSetKernelArg(krylov.sum, 1, sizeof(cl_mem), &krylov.memObjScalars);
+	check_ret(ret, "set sum arg 1");
+	ret = clSetKernelArg(krylov.sum, 2, sizeof(T) * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set sum arg 2");
+	ret = clSetKernelArg(krylov.sum, 3, sizeof(int), &partial_n);
+	check_ret(ret, "set sum arg 3");
+
+	ret = clSetKernelArg(krylov.axpby, 4, sizeof(int), &n);
+	check_ret(ret, "set axpby arg 4");
+	ret = clSetKernelArg(krylov.diag_scale, 0, sizeof(cl_mem), &env.memObjA);
+	check_ret(ret, "set diagScale arg 0");
+	ret = clSetKernelArg(krylov.diag_scale, 3, sizeof(int), &n);
+	check_ret(ret, "set diagScale arg 3");
+
+	krylov.vector_size = (n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+	krylov.matvec_work_size[0] = BLOCK_SIZE;
+	krylov.matvec_work_size[1] = (n + ROWS_PER_GROUP - 1) / ROWS_PER_GROUP * ROWS_PER_GROUP;
+	krylov.matvec_group_size[0] = BLOCK_SIZE;
+	krylov.matvec_group_size[1] = ROWS_PER_GROUP;
+	return krylov;
+}
+
+void release_krylov_env(krylov_env& krylov) {
+	for (cl_mem vector : krylov.vectors) {
+		clReleaseMemObject(vector);
+	}
+	clReleaseMemObject(krylov.memObjScalars);
+	clReleaseKernel(krylov.matvec);
+	clReleaseKernel(krylov.dot);
+	clReleaseKernel(krylov.sum);
+	clReleaseKernel(krylov.axpby);
+	clReleaseKernel(krylov.diag_scale);
+}
+
+// y = A * x
+void krylov_matvec(solver_env& env, krylov_env& krylov, cl_mem x, cl_mem y) {
+	cl_int ret = clSetKernelArg(krylov.matvec, 1, sizeof(cl_mem), &x);
+	check_ret(ret, "set matvec arg 1");
+	ret = clSetKernelArg(krylov.matvec, 2, sizeof(cl_mem), &y);
+	check_ret(ret, "set matvec arg 2");
+	ret = clEnqueueNDRangeKernel(env.queue, krylov.matvec, 2, nullptr, krylov.matvec_work_size, krylov.matvec_group_size, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueNDRangeKernel matvec");
+}
+
+// scalars[slot] = x . y, read with read_scalars
+void krylov_dot(solver_env& env, krylov_env& krylov, cl_mem x, cl_mem y, int slot) {
+	size_t group_size = BLOCK_SIZE;
+	size_t work_size = REDUCE_GROUPS * BLOCK_SIZE;
+	cl_int ret = clSetKernelArg(krylov.dot, 0, sizeof(cl_mem), &x);
+	check_ret(ret, "set dot arg 0");
+	ret = clSetKernelArg(krylov.dot, 1, sizeof(cl_mem), &y);
+	check_ret(ret, "set dot arg 1");
+	ret = clEnqueueNDRangeKernel(env.queue, krylov.dot, 1, nullptr, &work_size, &group_size, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueNDRangeKernel dot");
+	ret = clSetKernelArg(krylov.sum, 4, sizeof(int), &slot);
+	check_ret(ret, "set sum arg 4");
+	ret = clEnqueueNDRangeKernel(env.queue, krylov.sum, 1, nullptr, &group_size, &group_size, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueNDRangeKernel sum");
+}
+
+template<typename T>
+void read_scalars(solver_env& env, krylov_env& krylov, int count, T* scalars) {
+	cl_int ret = clEnqueueReadBuffer(env.queue, krylov.memObjScalars, CL_TRUE, 0, sizeof(T) * count, scalars, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer scalars");
+}
+
+// y = alpha * x + beta * y
+template<typename T>
+void krylov_axpby(solver_env& env, krylov_env& krylov, T alpha, cl_mem x, T beta, cl_mem y) {
+	cl_int ret = clSetKernelArg(krylov.axpby, 0, sizeof(T), &alpha);
+	check_ret(ret, "set axpby arg 0");
+	ret = clSetKernelArg(krylov.axpby, 1, sizeof(cl_mem), &x);
+	check_ret(ret, "set axpby arg 1");
+	ret = clSetKernelArg(krylov.axpby, 2, sizeof(T), &beta);
+	check_ret(ret, "set axpby arg 2");
+	ret = clSetKernelArg(krylov.axpby, 3, sizeof(cl_mem), &y);
+	check_ret(ret, "set axpby arg 3");
+	size_t group_size = BLOCK_SIZE;
+	ret = clEnqueueNDRangeKernel(env.queue, krylov.axpby, 1, nullptr, &krylov.vector_size, &group_size, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueNDRangeKernel axpby");
+}
+
+// y = x
+template<typename T>
+void copy_vector(solver_env& env, int n, cl_mem x, cl_mem y) {
+	cl_int ret = clEnqueueCopyBuffer(env.queue, x, y, 0, 0, sizeof(T) * n, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueCopyBuffer");
+}
+
+// z = M^-1 r, M = diag(A) or the identity
+template<typename T>
+void krylov_precondition(solver_env& env, krylov_env& krylov, bool preconditioned, int n, cl_mem r, cl_mem z) {
+	if (!preconditioned) {
+		copy_vector<T>(env, n, r, z);
+		return;
+	}
+	cl_int ret = clSetKernelArg(krylov.diag_scale, 1, sizeof(cl_mem), &r);
+	check_ret(ret, "set diagScale arg 1");
+	ret = clSetKernelArg(krylov.diag_scale, 2, sizeof(cl_mem), &z);
+	check_ret(ret, "set diagScale arg 2");
+	size_t group_size = BLOCK_SIZE;
+	ret = clEnqueueNDRangeKernel(env.queue, krylov.diag_scale, 1, nullptr, &krylov.vector_size, &group_size, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueNDRangeKernel diagScale");
+}
+
+// r = b - A x
+template<typename T>
+void krylov_residual(solver_env& env, krylov_env& krylov, int n, cl_mem x, cl_mem r) {
+	krylov_matvec(env, krylov, x, r);
+	krylov_axpby(env, krylov, T(1), env.memObjB, T(-1), r);
+}
+
+// Preconditioned CG for symmetric positive definite A, one matvec per iteration.
+template<typename T>
+double opencl_cg(int platform_index, int n, T* a, T* b, T* x0, T* x1, T* delta, char* filename, T eps, bool preconditioned = true) {
+	solver_env env = create_solver_env(platform_index, n, a, b, x0, x1, delta, filename);
+	krylov_env krylov = create_krylov_env<T>(env, n, 4);
+	cl_mem x = env.memObjX0;
+	cl_mem r = krylov.vectors[0];
+	cl_mem z = krylov.vectors[1];
+	cl_mem p = krylov.vectors[2];
+	cl_mem q = krylov.vectors[3];
+
+	int nIter = 100;
+	int iter = 0;
+	T scalars[KRYLOV_SCALARS];
+	double time = omp_get_wtime();
+	krylov_residual<T>(env, krylov, n, x, r);
+	krylov_precondition<T>(env, krylov, preconditioned, n, r, z);
+	copy_vector<T>(env, n, z, p);
+	krylov_dot(env, krylov, r, z, 0);
+	krylov_dot(env, krylov, env.memObjB, env.memObjB, 1);
+	krylov_dot(env, krylov, r, r, 2);
+	read_scalars(env, krylov, 3, scalars);
+	T rz = scalars[0];
+	T norm_b = std::sqrt(scalars[1]);
+	T accuracy = std::sqrt(scalars[2]) / norm_b;
+	while (accuracy > eps && iter < nIter) {
+		krylov_matvec(env, krylov, p, q);
+		krylov_dot(env, krylov, p, q, 0);
+		read_scalars(env, krylov, 1, scalars);
+		T alpha = rz / scalars[0];
+		krylov_axpby(env, krylov, alpha, p, T(1), x);
+		krylov_axpby(env, krylov, -alpha, q, T(1), r);
+		krylov_precondition<T>(env, krylov, preconditioned, n, r, z);
+		krylov_dot(env, krylov, r, z, 0);
+		krylov_dot(env, krylov, r, r, 1);
+		read_scalars(env, krylov, 2, scalars);
+		T beta = scalars[0] / rz;
+		rz = scalars[0];
+		accuracy = std::sqrt(scalars[1]) / norm_b;
+		krylov_axpby(env, krylov, T(1), z, beta, p);
+		iter++;
+	}
+
+	std::cout << "Iterations: " << iter << '\n';
+	std::cout << "Accuracy: " << accuracy << '\n';
+
+	release_krylov_env(krylov);
+	finish_solver_env(env, n, x0, x1);
+	time = omp_get_wtime() - time;
+	return time;
+}
+
+// Right preconditioned BiCGSTAB for general A, two matvecs per iteration.
+template<typename T>
+double opencl_bicgstab(int platform_index, int n, T* a, T* b, T* x0, T* x1, T* delta, char* filename, T eps, bool preconditioned = true) {
+	solver_env env = create_solver_env(platform_index, n, a, b, x0, x1, delta, filename);
+	krylov_env krylov = create_krylov_env<T>(env, n, 7);
+	cl_mem x = env.memObjX0;
+	cl_mem r = krylov.vectors[0];
+	cl_mem r_hat = krylov.vectors[1];
+	cl_mem p = krylov.vectors[2];
+	cl_mem v = krylov.vectors[3];
+	cl_mem s = krylov.vectors[4];
+	cl_mem t = krylov.vectors[5];
+	// M^-1 p and M^-1 s
+	cl_mem z = krylov.vectors[6];
+
+	int nIter = 100;
+	int iter = 0;
+	T scalars[KRYLOV_SCALARS];
+	double time = omp_get_wtime();
+	krylov_residual<T>(env, krylov, n, x, r);
+	copy_vector<T>(env, n, r, r_hat);
+	copy_vector<T>(env, n, r, p);
+	krylov_dot(env, krylov, r_hat, r, 0);
+	krylov_dot(env, krylov, env.memObjB, env.memObjB, 1);
+	read_scalars(env, krylov, 2, scalars);
+	T rho = scalars[0];
+	T norm_b = std::sqrt(scalars[1]);
+	T accuracy = std::sqrt(rho) / norm_b;
+	while (accuracy > eps && iter < nIter) {
+		krylov_precondition<T>(env, krylov, preconditioned, n, p, z);
+		krylov_matvec(env, krylov, z, v);
+		krylov_dot(env, krylov, r_hat, v, 0);
+		read_scalars(env, krylov, 1, scalars);
+		T alpha = rho / scalars[0];
+		// x += alpha * M^-1 p, s = r - alpha * v
+		krylov_axpby(env, krylov, alpha, z, T(1), x);
+		copy_vector<T>(env, n, r, s);
+		krylov_axpby(env, krylov, -alpha, v, T(1), s);
+
+		krylov_precondition<T>(env, krylov, preconditioned, n, s, z);
+		krylov_matvec(env, krylov, z, t);
+		krylov_dot(env, krylov, t, s, 0);
+		krylov_dot(env, krylov, t, t, 1);
+		read_scalars(env, krylov, 2, scalars);
+		T omega = scalars[1] > 0 ? scalars[0] / scalars[1] : T(0);
+		// x += omega * M^-1 s, r = s - omega * t
+		krylov_axpby(env, krylov, omega, z, T(1), x);
+		copy_vector<T>(env, n, s, r);
+		krylov_axpby(env, krylov, -omega, t, T(1), r);
+
+		krylov_dot(env, krylov, r_hat, r, 0);
+		krylov_dot(env, krylov, r, r, 1);
+		read_scalars(env, krylov, 2, scalars);
+		accuracy = std::sqrt(scalars[1]) / norm_b;
+		iter++;
+		if (omega == 0 || scalars[0] == 0) break;
+		// p = r + beta * (p - omega * v)
+		T beta = (scalars[0] / rho) * (alpha / omega);
+		rho = scalars[0];
+		krylov_axpby(env, krylov, -omega, v, T(1), p);
+		krylov_axpby(env, krylov, T(1), r, beta, p);
+	}
+
+	std::cout << "Iterations: " << iter << '\n';
+	std::cout << "Accuracy: " << accuracy << '\n';
+
+	release_krylov_env(krylov);
+	finish_solver_env(env, n, x0, x1);
+	time = omp_get_wtime() - time;
+	return time;
+}
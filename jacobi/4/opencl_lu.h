@@ -0,0 +1,210 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "opencl_jacobi.h"
+
+// columns of a panel, a multiple of GEMM_TILE
+#define LU_PANEL 64
+// tile of gemmUpdate, GEMM_TILE in jacobi_*.cl
+#define GEMM_TILE 16
+
+// Unblocked LU with partial pivoting of the m x w panel p (row-major, m >= w): L below the diagonal
+// with a unit diagonal, U on and above it. pivots[j] is the panel row swapped with row j.
+// Returns false for a zero pivot.
+template<typename T>
+bool factor_panel_lu(int m, int w, T* p, int* pivots) {
+	for (int j = 0; j < w; j++) {
+		int best = j;
+		for (int i = j + 1; i < m; i++) {
+			if (std::abs(p[i * w + j]) > std::abs(p[best * w + j])) best = i;
+		}
+		pivots[j] = best;
+		if (p[best * w + j] == 0) return false;
+		if (best != j) std::swap_ranges(p + j * w, p + (j + 1) * w, p + best * w);
+		const T inv = 1 / p[j * w + j];
+		for (int i = j + 1; i < m; i++) {
+			const T l = p[i * w + j] *= inv;
+			for (int c = j + 1; c < w; c++) p[i * w + c] -= l * p[j * w + c];
+		}
+	}
+	return true;
+}
+
+// Cholesky of the m x w panel p whose top w x w block is A11: L11 and L21 = A21 L11^-T are written
+// on and below the diagonal. Returns false when A11 is not positive definite.
+template<typename T>
+bool factor_panel_cholesky(int m, int w, T* p) {
+	for (int j = 0; j < w; j++) {
+		T d = p[j * w + j];
+		for (int c = 0; c < j; c++) d -= p[j * w + c] * p[j * w + c];
+		if (!(d > 0)) return false;
+		const T l = std::sqrt(d);
+		p[j * w + j] = l;
+		for (int i = j + 1; i < m; i++) {
+			T s = p[i * w + j];
+			for (int c = 0; c < j; c++) s -= p[i * w + c] * p[j * w + c];
+			p[i * w + j] = s / l;
+		}
+	}
+	return true;
+}
+
+// Blocked right-looking LU with partial pivoting (or Cholesky when cholesky is set) of A in place,
+// the solution of Ax = b is returned in x. Per step of LU_PANEL columns the host factors the panel
+// (rows k .. n - 1), the device swaps the rows of the other columns, solves the row panel (trsmLower)
+// and updates the trailing matrix with gemmUpdate, the block GEMM of the step. For Cholesky the row
+// panel is L21^T from the host and the whole trailing block is updated, the upper part is unused.
+// Lookahead: the columns of the next panel are updated first and read back, the host factors
+// them while the device updates the rest. Direct, so also for systems Jacobi cannot solve.
+template<typename T>
+double opencl_lu(int platform_index, int n, const T* a, T* b, T* x, char* filename, bool cholesky = false) {
+	solver_env env = create_solver_env<T>(platform_index, n, nullptr, b, x, x, x, filename);
+	cl_int ret;
+	env.memObjA = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * n * n, nullptr, &ret);
+	check_ret(ret, "create buffer A");
+	write_chunked(env.queue, env.memObjA, a, sizeof(T) * n * n, "EnqueueWriteBuffer A");
+	cl_kernel update = clCreateKernel(env.program, kernel_name<T>("gemmUpdate").c_str(), &ret);
+	check_ret(ret, "create kernel gemmUpdate");
+	cl_kernel swap = clCreateKernel(env.program, kernel_name<T>("swapRows").c_str(), &ret);
+	check_ret(ret, "create kernel swapRows");
+	cl_kernel trsm = clCreateKernel(env.program, kernel_name<T>("trsmLower").c_str(), &ret);
+	check_ret(ret, "create kernel trsmLower");
+	cl_mem memObjPivots = clCreateBuffer(env.context, CL_MEM_READ_ONLY, sizeof(int) * LU_PANEL, nullptr, &ret);
+	check_ret(ret, "create buffer pivots");
+	for (cl_kernel kernel : { update, swap, trsm }) {
+		ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &env.memObjA);
+		check_ret(ret, "set kernel arg 0");
+	}
+	ret = clSetKernelArg(swap, 1, sizeof(cl_mem), &memObjPivots);
+	check_ret(ret, "set swap arg 1");
+	ret = clSetKernelArg(swap, 2, sizeof(int), &n);
+	check_ret(ret, "set swap arg 2");
+	ret = clSetKernelArg(trsm, 1, sizeof(int), &n);
+	check_ret(ret, "set trsm arg 1");
+	ret = clSetKernelArg(update, 1, sizeof(int), &n);
+	check_ret(ret, "set update arg 1");
+
+	// the m x w panel at (k, k), or the w x (n - k - w) row panel right of it
+	auto panel_rect = [&](bool write, int row, int col, int rows, int cols, T* host, cl_event* event) {
+		const size_t buffer_origin[3] = { sizeof(T) * col, (size_t)row, 0 };
+		const size_t host_origin[3] = { 0, 0, 0 };
+		const size_t region[3] = { sizeof(T) * cols, (size_t)rows, 1 };
+		if (write) ret = clEnqueueWriteBufferRect(env.queue, env.memObjA, CL_FALSE, buffer_origin, host_origin, region, sizeof(T) * n, 0, sizeof(T) * cols, 0, host, 0, nullptr, event);
+		else ret = clEnqueueReadBufferRect(env.queue, env.memObjA, CL_FALSE, buffer_origin, host_origin, region, sizeof(T) * n, 0, sizeof(T) * cols, 0, host, 0, nullptr, event);
+		check_ret(ret, write ? "EnqueueWriteBufferRect" : "EnqueueReadBufferRect");
+	};
+	// C -= L U for the trailing rows of step (k, w) and the columns [col0, col0 + cols)
+	auto enqueue_update = [&](int k, int w, int col0, int cols) {
+		int row0 = k + w, rows = n - k - w;
+		int args[6] = { row0, col0, k, rows, cols, w };
+		for (int i = 0; i < 6; i++) {
+			ret = clSetKernelArg(update, 2 + i, sizeof(int), &args[i]);
+			check_ret(ret, "set update arg");
+		}
+		size_t global_work_size[2] = { (size_t)(cols + GEMM_TILE - 1) / GEMM_TILE * GEMM_TILE, (size_t)(rows + GEMM_TILE - 1) / GEMM_TILE * GEMM_TILE };
+		size_t group_size[2] = { GEMM_TILE, GEMM_TILE };
+		ret = clEnqueueNDRangeKernel(env.queue, update, 2, nullptr, global_work_size, group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel gemmUpdate");
+	};
+
+	double time = omp_get_wtime();
+	std::vector<int> pivots(n);
+	// the queue is in order: a panel is read back only after its previous contents were written
+	std::vector<T> panel_storage((size_t)n * LU_PANEL);
+	std::vector<T> row_panel((size_t)LU_PANEL * n);
+	T* panel = panel_storage.data();
+	cl_event ready;
+	panel_rect(false, 0, 0, n, std::min(LU_PANEL, n), panel, &ready);
+	for (int k = 0; k < n; k += LU_PANEL) {
+		const int w = std::min(LU_PANEL, n - k), m = n - k;
+		clWaitForEvents(1, &ready);
+		clReleaseEvent(ready);
+		bool factored = cholesky ? factor_panel_cholesky(m, w, panel) : factor_panel_lu(m, w, panel, &pivots[k]);
+		if (!factored) {
+			std::cout << (cholesky ? "matrix is not positive definite\n" : "matrix is singular\n");
+			exit(1);
+		}
+		panel_rect(true, k, k, m, w, panel, nullptr);
+		const int rest = n - k - w;
+		size_t group_size = BLOCK_SIZE;
+		if (!cholesky) {
+			// the swaps reach the columns of L left of the panel as well, also in the last step
+			for (int j = k; j < k + w; j++) pivots[j] += k;
+			ret = clEnqueueWriteBuffer(env.queue, memObjPivots, CL_FALSE, 0, sizeof(int) * w, &pivots[k], 0, nullptr, nullptr);
+			check_ret(ret, "EnqueueWriteBuffer pivots");
+			int args[2] = { k, w };
+			for (int i = 0; i < 2; i++) {
+				ret = clSetKernelArg(swap, 3 + i, sizeof(int), &args[i]);
+				check_ret(ret, "set swap arg");
+				ret = clSetKernelArg(trsm, 2 + i, sizeof(int), &args[i]);
+				check_ret(ret, "set trsm arg");
+			}
+			size_t global_work_size = (size_t)(n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+			ret = clEnqueueNDRangeKernel(env.queue, swap, 1, nullptr, &global_work_size, &group_size, 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueNDRangeKernel swapRows");
+		}
+		if (rest == 0) break;
+
+		if (cholesky) {
+			for (int j = 0; j < w; j++) {
+				for (int i = 0; i < rest; i++) row_panel[(size_t)j * rest + i] = panel[(size_t)(w + i) * w + j];
+			}
+			panel_rect(true, k, k + w, w, rest, row_panel.data(), nullptr);
+		}
+		else {
+			size_t global_work_size = (size_t)(rest + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+			ret = clEnqueueNDRangeKernel(env.queue, trsm, 1, nullptr, &global_work_size, &group_size, 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueNDRangeKernel trsmLower");
+		}
+
+		const int next = std::min(LU_PANEL, rest);
+		enqueue_update(k, w, k + w, next);
+		panel_rect(false, k + w, k + w, rest, next, panel, &ready);
+		if (rest > next) enqueue_update(k, w, k + w + next, rest - next);
+		clFlush(env.queue);
+	}
+
+	std::vector<T> factors((size_t)n * n);
+	ret = clEnqueueReadBuffer(env.queue, env.memObjA, CL_TRUE, 0, sizeof(T) * n * n, factors.data(), 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer");
+	const T* f = factors.data();
+	std::copy(b, b + n, x);
+	if (cholesky) {
+		// L y = b, L^T x = y
+		for (int i = 0; i < n; i++) {
+			T s = x[i];
+			for (int j = 0; j < i; j++) s -= f[(size_t)i * n + j] * x[j];
+			x[i] = s / f[(size_t)i * n + i];
+		}
+		for (int i = n - 1; i >= 0; i--) {
+			T s = x[i];
+			for (int j = i + 1; j < n; j++) s -= f[(size_t)j * n + i] * x[j];
+			x[i] = s / f[(size_t)i * n + i];
+		}
+	}
+	else {
+		// P b, L y = P b, U x = y
+		for (int i = 0; i < n; i++) std::swap(x[i], x[pivots[i]]);
+		for (int i = 0; i < n; i++) {
+			T s = x[i];
+			for (int j = 0; j < i; j++) s -= f[(size_t)i * n + j] * x[j];
+			x[i] = s;
+		}
+		for (int i = n - 1; i >= 0; i--) {
+			T s = x[i];
+			for (int j = i + 1; j < n; j++) s -= f[(size_t)i * n + j] * x[j];
+			x[i] = s / f[(size_t)i * n + i];
+		}
+	}
+	time = omp_get_wtime() - time;
+
+	std::vector<T> unused(n);
+	finish_solver_env(env, n, unused.data(), unused.data());
+	clReleaseMemObject(memObjPivots);
+	clReleaseKernel(update);
+	clReleaseKernel(swap);
+	clReleaseKernel(trsm);
+	return time;
+}
@@ -0,0 +1,394 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include <algorithm>
+#include "opencl_jacobi.h"
+#include "opencl_stencil.h"
+
+// levels with at most this many points run on the host
+#define MG_HOST_POINTS 4096
+// sweeps of the coarsest level, solved on the host
+#define MG_COARSEST_SWEEPS 50
+
+// One level of the hierarchy: on the device u, f, r and tmp (the other half of the Jacobi ping-pong)
+// are buffers, on the host they are vectors.
+template<typename T>
+struct mg_level {
+	stencil grid;
+	bool on_host;
+	cl_mem u, f, r, tmp;
+	std::vector<T> host_u, host_f, host_r, host_tmp;
+
+	size_t size() const {
+		return (size_t)grid.nx * grid.ny * grid.nz;
+	}
+};
+
+int coarsen(int size) {
+	return size >= 3 ? (size - 1) / 2 : size;
+}
+
+// Rediscretisation: the couplings of a coarsened axis are scaled by 1/4 (h doubles), the part of
+// the center that is not the negated sum of the couplings is kept.
+stencil coarse_stencil(const stencil& fine) {
+	stencil coarse = { coarsen(fine.nx), coarsen(fine.ny), coarsen(fine.nz), 0, fine.cx, fine.cy, fine.cz };
+	if (coarse.nx != fine.nx) coarse.cx /= 4;
+	if (coarse.ny != fine.ny) coarse.cy /= 4;
+	if (coarse.nz != fine.nz) coarse.cz /= 4;
+	double shift = fine.center + 2 * (fine.cx + fine.cy + fine.cz);
+	coarse.center = shift - 2 * (coarse.cx + coarse.cy + coarse.cz);
+	return coarse;
+}
+
+// Host versions of the mg kernels for the coarse levels.
+template<typename T>
+T host_at(const std::vector<T>& u, int x, int y, int z, const stencil& g) {
+	return x >= 0 && x < g.nx && y >= 0 && y < g.ny && z >= 0 && z < g.nz ? u[((size_t)z * g.ny + y) * g.nx + x] : 0;
+}
+
+template<typename T>
+T host_apply(const std::vector<T>& u, int x, int y, int z, const stencil& g) {
+	return (T)g.center * host_at(u, x, y, z, g)
+		+ (T)g.cx * (host_at(u, x - 1, y, z, g) + host_at(u, x + 1, y, z, g))
+		+ (T)g.cy * (host_at(u, x, y - 1, z, g) + host_at(u, x, y + 1, z, g))
+		+ (T)g.cz * (host_at(u, x, y, z - 1, g) + host_at(u, x, y, z + 1, g));
+}
+
+template<typename T>
+void host_smooth(mg_level<T>& level, T omega, int sweeps) {
+	const stencil& g = level.grid;
+	for (int s = 0; s < sweeps; s++) {
+		#pragma omp parallel for
+		for (int z = 0; z < g.nz; z++) {
+			for (int y = 0; y < g.ny; y++) {
+				for (int x = 0; x < g.nx; x++) {
+					size_t p = ((size_t)z * g.ny + y) * g.nx + x;
+					level.host_tmp[p] = level.host_u[p] + omega * (level.host_f[p] - host_apply(level.host_u, x, y, z, g)) / (T)g.center;
+				}
+			}
+		}
+		std::swap(level.host_u, level.host_tmp);
+	}
+}
+
+template<typename T>
+void host_residual(mg_level<T>& level) {
+	const stencil& g = level.grid;
+	#pragma omp parallel for
+	for (int z = 0; z < g.nz; z++) {
+		for (int y = 0; y < g.ny; y++) {
+			for (int x = 0; x < g.nx; x++) {
+				size_t p = ((size_t)z * g.ny + y) * g.nx + x;
+				level.host_r[p] = level.host_f[p] - host_apply(level.host_u, x, y, z, g);
+			}
+		}
+	}
+}
+
+template<typename T>
+void host_restrict(const std::vector<T>& r, const stencil& g, std::vector<T>& f, const stencil& c) {
+	const int sx = c.nx != g.nx, sy = c.ny != g.ny, sz = c.nz != g.nz;
+	#pragma omp parallel for
+	for (int z = 0; z < c.nz; z++) {
+		for (int y = 0; y < c.ny; y++) {
+			for (int x = 0; x < c.nx; x++) {
+				int fx = sx ? 2 * x + 1 : x, fy = sy ? 2 * y + 1 : y, fz = sz ? 2 * z + 1 : z;
+				T sum = 0;
+				for (int dz = -sz; dz <= sz; dz++) {
+					for (int dy = -sy; dy <= sy; dy++) {
+						for (int dx = -sx; dx <= sx; dx++) {
+							T w = (T)((dx ? 0.25 : (sx ? 0.5 : 1)) * (dy ? 0.25 : (sy ? 0.5 : 1)) * (dz ? 0.25 : (sz ? 0.5 : 1)));
+							sum += w * host_at(r, fx + dx, fy + dy, fz + dz, g);
+						}
+					}
+				}
+				f[((size_t)z * c.ny + y) * c.nx + x] = sum;
+			}
+		}
+	}
+}
+
+// u += interpolation of e
+template<typename T>
+void host_prolong(const std::vector<T>& e, const stencil& c, std::vector<T>& u, const stencil& g) {
+	const int sx = c.nx != g.nx, sy = c.ny != g.ny, sz = c.nz != g.nz;
+	#pragma omp parallel for
+	for (int z = 0; z < g.nz; z++) {
+		for (int y = 0; y < g.ny; y++) {
+			for (int x = 0; x < g.nx; x++) {
+				int x0 = sx ? (x - 1) >> 1 : x, y0 = sy ? (y - 1) >> 1 : y, z0 = sz ? (z - 1) >> 1 : z;
+				int x1 = sx && !(x & 1) ? x0 + 1 : x0, y1 = sy && !(y & 1) ? y0 + 1 : y0, z1 = sz && !(z & 1) ? z0 + 1 : z0;
+				T w = (T)((x1 != x0 ? 0.5 : 1) * (y1 != y0 ? 0.5 : 1) * (z1 != z0 ? 0.5 : 1));
+				T sum = 0;
+				for (int cz = z0; cz <= z1; cz++) {
+					for (int cy = y0; cy <= y1; cy++) {
+						for (int cx = x0; cx <= x1; cx++) {
+							sum += host_at(e, cx, cy, cz, c);
+						}
+					}
+				}
+				u[((size_t)z * g.ny + y) * g.nx + x] += w * sum;
+			}
+		}
+	}
+}
+
+// Device kernels of the cycle, the level-dependent arguments are set on every launch.
+struct mg_kernels {
+	cl_kernel smooth;
+	cl_kernel residual;
+	cl_kernel restrict_r;
+	cl_kernel prolong;
+	cl_kernel axpby;
+};
+
+template<typename T>
+void set_grid_args(cl_kernel kernel, int first, const stencil& g, bool coefficients) {
+	int dims[3] = { g.nx, g.ny, g.nz };
+	cl_int ret;
+	for (int d = 0; d < 3; d++) {
+		ret = clSetKernelArg(kernel, first + d, sizeof(int), &dims[d]);
+		check_ret(ret, "set mg grid arg");
+	}
+	if (!coefficients) return;
+	T c[4] = { (T)g.center, (T)g.cx, (T)g.cy, (T)g.cz };
+	for (int i = 0; i < 4; i++) {
+		ret = clSetKernelArg(kernel, first + 3 + i, sizeof(T), &c[i]);
+		check_ret(ret, "set mg coefficient arg");
+	}
+}
+
+void enqueue_grid(solver_env& env, cl_kernel kernel, const stencil& g) {
+	size_t group_size[3] = { 16, 4, 1 };
+	size_t global_work_size[3] = { (size_t)(g.nx + 15) / 16 * 16, (size_t)(g.ny + 3) / 4 * 4, (size_t)g.nz };
+	cl_int ret = clEnqueueNDRangeKernel(env.queue, kernel, 3, nullptr, global_work_size, group_size, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueNDRangeKernel mg");
+}
+
+template<typename T>
+void device_smooth(solver_env& env, mg_kernels& k, mg_level<T>& level, T omega, int sweeps) {
+	set_grid_args<T>(k.smooth, 3, level.grid, true);
+	cl_int ret = clSetKernelArg(k.smooth, 0, sizeof(cl_mem), &level.f);
+	check_ret(ret, "set smooth arg 0");
+	ret = clSetKernelArg(k.smooth, 10, sizeof(T), &omega);
+	check_ret(ret, "set smooth arg 10");
+	for (int s = 0; s < sweeps; s++) {
+		ret = clSetKernelArg(k.smooth, 1, sizeof(cl_mem), &level.u);
+		check_ret(ret, "set smooth arg 1");
+		ret = clSetKernelArg(k.smooth, 2, sizeof(cl_mem), &level.tmp);
+		check_ret(ret, "set smooth arg 2");
+		enqueue_grid(env, k.smooth, level.grid);
+		std::swap(level.u, level.tmp);
+	}
+}
+
+template<typename T>
+void device_residual(solver_env& env, mg_kernels& k, mg_level<T>& level) {
+	set_grid_args<T>(k.residual, 3, level.grid, true);
+	cl_mem args[3] = { level.f, level.u, level.r };
+	for (int i = 0; i < 3; i++) {
+		cl_int ret = clSetKernelArg(k.residual, i, sizeof(cl_mem), &args[i]);
+		check_ret(ret, "set residual arg");
+	}
+	enqueue_grid(env, k.residual, level.grid);
+}
+
+// The parameters of a cycle: gamma = 1 is a V-cycle, gamma = 2 a W-cycle.
+template<typename T>
+struct mg_cycle {
+	int gamma;
+	int pre;
+	int post;
+	T omega;
+};
+
+template<typename T>
+void cycle(solver_env& env, mg_kernels& k, std::vector<mg_level<T>>& levels, size_t l, const mg_cycle<T>& c) {
+	mg_level<T>& level = levels[l];
+	if (l + 1 == levels.size()) {
+		if (level.on_host) host_smooth(level, c.omega, MG_COARSEST_SWEEPS);
+		else device_smooth(env, k, level, c.omega, MG_COARSEST_SWEEPS);
+		return;
+	}
+	mg_level<T>& next = levels[l + 1];
+	cl_int ret;
+	if (level.on_host) {
+		host_smooth(level, c.omega, c.pre);
+		host_residual(level);
+		host_restrict(level.host_r, level.grid, next.host_f, next.grid);
+		std::fill(next.host_u.begin(), next.host_u.end(), T(0));
+		for (int i = 0; i < c.gamma; i++) cycle(env, k, levels, l + 1, c);
+		host_prolong(next.host_u, next.grid, level.host_u, level.grid);
+		host_smooth(level, c.omega, c.post);
+		return;
+	}
+
+	device_smooth(env, k, level, c.omega, c.pre);
+	device_residual(env, k, level);
+	if (next.on_host) {
+		// the residual is restricted on the host, the correction interpolated and added back here
+		ret = clEnqueueReadBuffer(env.queue, level.r, CL_TRUE, 0, sizeof(T) * level.size(), level.host_r.data(), 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueReadBuffer mg");
+		host_restrict(level.host_r, level.grid, next.host_f, next.grid);
+		std::fill(next.host_u.begin(), next.host_u.end(), T(0));
+		for (int i = 0; i < c.gamma; i++) cycle(env, k, levels, l + 1, c);
+		std::fill(level.host_r.begin(), level.host_r.end(), T(0));
+		host_prolong(next.host_u, next.grid, level.host_r, level.grid);
+		ret = clEnqueueWriteBuffer(env.queue, level.r, CL_TRUE, 0, sizeof(T) * level.size(), level.host_r.data(), 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueWriteBuffer mg");
+		T one = 1;
+		ret = clSetKernelArg(k.axpby, 0, sizeof(T), &one);
+		check_ret(ret, "set axpby arg 0");
+		ret = clSetKernelArg(k.axpby, 1, sizeof(cl_mem), &level.r);
+		check_ret(ret, "set axpby arg 1");
+		ret = clSetKernelArg(k.axpby, 2, sizeof(T), &one);
+		check_ret(ret, "set axpby arg 2");
+		ret = clSetKernelArg(k.axpby, 3, sizeof(cl_mem), &level.u);
+		check_ret(ret, "set axpby arg 3");
+		int size = (int)level.size();
+		ret = clSetKernelArg(k.axpby, 4, sizeof(int), &size);
+		check_ret(ret, "set axpby arg 4");
+		size_t group_size = BLOCK_SIZE;
+		size_t work_size = (level.size() + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+		ret = clEnqueueNDRangeKernel(env.queue, k.axpby, 1, nullptr, &work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel axpby");
+	}
+	else {
+		ret = clSetKernelArg(k.restrict_r, 0, sizeof(cl_mem), &level.r);
+		check_ret(ret, "set restrict arg 0");
+		ret = clSetKernelArg(k.restrict_r, 1, sizeof(cl_mem), &next.f);
+		check_ret(ret, "set restrict arg 1");
+		set_grid_args<T>(k.restrict_r, 2, level.grid, false);
+		set_grid_args<T>(k.restrict_r, 5, next.grid, false);
+		enqueue_grid(env, k.restrict_r, next.grid);
+		T zero = 0;
+		ret = clEnqueueFillBuffer(env.queue, next.u, &zero, sizeof(T), 0, sizeof(T) * next.size(), 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueFillBuffer");
+		for (int i = 0; i < c.gamma; i++) cycle(env, k, levels, l + 1, c);
+		ret = clSetKernelArg(k.prolong, 0, sizeof(cl_mem), &next.u);
+		check_ret(ret, "set prolong arg 0");
+		ret = clSetKernelArg(k.prolong, 1, sizeof(cl_mem), &level.u);
+		check_ret(ret, "set prolong arg 1");
+		set_grid_args<T>(k.prolong, 2, level.grid, false);
+		set_grid_args<T>(k.prolong, 5, next.grid, false);
+		enqueue_grid(env, k.prolong, level.grid);
+	}
+	device_smooth(env, k, level, c.omega, c.post);
+}
+
+// Multigrid for the stencil problem A u = f of opencl_stencil_jacobi: cycles of weighted Jacobi
+// smoothing, full weighting restriction and linear interpolation. Levels above MG_HOST_POINTS stay
+// on the device, the smaller ones and the coarsest solve run on the host. Stops when
+// sum(|f - A u|) <= eps * sum(|f|) or after 50 cycles; the answer is returned in u0.
+template<typename T>
+double opencl_multigrid(int platform_index, const stencil& grid, T* f, T* u0, T* u1, T* r, char* filename, T eps, int gamma = 1, int pre = 2, int post = 2) {
+	const int max_cycles = 50;
+	mg_cycle<T> c = { gamma, pre, post, (T)(grid.nz > 1 ? 6.0 / 7 : 0.8) };
+	std::vector<mg_level<T>> levels;
+	levels.push_back(mg_level<T>());
+	levels[0].grid = grid;
+	while (true) {
+		stencil coarse = coarse_stencil(levels.back().grid);
+		const stencil& fine = levels.back().grid;
+		if (coarse.nx == fine.nx && coarse.ny == fine.ny && coarse.nz == fine.nz) break;
+		levels.push_back(mg_level<T>());
+		levels.back().grid = coarse;
+		if (levels.back().size() <= 16) break;
+	}
+
+	const int n = grid.nx * grid.ny * grid.nz;
+	// level 0 lives in env: u = X0, tmp = X1, f = B, r = delta
+	solver_env env = create_solver_env<T>(platform_index, n, nullptr, f, u0, u1, r, filename);
+	cl_int ret;
+	mg_kernels k;
+	k.smooth = clCreateKernel(env.program, kernel_name<T>("mgSmooth").c_str(), &ret);
+	check_ret(ret, "create kernel mgSmooth");
+	k.residual = clCreateKernel(env.program, kernel_name<T>("mgResidual").c_str(), &ret);
+	check_ret(ret, "create kernel mgResidual");
+	k.restrict_r = clCreateKernel(env.program, kernel_name<T>("mgRestrict").c_str(), &ret);
+	check_ret(ret, "create kernel mgRestrict");
+	k.prolong = clCreateKernel(env.program, kernel_name<T>("mgProlong").c_str(), &ret);
+	check_ret(ret, "create kernel mgProlong");
+	k.axpby = clCreateKernel(env.program, kernel_name<T>("axpby").c_str(), &ret);
+	check_ret(ret, "create kernel axpby");
+
+	for (size_t l = 0; l < levels.size(); l++) {
+		mg_level<T>& level = levels[l];
+		level.on_host = l > 0 && level.size() <= MG_HOST_POINTS;
+		if (l == 0) {
+			level.u = env.memObjX0;
+			level.tmp = env.memObjX1;
+			level.f = env.memObjB;
+			level.r = env.memObjDelta;
+		}
+		else if (!level.on_host) {
+			cl_mem* buffers[4] = { &level.u, &level.f, &level.r, &level.tmp };
+			for (cl_mem* buffer : buffers) {
+				*buffer = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * level.size(), nullptr, &ret);
+				check_ret(ret, "create buffer mg level");
+			}
+		}
+		if (level.on_host) {
+			level.host_u.assign(level.size(), 0);
+			level.host_f.assign(level.size(), 0);
+			level.host_r.assign(level.size(), 0);
+			level.host_tmp.assign(level.size(), 0);
+		}
+		else if (l + 1 < levels.size() && levels[l + 1].size() <= MG_HOST_POINTS) {
+			// staging for the transfer to the host levels
+			level.host_r.assign(level.size(), 0);
+		}
+	}
+
+	// sum(|v|) over the finest grid
+	auto norm = [&](cl_mem v) {
+		size_t group_size = BLOCK_SIZE;
+		size_t reduce_work_size = REDUCE_GROUPS * BLOCK_SIZE;
+		ret = clSetKernelArg(env.reduce_delta, 0, sizeof(cl_mem), &v);
+		check_ret(ret, "set reduce arg 0");
+		ret = clEnqueueNDRangeKernel(env.queue, env.reduce_delta, 1, nullptr, &reduce_work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel reduce");
+		ret = clEnqueueNDRangeKernel(env.queue, env.reduce_partial, 1, nullptr, &group_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel reduce");
+		T value;
+		ret = clEnqueueReadBuffer(env.queue, env.memObjResidual, CL_TRUE, 0, sizeof(T), &value, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueReadBuffer");
+		return value;
+	};
+
+	double time = omp_get_wtime();
+	T norm_f = norm(levels[0].f);
+	device_residual(env, k, levels[0]);
+	T accuracy = norm(levels[0].r) / norm_f;
+	int cycles = 0;
+	while (accuracy > eps && cycles < max_cycles) {
+		cycle(env, k, levels, 0, c);
+		device_residual(env, k, levels[0]);
+		accuracy = norm(levels[0].r) / norm_f;
+		cycles++;
+	}
+
+	std::cout << "Levels: " << levels.size() << ", cycles: " << cycles << (gamma == 1 ? " (V)\n" : " (W)\n");
+	std::cout << "Iterations: " << cycles << '\n';
+	std::cout << "Accuracy: " << accuracy << '\n';
+
+	env.memObjX0 = levels[0].u;
+	env.memObjX1 = levels[0].tmp;
+	clSetKernelArg(env.reduce_delta, 0, sizeof(cl_mem), &env.memObjDelta);
+	finish_solver_env(env, n, u0, u1);
+	time = omp_get_wtime() - time;
+
+	for (size_t l = 1; l < levels.size(); l++) {
+		if (levels[l].on_host) continue;
+		clReleaseMemObject(levels[l].u);
+		clReleaseMemObject(levels[l].f);
+		clReleaseMemObject(levels[l].r);
+		clReleaseMemObject(levels[l].tmp);
+	}
+	clReleaseKernel(k.smooth);
+	clReleaseKernel(k.residual);
+	clReleaseKernel(k.restrict_r);
+	clReleaseKernel(k.prolong);
+	clReleaseKernel(k.axpby);
+	return time;
+}
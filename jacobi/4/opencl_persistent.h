@@ -0,0 +1,81 @@
+#pragma once
+#include <CL/cl.h>
+#include <algorithm>
+#include "opencl_jacobi.h"
+
+// Jacobi as a single launch of jacobiPersistent: one work-group of BLOCK_SIZE per compute unit
+// loops over the sweeps on the device, synchronizes through a global atomic barrier and stops by
+// itself at sum(|delta|) <= eps or nIter sweeps. No host round trip between sweeps, which pays off
+// where launches and waits dominate, for small and medium n. The answer is returned in x0.
+// The barrier deadlocks unless all the work-groups run at the same time, and OpenCL promises no
+// such thing. Only GPUs are trusted to keep one group of the kernel per compute unit resident;
+// other devices, or a kernel that cannot take BLOCK_SIZE work-items, get opencl_jacobi instead.
+template<typename T>
+double opencl_jacobi_persistent(int platform_index, int n, T* a, T* b, T* x0, T* x1, T* delta, char* filename, T eps, int nIter = 100) {
+	solver_env env = create_solver_env(platform_index, n, a, b, x0, x1, delta, filename);
+	cl_int ret;
+	cl_kernel kernel = clCreateKernel(env.program, kernel_name<T>("jacobiPersistent").c_str(), &ret);
+	check_ret(ret, "create kernel jacobiPersistent");
+
+	// every work-group has to be resident for the barrier: one per compute unit, at most one per row
+	cl_uint compute_units;
+	clGetDeviceInfo(env.device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, nullptr);
+	cl_device_type type;
+	clGetDeviceInfo(env.device, CL_DEVICE_TYPE, sizeof(type), &type, nullptr);
+	size_t kernel_group_size;
+	clGetKernelWorkGroupInfo(kernel, env.device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_group_size), &kernel_group_size, nullptr);
+	if (!(type & CL_DEVICE_TYPE_GPU) || kernel_group_size < BLOCK_SIZE) {
+		std::cout << "work-groups may not be resident together, jacobiRow sweeps instead\n";
+		clReleaseKernel(kernel);
+		finish_solver_env(env, n, x0, x1);
+		return opencl_jacobi(platform_index, n, a, b, x0, x1, delta, filename, (char*)kernel_name<T>("jacobiRow").c_str(), SWEEP_ROW_PER_GROUP, eps);
+	}
+	int groups = std::max(1, std::min((int)compute_units, n));
+	int sync[2] = { 0, 0 };
+	cl_mem memObjSync = clCreateBuffer(env.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(sync), sync, &ret);
+	check_ret(ret, "create buffer sync");
+	cl_mem memObjPartial = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * 2 * groups, nullptr, &ret);
+	check_ret(ret, "create buffer partial");
+	cl_mem memObjIterations = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY, sizeof(int), nullptr, &ret);
+	check_ret(ret, "create buffer iterations");
+
+	cl_mem args[8] = { env.memObjA, env.memObjB, env.memObjX0, env.memObjX1, memObjPartial, memObjSync, memObjIterations, env.memObjResidual };
+	for (int i = 0; i < 8; i++) {
+		ret = clSetKernelArg(kernel, i, sizeof(cl_mem), &args[i]);
+		check_ret(ret, "set kernel arg");
+	}
+	ret = clSetKernelArg(kernel, 8, sizeof(T) * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set kernel arg 8");
+	ret = clSetKernelArg(kernel, 9, sizeof(int), &n);
+	check_ret(ret, "set kernel arg 9");
+	ret = clSetKernelArg(kernel, 10, sizeof(T), &eps);
+	check_ret(ret, "set kernel arg 10");
+	ret = clSetKernelArg(kernel, 11, sizeof(int), &nIter);
+	check_ret(ret, "set kernel arg 11");
+
+	double time = omp_get_wtime();
+	size_t group_size = BLOCK_SIZE;
+	size_t global_work_size = (size_t)groups * BLOCK_SIZE;
+	ret = clEnqueueNDRangeKernel(env.queue, kernel, 1, nullptr, &global_work_size, &group_size, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueNDRangeKernel");
+	int iter;
+	T accuracy;
+	ret = clEnqueueReadBuffer(env.queue, memObjIterations, CL_TRUE, 0, sizeof(int), &iter, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer");
+	ret = clEnqueueReadBuffer(env.queue, env.memObjResidual, CL_TRUE, 0, sizeof(T), &accuracy, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer");
+
+	std::cout << "Iterations: " << iter << " (" << groups << " work-groups, one launch)\n";
+	std::cout << "Accuracy: " << accuracy << '\n';
+
+	// the last sweep wrote X1 when the count is odd
+	if (iter % 2 == 1) std::swap(env.memObjX0, env.memObjX1);
+	finish_solver_env(env, n, x0, x1);
+	time = omp_get_wtime() - time;
+
+	clReleaseMemObject(memObjSync);
+	clReleaseMemObject(memObjPartial);
+	clReleaseMemObject(memObjIterations);
+	clReleaseKernel(kernel);
+	return time;
+}
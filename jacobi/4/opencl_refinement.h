@@ -0,0 +1,177 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include <cmath>
+#include "opencl_jacobi.h"
+
+// Mixed precision iterative refinement for a double system: the corrections A d = r are solved by
+// float Jacobi sweeps on A rounded to float, the residual r = b - A x is computed on the device from
+// A, b and x split into float pairs hi + lo with compensated arithmetic (residualSplitFloat), and
+// x is kept as such a pair. The answer reaches double accuracy while every pass over A is float.
+// filename is the float kernel file, the iteration stops at sum(|r|) <= eps * sum(|b|).
+double opencl_refinement(int platform_index, int n, double* a, double* b, double* x, char* filename, double eps, int check_every = 8) {
+	const float inner_eps = 1e-6f;
+	const int max_refinements = 20;
+	std::vector<float> a_split((size_t)n * n);
+	std::vector<float> b_hi(n), b_lo(n), x_hi(n), x_lo(n), zeros(n, 0);
+	for (size_t i = 0; i < a_split.size(); i++) a_split[i] = (float)a[i];
+	for (int i = 0; i < n; i++) {
+		b_hi[i] = (float)b[i];
+		b_lo[i] = (float)(b[i] - b_hi[i]);
+		x_hi[i] = (float)x[i];
+		x_lo[i] = (float)(x[i] - x_hi[i]);
+	}
+
+	// A is the float part of the matrix and X0 the correction of the inner solve, B is unused
+	solver_env env = create_solver_env(platform_index, n, a_split.data(), zeros.data(), zeros.data(), zeros.data(), zeros.data(), filename);
+	cl_int ret;
+	for (size_t i = 0; i < a_split.size(); i++) a_split[i] = (float)(a[i] - (float)a[i]);
+	cl_mem memObjALo = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * n * n, a_split.data(), &ret);
+	check_ret(ret, "create buffer A lo");
+	std::vector<float>().swap(a_split);
+	cl_mem memObjBHi = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * n, b_hi.data(), &ret);
+	check_ret(ret, "create buffer B hi");
+	cl_mem memObjBLo = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * n, b_lo.data(), &ret);
+	check_ret(ret, "create buffer B lo");
+	cl_mem memObjXHi = clCreateBuffer(env.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(float) * n, x_hi.data(), &ret);
+	check_ret(ret, "create buffer X hi");
+	cl_mem memObjXLo = clCreateBuffer(env.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(float) * n, x_lo.data(), &ret);
+	check_ret(ret, "create buffer X lo");
+	// the residual, the right side of the inner solve; B of env is read-only
+	cl_mem memObjR = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(float) * n, nullptr, &ret);
+	check_ret(ret, "create buffer R");
+
+	cl_kernel residual = clCreateKernel(env.program, kernel_name<float>("residualSplit").c_str(), &ret);
+	check_ret(ret, "create kernel residualSplit");
+	cl_kernel refine = clCreateKernel(env.program, kernel_name<float>("refine").c_str(), &ret);
+	check_ret(ret, "create kernel refine");
+	cl_kernel jacobi = clCreateKernel(env.program, kernel_name<float>("jacobiRow").c_str(), &ret);
+	check_ret(ret, "create kernel");
+	cl_kernel diag_scale = clCreateKernel(env.program, kernel_name<float>("diagScale").c_str(), &ret);
+	check_ret(ret, "create kernel diagScale");
+	// sum(|r|) and sum(|b|) go through the reduction of the residual
+	cl_kernel reduce_r = clCreateKernel(env.program, kernel_name<float>("reduce").c_str(), &ret);
+	check_ret(ret, "create kernel reduce");
+
+	cl_mem residual_args[7] = { env.memObjA, memObjALo, memObjBHi, memObjBLo, memObjXHi, memObjXLo, memObjR };
+	for (int i = 0; i < 7; i++) {
+		ret = clSetKernelArg(residual, i, sizeof(cl_mem), &residual_args[i]);
+		check_ret(ret, "set residual arg");
+	}
+	ret = clSetKernelArg(residual, 7, sizeof(int), &n);
+	check_ret(ret, "set residual arg 7");
+	ret = clSetKernelArg(residual, 8, sizeof(float) * 2 * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set residual arg 8");
+
+	ret = clSetKernelArg(refine, 0, sizeof(cl_mem), &memObjXHi);
+	check_ret(ret, "set refine arg 0");
+	ret = clSetKernelArg(refine, 1, sizeof(cl_mem), &memObjXLo);
+	check_ret(ret, "set refine arg 1");
+	ret = clSetKernelArg(refine, 3, sizeof(int), &n);
+	check_ret(ret, "set refine arg 3");
+
+	ret = clSetKernelArg(jacobi, 0, sizeof(cl_mem), &env.memObjA);
+	check_ret(ret, "set kernel arg 0");
+	ret = clSetKernelArg(jacobi, 1, sizeof(cl_mem), &memObjR);
+	check_ret(ret, "set kernel arg 1");
+	ret = clSetKernelArg(jacobi, 4, sizeof(cl_mem), &env.memObjDelta);
+	check_ret(ret, "set kernel arg 4");
+	ret = clSetKernelArg(jacobi, 5, sizeof(int), &n);
+	check_ret(ret, "set kernel arg 5");
+	ret = clSetKernelArg(jacobi, 6, sizeof(float) * 4 * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set kernel arg 6");
+	ret = clSetKernelArg(jacobi, 7, sizeof(float) * BLOCK_SIZE * ROWS_PER_GROUP, nullptr);
+	check_ret(ret, "set kernel arg 7");
+
+	ret = clSetKernelArg(diag_scale, 0, sizeof(cl_mem), &env.memObjA);
+	check_ret(ret, "set diagScale arg 0");
+	ret = clSetKernelArg(diag_scale, 1, sizeof(cl_mem), &memObjR);
+	check_ret(ret, "set diagScale arg 1");
+	ret = clSetKernelArg(diag_scale, 3, sizeof(int), &n);
+	check_ret(ret, "set diagScale arg 3");
+
+	ret = clSetKernelArg(reduce_r, 1, sizeof(cl_mem), &env.memObjPartial);
+	check_ret(ret, "set reduce arg 1");
+	ret = clSetKernelArg(reduce_r, 2, sizeof(float) * BLOCK_SIZE, nullptr);
+	check_ret(ret, "set reduce arg 2");
+	ret = clSetKernelArg(reduce_r, 3, sizeof(int), &n);
+	check_ret(ret, "set reduce arg 3");
+
+	size_t group_size = BLOCK_SIZE;
+	size_t row_work_size[1] = { (size_t)n * BLOCK_SIZE };
+	size_t vector_work_size[1] = { (size_t)(n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE };
+	size_t reduce_work_size[1] = { REDUCE_GROUPS * BLOCK_SIZE };
+	size_t jacobi_work_size[2] = { BLOCK_SIZE, (size_t)(n + ROWS_PER_GROUP - 1) / ROWS_PER_GROUP * ROWS_PER_GROUP };
+	size_t jacobi_group_size[2] = { BLOCK_SIZE, ROWS_PER_GROUP };
+
+	// sum(|v|) through reduce_r and the second pass of env
+	auto norm = [&](cl_mem v) {
+		ret = clSetKernelArg(reduce_r, 0, sizeof(cl_mem), &v);
+		check_ret(ret, "set reduce arg 0");
+		ret = clEnqueueNDRangeKernel(env.queue, reduce_r, 1, nullptr, reduce_work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel reduce");
+		ret = clEnqueueNDRangeKernel(env.queue, env.reduce_partial, 1, nullptr, &group_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel reduce");
+		float value;
+		ret = clEnqueueReadBuffer(env.queue, env.memObjResidual, CL_TRUE, 0, sizeof(float), &value, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueReadBuffer");
+		return (double)value;
+	};
+
+	double time = omp_get_wtime();
+	double norm_b = norm(memObjBHi);
+	double accuracy = 0;
+	int refinements = 0;
+	int sweeps = 0;
+	for (;; refinements++) {
+		ret = clEnqueueNDRangeKernel(env.queue, residual, 1, nullptr, row_work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel residual");
+		accuracy = norm(memObjR) / norm_b;
+		if (!(accuracy > eps) || refinements == max_refinements) break;
+
+		// A d = r by float Jacobi starting from d = r / diag(A)
+		ret = clSetKernelArg(diag_scale, 2, sizeof(cl_mem), &env.memObjX0);
+		check_ret(ret, "set diagScale arg 2");
+		ret = clEnqueueNDRangeKernel(env.queue, diag_scale, 1, nullptr, vector_work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel diagScale");
+		float inner_accuracy;
+		sweeps += iterate(env, [&](solver_env& env) {
+			ret = clSetKernelArg(jacobi, 2, sizeof(cl_mem), &env.memObjX0);
+			check_ret(ret, "set kernel arg 2");
+			ret = clSetKernelArg(jacobi, 3, sizeof(cl_mem), &env.memObjX1);
+			check_ret(ret, "set kernel arg 3");
+			ret = clEnqueueNDRangeKernel(env.queue, jacobi, 2, nullptr, jacobi_work_size, jacobi_group_size, 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueNDRangeKernel");
+			std::swap(env.memObjX0, env.memObjX1);
+		}, inner_eps, 100, check_every, inner_accuracy);
+
+		ret = clSetKernelArg(refine, 2, sizeof(cl_mem), &env.memObjX0);
+		check_ret(ret, "set refine arg 2");
+		ret = clEnqueueNDRangeKernel(env.queue, refine, 1, nullptr, vector_work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel refine");
+	}
+
+	ret = clEnqueueReadBuffer(env.queue, memObjXHi, CL_TRUE, 0, sizeof(float) * n, x_hi.data(), 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer");
+	ret = clEnqueueReadBuffer(env.queue, memObjXLo, CL_TRUE, 0, sizeof(float) * n, x_lo.data(), 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer");
+	for (int i = 0; i < n; i++) x[i] = (double)x_hi[i] + x_lo[i];
+	time = omp_get_wtime() - time;
+
+	std::cout << "Refinements: " << refinements << ", float sweeps: " << sweeps << '\n';
+	std::cout << "Accuracy: " << accuracy << '\n';
+
+	clReleaseMemObject(memObjALo);
+	clReleaseMemObject(memObjBHi);
+	clReleaseMemObject(memObjBLo);
+	clReleaseMemObject(memObjXHi);
+	clReleaseMemObject(memObjXLo);
+	clReleaseMemObject(memObjR);
+	clReleaseKernel(residual);
+	clReleaseKernel(refine);
+	clReleaseKernel(jacobi);
+	clReleaseKernel(diag_scale);
+	clReleaseKernel(reduce_r);
+	finish_solver_env(env, n, zeros.data(), zeros.data());
+	return time;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include "opencl_jacobi.h"
+
+// A Jacobi solver that stays on the device between solves, for sequences of related systems such
+// as time steps: A, b and x are uploaded once, later only what changed goes over, and every solve
+// starts from the solution of the previous one.
+struct resident_jacobi {
+	solver_env env;
+	cl_kernel kernel;
+	size_t global_work_size[2];
+	size_t group_size[2];
+	int n;
+};
+
+// x0 is the starting guess of the first solve
+template<typename T>
+resident_jacobi create_resident_jacobi(int platform_index, int n, const T* a, T* b, T* x0, T* x1, T* delta, char* filename, char* kernelname, sweep_layout layout) {
+	resident_jacobi solver;
+	solver.n = n;
+	solver.env = create_solver_env(platform_index, n, a, b, x0, x1, delta, filename);
+	solver.kernel = create_sweep_kernel<T>(solver.env, n, kernelname, layout, solver.global_work_size, solver.group_size);
+	return solver;
+}
+
+// New values for b[first, first + count), the whole of b by default
+template<typename T>
+void update_b(resident_jacobi& solver, const T* b, int first = 0, int count = -1) {
+	if (count < 0) count = solver.n - first;
+	cl_int ret = clEnqueueWriteBuffer(solver.env.queue, solver.env.memObjB, CL_TRUE, sizeof(T) * first, sizeof(T) * count, b + first, 0, nullptr, nullptr);
+	check_ret(ret, "EnqueueWriteBuffer B");
+}
+
+// Rows of A that changed, a is the whole updated matrix. Neighbouring rows go over as one sub-range.
+template<typename T>
+void update_rows(resident_jacobi& solver, const T* a, const std::vector<int>& rows) {
+	const size_t n = solver.n;
+	cl_int ret;
+	for (size_t i = 0; i < rows.size();) {
+		size_t j = i + 1;
+		while (j < rows.size() && rows[j] == rows[j - 1] + 1) j++;
+		ret = clEnqueueWriteBuffer(solver.env.queue, solver.env.memObjA, CL_FALSE, sizeof(T) * rows[i] * n, sizeof(T) * (j - i) * n, a + rows[i] * n, 0, nullptr, nullptr);
+		check_ret(ret, "EnqueueWriteBuffer A rows");
+		i = j;
+	}
+	clFinish(solver.env.queue);
+}
+
+// Sweeps from the current x until sum(|delta|) <= eps or nIter sweeps, returns the number of sweeps
+template<typename T>
+int solve(resident_jacobi& solver, T eps, T& accuracy, int nIter = 100, int check_every = 8) {
+	return iterate(solver.env, [&](solver_env& env) {
+		jacobi_sweep(env, solver.kernel, solver.global_work_size, solver.group_size);
+	}, eps, nIter, check_every, accuracy);
+}
+
+template<typename T>
+void read_solution(resident_jacobi& solver, T* x) {
+	cl_int ret = clEnqueueReadBuffer(solver.env.queue, solver.env.memObjX0, CL_TRUE, 0, sizeof(T) * solver.n, x, 0, nullptr, nullptr);
+	check_ret(ret, "clEnqueueReadBuffer");
+}
+
+// Reads x0 and x1 back and releases the device state
+template<typename T>
+void release_resident_jacobi(resident_jacobi& solver, T* x0, T* x1) {
+	finish_solver_env(solver.env, solver.n, x0, x1);
+	clReleaseKernel(solver.kernel);
+}
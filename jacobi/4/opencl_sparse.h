@@ -0,0 +1,122 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include "opencl_jacobi.h"
+#include "sparse_matrix.h"
+
+// rows of a SELL-C-sigma slice and the sorting window
+#define SELL_C 32
+#define SELL_SIGMA 1024
+
+enum sparse_format {
+	SPARSE_CSR,
+	SPARSE_ELL,
+	SPARSE_SELL
+};
+
+template<typename T>
+cl_mem create_input_buffer(solver_env& env, size_t count, const T* data, const char* message) {
+	cl_int ret;
+	cl_mem buffer = clCreateBuffer(env.context, CL_MEM_READ_ONLY, sizeof(T) * count, nullptr, &ret);
+	check_ret(ret, message);
+	write_chunked(env.queue, buffer, data, sizeof(T) * count, message);
+	return buffer;
+}
+
+// Jacobi on a sparse A: the device holds the nonzeros in the chosen format (CSR as is, ELLPACK or
+// SELL-C-sigma converted from it) and the vectors of solver_env. The CSR arrays are uploaded from
+// where they are, a mapped binary matrix included.
+template<typename T>
+double opencl_sparse_jacobi(int platform_index, const csr_view<T>& a, sparse_format format, T* b, T* x0, T* x1, T* delta, char* filename, T eps, int check_every = 8) {
+	int n = a.n;
+	solver_env env = create_solver_env<T>(platform_index, n, nullptr, b, x0, x1, delta, filename);
+	cl_int ret;
+	std::vector<T> diag = diagonal(a);
+	std::vector<cl_mem> buffers;
+	buffers.push_back(create_input_buffer(env, n, diag.data(), "create buffer diag"));
+
+	cl_kernel kernel;
+	size_t global_work_size = (n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+	size_t group_size = BLOCK_SIZE;
+	if (format == SPARSE_CSR) {
+		kernel = clCreateKernel(env.program, kernel_name<T>("jacobiCsr").c_str(), &ret);
+		check_ret(ret, "create kernel");
+		buffers.push_back(create_input_buffer(env, a.val.size(), a.val.data(), "create buffer val"));
+		buffers.push_back(create_input_buffer(env, a.col.size(), a.col.data(), "create buffer col"));
+		buffers.push_back(create_input_buffer(env, a.row_ptr.size(), a.row_ptr.data(), "create buffer row_ptr"));
+		ret = clSetKernelArg(kernel, 8, sizeof(cl_mem), &buffers[3]);
+		check_ret(ret, "set kernel arg 8");
+	}
+	else if (format == SPARSE_ELL) {
+		kernel = clCreateKernel(env.program, kernel_name<T>("jacobiEll").c_str(), &ret);
+		check_ret(ret, "create kernel");
+		ell_matrix<T> ell = to_ell(a);
+		std::cout << "ELLPACK width " << ell.width << '\n';
+		buffers.push_back(create_input_buffer(env, ell.val.size(), ell.val.data(), "create buffer val"));
+		buffers.push_back(create_input_buffer(env, ell.col.size(), ell.col.data(), "create buffer col"));
+		ret = clSetKernelArg(kernel, 8, sizeof(int), &ell.width);
+		check_ret(ret, "set kernel arg 8");
+	}
+	else {
+		kernel = clCreateKernel(env.program, kernel_name<T>("jacobiSell").c_str(), &ret);
+		check_ret(ret, "create kernel");
+		sell_matrix<T> sell = to_sell(a, SELL_C, SELL_SIGMA);
+		std::cout << "SELL-" << SELL_C << '-' << SELL_SIGMA << " fill " << (double)sell.val.size() / a.val.size() << '\n';
+		buffers.push_back(create_input_buffer(env, sell.val.size(), sell.val.data(), "create buffer val"));
+		buffers.push_back(create_input_buffer(env, sell.col.size(), sell.col.data(), "create buffer col"));
+		buffers.push_back(create_input_buffer(env, sell.slice_ptr.size(), sell.slice_ptr.data(), "create buffer slice_ptr"));
+		buffers.push_back(create_input_buffer(env, sell.perm.size(), sell.perm.data(), "create buffer perm"));
+		int c = SELL_C;
+		ret = clSetKernelArg(kernel, 8, sizeof(cl_mem), &buffers[3]);
+		check_ret(ret, "set kernel arg 8");
+		ret = clSetKernelArg(kernel, 9, sizeof(cl_mem), &buffers[4]);
+		check_ret(ret, "set kernel arg 9");
+		ret = clSetKernelArg(kernel, 10, sizeof(int), &c);
+		check_ret(ret, "set kernel arg 10");
+		// one work-group per slice
+		global_work_size = sell.perm.size();
+		group_size = SELL_C;
+	}
+	ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffers[1]);
+	check_ret(ret, "set kernel arg 0");
+	ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffers[2]);
+	check_ret(ret, "set kernel arg 1");
+	ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &env.memObjDelta);
+	check_ret(ret, "set kernel arg 4");
+	ret = clSetKernelArg(kernel, 5, sizeof(cl_mem), &env.memObjB);
+	check_ret(ret, "set kernel arg 5");
+	ret = clSetKernelArg(kernel, 6, sizeof(cl_mem), &buffers[0]);
+	check_ret(ret, "set kernel arg 6");
+	ret = clSetKernelArg(kernel, 7, sizeof(int), &n);
+	check_ret(ret, "set kernel arg 7");
+
+	T numerator;
+	double time = omp_get_wtime();
+	int iter = iterate(env, [&](solver_env& env) {
+		ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &env.memObjX0);
+		check_ret(ret, "set kernel arg 2");
+		ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &env.memObjX1);
+		check_ret(ret, "set kernel arg 3");
+
+		ret = clEnqueueNDRangeKernel(env.queue, kernel, 1, nullptr, &global_work_size, &group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel");
+		std::swap(env.memObjX0, env.memObjX1);
+	}, eps, 100, check_every, numerator);
+
+	std::cout << "Iterations: " << iter << '\n';
+	std::cout << "Accuracy: " << numerator << '\n';
+
+	finish_solver_env(env, n, x0, x1);
+	time = omp_get_wtime() - time;
+
+	for (cl_mem buffer : buffers) {
+		clReleaseMemObject(buffer);
+	}
+	clReleaseKernel(kernel);
+	return time;
+}
+
+template<typename T>
+double opencl_sparse_jacobi(int platform_index, const csr_matrix<T>& a, sparse_format format, T* b, T* x0, T* x1, T* delta, char* filename, T eps, int check_every = 8) {
+	return opencl_sparse_jacobi(platform_index, view(a), format, b, x0, x1, delta, filename, eps, check_every);
+}
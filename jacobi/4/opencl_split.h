@@ -0,0 +1,100 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include <map>
+#include <random>
+#include "opencl_jacobi.h"
+
+// size of the system the native / emulated double probe solves
+#define SPLIT_PROBE_N 2048
+
+// double as a float pair hi + lo, lo is the rounding error of hi
+void split_double(size_t count, const double* x, cl_float2* split) {
+	for (size_t i = 0; i < count; i++) {
+		split[i].s[0] = (float)x[i];
+		split[i].s[1] = (float)(x[i] - split[i].s[0]);
+	}
+}
+
+void join_double(size_t count, const cl_float2* split, double* x) {
+	for (size_t i = 0; i < count; i++) x[i] = (double)split[i].s[0] + split[i].s[1];
+}
+
+// Double Jacobi with fp32 instructions only: A, b and x live on the device as float pairs and the
+// sweeps are jacobiRowSplitFloat, about 48 bits of the 53 of a double survive. filename is the float
+// kernel file. Stops like opencl_jacobi, but the relative changes do not fall much below
+// n * 2^-48, a smaller eps runs all the sweeps.
+double opencl_jacobi_split(int platform_index, int n, const double* a, double* b, double* x0, double* x1, char* filename, double eps, int check_every = 8) {
+	std::vector<cl_float2> b_split(n), x0_split(n), x1_split(n);
+	std::vector<float> zeros(2 * n, 0);
+	split_double(n, b, b_split.data());
+	split_double(n, x0, x0_split.data());
+	split_double(n, x1, x1_split.data());
+	// the vectors are 2n floats to the environment, only the first n values of delta are written
+	solver_env env = create_solver_env<float>(platform_index, 2 * n, nullptr, (float*)b_split.data(), (float*)x0_split.data(), (float*)x1_split.data(), zeros.data(), filename);
+	cl_int ret;
+	{
+		std::vector<cl_float2> a_split((size_t)n * n);
+		split_double(a_split.size(), a, a_split.data());
+		env.memObjA = clCreateBuffer(env.context, CL_MEM_READ_ONLY, sizeof(cl_float2) * a_split.size(), nullptr, &ret);
+		check_ret(ret, "create buffer A");
+		write_chunked(env.queue, env.memObjA, a_split.data(), sizeof(cl_float2) * a_split.size(), "EnqueueWriteBuffer A");
+	}
+	size_t global_work_size[2], group_size[2];
+	cl_kernel kernel = create_sweep_kernel<cl_float2>(env, n, "jacobiRowSplitFloat", SWEEP_ROW_PER_GROUP, global_work_size, group_size);
+
+	float accuracy;
+	double time = omp_get_wtime();
+	int iter = iterate(env, [&](solver_env& env) {
+		jacobi_sweep(env, kernel, global_work_size, group_size);
+	}, (float)eps, 100, check_every, accuracy);
+
+	std::cout << "Iterations: " << iter << " (emulated double)\n";
+	std::cout << "Accuracy: " << accuracy << '\n';
+
+	finish_solver_env(env, 2 * n, (float*)x0_split.data(), (float*)x1_split.data());
+	join_double(n, x0_split.data(), x0);
+	join_double(n, x1_split.data(), x1);
+	time = omp_get_wtime() - time;
+
+	clReleaseKernel(kernel);
+	return time;
+}
+
+// Native or emulated double for the device of platform_index: emulated when it has no fp64 at all,
+// otherwise both solve the same SPLIT_PROBE_N system for 100 sweeps and the faster one is taken.
+// The probe runs once per platform.
+bool prefer_split(int platform_index, char* double_filename, char* float_filename) {
+	static std::map<int, bool> decided;
+	auto found = decided.find(platform_index);
+	if (found != decided.end()) return found->second;
+
+	cl_device_id device;
+	initialize(platform_index, device);
+	cl_device_fp_config fp64 = 0;
+	clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64), &fp64, nullptr);
+	bool split = true;
+	if (fp64 != 0) {
+		const int n = SPLIT_PROBE_N;
+		std::mt19937 gen(1);
+		std::vector<double> a((size_t)n * n), b(n), x0(n, 1), x1(n, 0), delta(n, 0);
+		for (size_t i = 0; i < a.size(); i++) a[i] = i / n == i % n ? n : double(gen() % 1000) / 1000;
+		for (int i = 0; i < n; i++) b[i] = double(gen() % 1000) / 1000;
+		// eps 0: both make all the sweeps
+		double native = opencl_jacobi(platform_index, n, a.data(), b.data(), x0.data(), x1.data(), delta.data(), double_filename, (char*)"jacobiRowDouble", SWEEP_ROW_PER_GROUP, 0.0);
+		std::fill(x0.begin(), x0.end(), 1);
+		double emulated = opencl_jacobi_split(platform_index, n, a.data(), b.data(), x0.data(), x1.data(), float_filename, 0.0);
+		std::cout << "probe: native double " << native << ", emulated " << emulated << '\n';
+		split = emulated < native;
+	}
+	decided[platform_index] = split;
+	return split;
+}
+
+// Double Jacobi on the device of platform_index by what prefer_split picked for it: the float pair
+// sweeps or native jacobiRowDouble. split tells which one ran.
+double opencl_jacobi_fp64(int platform_index, int n, const double* a, double* b, double* x0, double* x1, double* delta, char* double_filename, char* float_filename, double eps, bool& split) {
+	split = prefer_split(platform_index, double_filename, float_filename);
+	if (split) return opencl_jacobi_split(platform_index, n, a, b, x0, x1, float_filename, eps);
+	return opencl_jacobi(platform_index, n, a, b, x0, x1, delta, double_filename, (char*)"jacobiRowDouble", SWEEP_ROW_PER_GROUP, eps);
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <CL/cl.h>
+#include <algorithm>
+#include "opencl_jacobi.h"
+
+// work-group tiles of the stencil kernels, halo included
+#define STENCIL_TILE_2D 16
+#define STENCIL_TILE_3D 8
+
+// 5-point (nz == 1) or 7-point operator on an nx x ny x nz grid with zero values outside:
+// (A u)[p] = center * u[p] + cx * (west + east) + cy * (south + north) + cz * (down + up).
+struct stencil {
+	int nx;
+	int ny;
+	int nz;
+	double center;
+	double cx;
+	double cy;
+	double cz;
+};
+
+// Matrix-free Jacobi for A u = f on the grid, x fastest: only f, u and delta live on the device.
+// Every launch makes sweeps Jacobi sweeps per tile load; sweeps is limited by the tile, it is at
+// most 7 in 2D and 3 in 3D (less when the device takes smaller work-groups).
+template<typename T>
+double opencl_stencil_jacobi(int platform_index, const stencil& grid, T* f, T* u0, T* u1, T* delta, char* filename, T eps, int sweeps = 2, int check_every = 8) {
+	const bool is_3d = grid.nz > 1;
+	const int n = grid.nx * grid.ny * grid.nz;
+	solver_env env = create_solver_env<T>(platform_index, n, nullptr, f, u0, u1, delta, filename);
+	cl_int ret;
+	cl_kernel kernel = clCreateKernel(env.program, kernel_name<T>(is_3d ? "stencil3d" : "stencil2d").c_str(), &ret);
+	check_ret(ret, "create kernel");
+
+	size_t max_group_size;
+	clGetDeviceInfo(env.device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_group_size), &max_group_size, nullptr);
+	size_t group_size[3] = { STENCIL_TILE_2D, STENCIL_TILE_2D, 1 };
+	if (is_3d) group_size[0] = group_size[1] = group_size[2] = STENCIL_TILE_3D;
+	// halve the largest side, the last one first, while a side keeps a point inside its halo of 1
+	const int tiled = is_3d ? 3 : 2;
+	while (group_size[0] * group_size[1] * group_size[2] > max_group_size) {
+		int largest = tiled - 1;
+		for (int d = tiled - 2; d >= 0; d--) {
+			if (group_size[d] > group_size[largest]) largest = d;
+		}
+		if (group_size[largest] / 2 < 3) break;
+		group_size[largest] /= 2;
+	}
+	if (group_size[0] * group_size[1] * group_size[2] > max_group_size) {
+		std::cout << "work-groups of the device too small for the stencil tile\n";
+		exit(1);
+	}
+	size_t smallest = is_3d ? std::min(group_size[0], std::min(group_size[1], group_size[2])) : std::min(group_size[0], group_size[1]);
+	sweeps = std::max(1, std::min(sweeps, (int)(smallest - 1) / 2));
+
+	int dims[3] = { grid.nx, grid.ny, grid.nz };
+	size_t global_work_size[3];
+	for (int d = 0; d < 3; d++) {
+		size_t interior = group_size[d] - (d < 2 || is_3d ? 2 * sweeps : 0);
+		global_work_size[d] = (dims[d] + interior - 1) / interior * group_size[d];
+	}
+
+	T center = (T)grid.center, cx = (T)grid.cx, cy = (T)grid.cy, cz = (T)grid.cz;
+	int arg = 4;
+	ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &env.memObjB);
+	check_ret(ret, "set kernel arg 0");
+	ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &env.memObjDelta);
+	check_ret(ret, "set kernel arg 3");
+	for (int d = 0; d < (is_3d ? 3 : 2); d++) {
+		ret = clSetKernelArg(kernel, arg++, sizeof(int), &dims[d]);
+		check_ret(ret, "set kernel arg grid size");
+	}
+	ret = clSetKernelArg(kernel, arg++, sizeof(T), &center);
+	check_ret(ret, "set kernel arg center");
+	ret = clSetKernelArg(kernel, arg++, sizeof(T), &cx);
+	check_ret(ret, "set kernel arg cx");
+	ret = clSetKernelArg(kernel, arg++, sizeof(T), &cy);
+	check_ret(ret, "set kernel arg cy");
+	if (is_3d) {
+		ret = clSetKernelArg(kernel, arg++, sizeof(T), &cz);
+		check_ret(ret, "set kernel arg cz");
+	}
+	ret = clSetKernelArg(kernel, arg++, sizeof(int), &sweeps);
+	check_ret(ret, "set kernel arg sweeps");
+	ret = clSetKernelArg(kernel, arg++, sizeof(T) * group_size[0] * group_size[1] * group_size[2], nullptr);
+	check_ret(ret, "set kernel arg tile");
+
+	T numerator;
+	double time = omp_get_wtime();
+	int launches = iterate(env, [&](solver_env& env) {
+		ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &env.memObjX0);
+		check_ret(ret, "set kernel arg 1");
+		ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &env.memObjX1);
+		check_ret(ret, "set kernel arg 2");
+
+		ret = clEnqueueNDRangeKernel(env.queue, kernel, is_3d ? 3 : 2, nullptr, global_work_size, group_size, 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueNDRangeKernel");
+		std::swap(env.memObjX0, env.memObjX1);
+	}, eps, (100 + sweeps - 1) / sweeps, check_every, numerator);
+
+	std::cout << "Iterations: " << launches * sweeps << " (" << sweeps << " per tile load)\n";
+	std::cout << "Accuracy: " << numerator << '\n';
+
+	finish_solver_env(env, n, u0, u1);
+	time = omp_get_wtime() - time;
+
+	clReleaseKernel(kernel);
+	return time;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <omp.h>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+// rows of A that share one pass over x; omp_jacobi keeps one accumulator per row, so this stays 4
+#define OMP_JACOBI_ROWS 4
+// columns of a tile: the tile of x (16 KB in double) stays in L1 while a thread's rows pass over it
+#define OMP_JACOBI_TILE 2048
+
+// Native Jacobi on the host threads with the iteration and stopping rule of opencl_jacobi:
+// x1 = D^-1 (b - (A - D) x0) until sum(|(x1 - x0) / x0|) <= eps, checked every check_every sweeps,
+// or 100 sweeps; the answer is returned in x0.
+// Every thread owns a fixed contiguous range of rows. The columns go in tiles of OMP_JACOBI_TILE:
+// all the thread's rows take their partial sums over one tile of x before the next tile, so x is
+// read from cache instead of memory once per row. Inside a tile the rows go OMP_JACOBI_ROWS at a
+// time through one vectorizable loop, every x[j] loaded serves all of them. A is read in place;
+// the thread first-touches its part of the vectors, A is placed by whoever allocated it.
+// The residual is a reduction of the sweep, there is no separate pass.
+template<typename T>
+double omp_jacobi(int n, const T* a, const T* b, T* x0, T* x1, T eps, int check_every = 8) {
+	const int nIter = 100;
+	const int blocks = (n + OMP_JACOBI_ROWS - 1) / OMP_JACOBI_ROWS;
+	T* u0 = new T[n];
+	T* u1 = new T[n];
+	T* inv_diag = new T[n];
+	T* sum = new T[n];
+	// the rows [first, last) of the calling thread, the same in every parallel region
+	auto own_rows = [&](int& first, int& last) {
+		const int threads = omp_get_num_threads(), thread = omp_get_thread_num();
+		first = (int)((long long)blocks * thread / threads) * OMP_JACOBI_ROWS;
+		last = std::min(n, (int)((long long)blocks * (thread + 1) / threads) * OMP_JACOBI_ROWS);
+	};
+	#pragma omp parallel
+	{
+		int first, last;
+		own_rows(first, last);
+		for (int i = first; i < last; i++) {
+			u0[i] = x0[i];
+			u1[i] = x1[i];
+			inv_diag[i] = 1 / a[(size_t)i * n + i];
+			sum[i] = 0;
+		}
+	}
+
+	double time = omp_get_wtime();
+	int iter = 0;
+	T residual = 0;
+	bool converged = false;
+	while (!converged && iter < nIter) {
+		int batch = std::min(check_every, nIter - iter);
+		for (int k = 0; k < batch; k++, iter++) {
+			residual = 0;
+			#pragma omp parallel reduction(+:residual)
+			{
+				int first, last;
+				own_rows(first, last);
+				for (int start = 0; start < n; start += OMP_JACOBI_TILE) {
+					const int end = std::min(n, start + OMP_JACOBI_TILE);
+					const T* x = u0 + start;
+					const int width = end - start;
+					for (int i = first; i < last; i += OMP_JACOBI_ROWS) {
+						// a short last block repeats row n - 1 and drops it
+						const T* row0 = a + (size_t)i * n + start;
+						const T* row1 = a + (size_t)std::min(i + 1, n - 1) * n + start;
+						const T* row2 = a + (size_t)std::min(i + 2, n - 1) * n + start;
+						const T* row3 = a + (size_t)std::min(i + 3, n - 1) * n + start;
+						T s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+						#pragma omp simd reduction(+:s0, s1, s2, s3)
+						for (int j = 0; j < width; j++) {
+							s0 += row0[j] * x[j];
+							s1 += row1[j] * x[j];
+							s2 += row2[j] * x[j];
+							s3 += row3[j] * x[j];
+						}
+						const T sums[OMP_JACOBI_ROWS] = { s0, s1, s2, s3 };
+						for (int r = 0; r < OMP_JACOBI_ROWS && i + r < n; r++) sum[i + r] += sums[r];
+					}
+				}
+				for (int i = first; i < last; i++) {
+					const T next = (b[i] - (sum[i] - a[(size_t)i * n + i] * u0[i])) * inv_diag[i];
+					residual += std::abs((next - u0[i]) / u0[i]);
+					u1[i] = next;
+					sum[i] = 0;
+				}
+			}
+			std::swap(u0, u1);
+		}
+		converged = !(residual > eps);
+	}
+
+	std::cout << "Iterations: " << iter << '\n';
+	std::cout << "Accuracy: " << residual << '\n';
+	time = omp_get_wtime() - time;
+
+	std::copy(u0, u0 + n, x0);
+	std::copy(u1, u1 + n, x1);
+	delete[] u0;
+	delete[] u1;
+	delete[] inv_diag;
+	delete[] sum;
+	return time;
+}
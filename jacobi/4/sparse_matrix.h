@@ -0,0 +1,302 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <omp.h>
+
+// Compressed sparse rows: the columns of row i are col[row_ptr[i]..row_ptr[i + 1]), sorted.
+template<typename T>
+struct csr_matrix {
+	int n;
+	std::vector<int> row_ptr;
+	std::vector<int> col;
+	std::vector<T> val;
+};
+
+// Read-only window on an array owned elsewhere, a std::vector or a mapped file.
+template<typename U>
+struct array_view {
+	const U* ptr;
+	size_t count;
+
+	const U* data() const { return ptr; }
+	size_t size() const { return count; }
+	const U& operator[](size_t i) const { return ptr[i]; }
+};
+
+// CSR arrays without ownership: the conversions and the sparse solver take this, so a matrix mapped
+// from disk goes to the device without a copy.
+template<typename T>
+struct csr_view {
+	int n;
+	array_view<int> row_ptr;
+	array_view<int> col;
+	array_view<T> val;
+};
+
+template<typename T>
+csr_view<T> view(const csr_matrix<T>& a) {
+	return { a.n, { a.row_ptr.data(), a.row_ptr.size() }, { a.col.data(), a.col.size() }, { a.val.data(), a.val.size() } };
+}
+
+// ELLPACK: every row padded to width entries, stored column-major (entry k of row i at k * n + i)
+// so that consecutive rows are consecutive in memory. Padding has col = i and val = 0.
+template<typename T>
+struct ell_matrix {
+	int n;
+	int width;
+	std::vector<int> col;
+	std::vector<T> val;
+};
+
+// SELL-C-sigma: rows sorted by length inside windows of sigma rows (perm[t] is the row stored at
+// position t, -1 past n), cut into slices of c rows, each slice is ELLPACK with its own width and
+// starts at slice_ptr[slice].
+template<typename T>
+struct sell_matrix {
+	int n;
+	int c;
+	int sigma;
+	std::vector<int> perm;
+	std::vector<int> slice_ptr;
+	std::vector<int> col;
+	std::vector<T> val;
+};
+
+// Duplicate entries add up, as in Matrix Market files.
+template<typename T>
+std::vector<T> diagonal(const csr_view<T>& a) {
+	std::vector<T> d(a.n, 0);
+	#pragma omp parallel for
+	for (int i = 0; i < a.n; i++) {
+		for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) {
+			if (a.col[k] == i) d[i] += a.val[k];
+		}
+	}
+	return d;
+}
+
+template<typename T>
+ell_matrix<T> to_ell(const csr_view<T>& a) {
+	ell_matrix<T> ell;
+	ell.n = a.n;
+	ell.width = 0;
+	for (int i = 0; i < a.n; i++) ell.width = std::max(ell.width, a.row_ptr[i + 1] - a.row_ptr[i]);
+	ell.col.resize((size_t)ell.width * a.n);
+	ell.val.resize((size_t)ell.width * a.n);
+	#pragma omp parallel for
+	for (int i = 0; i < a.n; i++) {
+		int len = a.row_ptr[i + 1] - a.row_ptr[i];
+		for (int k = 0; k < ell.width; k++) {
+			ell.col[(size_t)k * a.n + i] = k < len ? a.col[a.row_ptr[i] + k] : i;
+			ell.val[(size_t)k * a.n + i] = k < len ? a.val[a.row_ptr[i] + k] : 0;
+		}
+	}
+	return ell;
+}
+
+template<typename T>
+sell_matrix<T> to_sell(const csr_view<T>& a, int c, int sigma) {
+	sell_matrix<T> sell;
+	sell.n = a.n;
+	sell.c = c;
+	sell.sigma = sigma;
+	int slices = (a.n + c - 1) / c;
+	sell.perm.assign((size_t)slices * c, -1);
+	for (int i = 0; i < a.n; i++) sell.perm[i] = i;
+	auto length = [&](int i) { return a.row_ptr[i + 1] - a.row_ptr[i]; };
+	#pragma omp parallel for
+	for (int start = 0; start < a.n; start += sigma) {
+		std::stable_sort(sell.perm.begin() + start, sell.perm.begin() + std::min(a.n, start + sigma),
+			[&](int x, int y) { return length(x) > length(y); });
+	}
+
+	sell.slice_ptr.assign(slices + 1, 0);
+	for (int s = 0; s < slices; s++) {
+		int width = 0;
+		for (int r = 0; r < c; r++) {
+			int row = sell.perm[s * c + r];
+			if (row >= 0) width = std::max(width, length(row));
+		}
+		sell.slice_ptr[s + 1] = sell.slice_ptr[s] + width * c;
+	}
+	sell.col.assign(sell.slice_ptr[slices], 0);
+	sell.val.assign(sell.slice_ptr[slices], 0);
+	#pragma omp parallel for
+	for (int s = 0; s < slices; s++) {
+		int width = (sell.slice_ptr[s + 1] - sell.slice_ptr[s]) / c;
+		for (int r = 0; r < c; r++) {
+			int row = sell.perm[s * c + r];
+			int len = row >= 0 ? length(row) : 0;
+			for (int k = 0; k < width; k++) {
+				size_t p = sell.slice_ptr[s] + (size_t)k * c + r;
+				sell.col[p] = k < len ? a.col[a.row_ptr[row] + k] : std::max(row, 0);
+				sell.val[p] = k < len ? a.val[a.row_ptr[row] + k] : 0;
+			}
+		}
+	}
+	return sell;
+}
+
+// Binary cache of a converted .mtx, written next to it as <path>.bin. The size and an FNV-1a hash
+// of the source file are stored to notice a changed source.
+struct csr_cache_header {
+	char magic[8];
+	int64_t source_size;
+	uint64_t source_hash;
+	int32_t value_size;
+	int32_t n;
+	int64_t nnz;
+};
+
+uint64_t fnv1a(const std::string& data) {
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : data) hash = (hash ^ c) * 1099511628211ull;
+	return hash;
+}
+
+template<typename T>
+bool load_csr_cache(const std::string& path, int64_t source_size, uint64_t source_hash, csr_matrix<T>& a) {
+	std::ifstream is(path, std::ios::binary);
+	csr_cache_header header;
+	if (!is.read((char*)&header, sizeof(header))) return false;
+	if (memcmp(header.magic, "CSRBIN2", 8) != 0 || header.source_size != source_size || header.source_hash != source_hash || header.value_size != sizeof(T)) return false;
+	a.n = header.n;
+	a.row_ptr.resize(header.n + 1);
+	a.col.resize(header.nnz);
+	a.val.resize(header.nnz);
+	is.read((char*)a.row_ptr.data(), sizeof(int) * a.row_ptr.size());
+	is.read((char*)a.col.data(), sizeof(int) * a.col.size());
+	is.read((char*)a.val.data(), sizeof(T) * a.val.size());
+	return (bool)is;
+}
+
+template<typename T>
+void save_csr_cache(const std::string& path, int64_t source_size, uint64_t source_hash, const csr_matrix<T>& a) {
+	std::ofstream os(path, std::ios::binary);
+	csr_cache_header header = { "CSRBIN2", source_size, source_hash, sizeof(T), a.n, (int64_t)a.col.size() };
+	os.write((const char*)&header, sizeof(header));
+	os.write((const char*)a.row_ptr.data(), sizeof(int) * a.row_ptr.size());
+	os.write((const char*)a.col.data(), sizeof(int) * a.col.size());
+	os.write((const char*)a.val.data(), sizeof(T) * a.val.size());
+}
+
+// Square coordinate Matrix Market file (real, integer or pattern; general, symmetric or
+// skew-symmetric) to CSR.
+// The body is split into one chunk of lines per thread and parsed in parallel, the rows are counted,
+// filled and sorted in parallel. The result is cached in <path>.bin and read from there next time
+// the source hashes the same, only the parsing is saved.
+template<typename T>
+csr_matrix<T> load_matrix_market(const std::string& path) {
+	csr_matrix<T> a;
+	std::ifstream is(path, std::ios::binary | std::ios::ate);
+	if (!is) {
+		std::cout << "can not open " << path << '\n';
+		exit(1);
+	}
+	int64_t source_size = is.tellg();
+	std::string data(source_size, '\0');
+	is.seekg(0);
+	is.read(&data[0], source_size);
+	uint64_t source_hash = fnv1a(data);
+	if (load_csr_cache(path + ".bin", source_size, source_hash, a)) return a;
+
+	// %%MatrixMarket matrix coordinate <field> <symmetry>
+	size_t pos = data.find('\n');
+	std::string banner = data.substr(0, pos);
+	if (!banner.empty() && banner.back() == '\r') banner.pop_back();
+	std::string symmetry = banner.substr(banner.find_last_of(" \t") + 1);
+	std::transform(symmetry.begin(), symmetry.end(), symmetry.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	if (symmetry != "general" && symmetry != "symmetric" && symmetry != "skew-symmetric") {
+		std::cout << "unsupported symmetry " << symmetry << " in " << path << '\n';
+		exit(1);
+	}
+	bool symmetric = symmetry != "general";
+	// the mirrored entries of a skew-symmetric matrix change sign
+	T mirror = symmetry == "skew-symmetric" ? T(-1) : T(1);
+	bool pattern = banner.find("pattern") != std::string::npos;
+	while (pos != std::string::npos && data[pos + 1] == '%') pos = data.find('\n', pos + 1);
+	char* p = &data[pos + 1];
+	int rows = strtol(p, &p, 10);
+	strtol(p, &p, 10);
+	long long entries = strtoll(p, &p, 10);
+	size_t body = p - data.data();
+
+	// chunk boundaries moved to the next line start
+	int threads = omp_get_max_threads();
+	std::vector<size_t> bounds(threads + 1, data.size());
+	bounds[0] = body;
+	for (int t = 1; t < threads; t++) {
+		size_t at = body + (data.size() - body) * t / threads;
+		at = data.find('\n', at);
+		bounds[t] = at == std::string::npos ? data.size() : at;
+	}
+
+	struct entry {
+		int row;
+		int col;
+		T val;
+	};
+	std::vector<std::vector<entry>> parsed(threads);
+	#pragma omp parallel for
+	for (int t = 0; t < threads; t++) {
+		char* q = &data[bounds[t]];
+		char* end = &data[0] + bounds[t + 1];
+		std::vector<entry>& local = parsed[t];
+		local.reserve(entries / threads + 1);
+		while (q < end) {
+			char* next;
+			long row = strtol(q, &next, 10);
+			if (next == q || next > end) break;
+			q = next;
+			long col = strtol(q, &q, 10);
+			T val = pattern ? T(1) : (T)strtod(q, &q);
+			local.push_back({ (int)row - 1, (int)col - 1, val });
+			if (symmetric && row != col) local.push_back({ (int)col - 1, (int)row - 1, mirror * val });
+		}
+	}
+
+	a.n = rows;
+	a.row_ptr.assign(rows + 1, 0);
+	#pragma omp parallel for
+	for (int t = 0; t < threads; t++) {
+		for (const entry& e : parsed[t]) {
+			#pragma omp atomic
+			a.row_ptr[e.row + 1]++;
+		}
+	}
+	for (int i = 0; i < rows; i++) a.row_ptr[i + 1] += a.row_ptr[i];
+	a.col.resize(a.row_ptr[rows]);
+	a.val.resize(a.row_ptr[rows]);
+	std::vector<int> fill(a.row_ptr.begin(), a.row_ptr.end() - 1);
+	#pragma omp parallel for
+	for (int t = 0; t < threads; t++) {
+		for (const entry& e : parsed[t]) {
+			int at;
+			#pragma omp atomic capture
+			at = fill[e.row]++;
+			a.col[at] = e.col;
+			a.val[at] = e.val;
+		}
+	}
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int i = 0; i < rows; i++) {
+		std::vector<std::pair<int, T>> row;
+		for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) row.push_back({ a.col[k], a.val[k] });
+		std::sort(row.begin(), row.end(), [](const std::pair<int, T>& x, const std::pair<int, T>& y) { return x.first < y.first; });
+		for (size_t k = 0; k < row.size(); k++) {
+			a.col[a.row_ptr[i] + k] = row[k].first;
+			a.val[a.row_ptr[i] + k] = row[k].second;
+		}
+	}
+
+	save_csr_cache(path + ".bin", source_size, source_hash, a);
+	return a;
+}
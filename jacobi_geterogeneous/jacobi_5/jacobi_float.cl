@@ -18,4 +18,64 @@ __kernel void jacobiFloat(
 	x1[j + stride] = (b[j + stride] - ans) / a[j * n + j + stride];
 	delta[j + stride] = x1[j + stride] - x0[j + stride];
 	if (x0[j + stride] > EPS) delta[j + stride] /= x0[j + stride];
-}
\ No newline at end of file
+}
+
+// a, b, x1 and delta are views of the device's rows, x0 is the whole vector
+__kernel void jacobiFloatShared(
+		__global const float* a,
+		__global const float* b,
+		__global const float* x0,
+		__global float* x1,
+		__global float* delta,
+		int n,
+		int stride) {
+	const int j = get_global_id(0);
+	const int row = j + stride;
+	float ans = 0;
+
+	for (int i = 0; i < n; i++) {
+		ans += a[j * n + i] * x0[i] * (float)(i != row);
+	}
+
+	x1[j] = (b[j] - ans) / a[j * n + row];
+	delta[j] = x1[j] - x0[row];
+	if (x0[row] > EPS) delta[j] /= x0[row];
+}
+
+// Row sums of jacobiFloat split by columns so that the device's own columns [stride, stride + rows)
+// can be summed before the segments of the other devices arrive: finish == 0 writes that part to
+// partial, finish == 1 adds the other columns and updates x1 and delta like jacobiFloat.
+__kernel void jacobiFloatPart(
+		__global const float* a,
+		__global const float* b,
+		__global const float* x0,
+		__global float* x1,
+		__global float* delta,
+		int n,
+		int stride,
+		__global float* partial,
+		int rows,
+		int finish) {
+	const int j = get_global_id(0);
+	const int row = j + stride;
+	float ans = 0;
+
+	if (!finish) {
+		for (int i = stride; i < stride + rows; i++) {
+			ans += a[j * n + i] * x0[i] * (float)(i != row);
+		}
+		partial[j] = ans;
+		return;
+	}
+	for (int i = 0; i < stride; i++) {
+		ans += a[j * n + i] * x0[i];
+	}
+	for (int i = stride + rows; i < n; i++) {
+		ans += a[j * n + i] * x0[i];
+	}
+	ans += partial[j];
+
+	x1[row] = (b[row] - ans) / a[j * n + row];
+	delta[row] = x1[row] - x0[row];
+	if (x0[row] > EPS) delta[row] /= x0[row];
+}
@@ -4,7 +4,10 @@
 #include <random>
 #include <chrono>
 #include <cassert>
+#include <vector>
 #include "opencl_jacobi.h"
+#include "partition_calibration.h"
+#include "opencl_jacobi_async.h"
 std::mt19937 gen(std::chrono::high_resolution_clock::now().time_since_epoch().count());
 const int n = 32 * 500;
 
@@ -85,6 +88,7 @@ void lets_go(const char* message) {
 	T* x1 = new T[n];
 	T* delta = new T[n];
 	std::pair<double, double> cpu_time, gpu_time, cpu_gpu_time;
+	double partition;
 	generateA(a);
 
 	if (!check(a)){
@@ -107,6 +111,11 @@ void lets_go(const char* message) {
 		cpu_gpu_time = opencl_jacobi(2, 1, n, a, b, x0, x1, delta, filename, kernelname, (double)j / 10, eps, nIter);
 		std::cout << (double)j / 10 << " * cpu & " << (1.0 - (double)j / 10) << " * gpu time = \t" << cpu_gpu_time.first << ";   \t" << cpu_gpu_time.second << '\n';
 	}
+	for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
+	partition = calibrate_partition(2, 1, n, a, b, x0, x1, delta, filename, kernelname);
+	for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
+	cpu_gpu_time = opencl_jacobi(2, 1, n, a, b, x0, x1, delta, filename, kernelname, partition, eps, nIter);
+	std::cout << "calibrated " << partition << " * cpu & " << 1 - partition << " * gpu time = \t" << cpu_gpu_time.first << ";   \t" << cpu_gpu_time.second << '\n';
 
 	std::cout << "\nIntel(R) Core(TM) i5-7500 VS Intel(R) HD Graphics 630\n******************************************************************\n";
 	for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
@@ -120,6 +129,25 @@ void lets_go(const char* message) {
 		cpu_gpu_time = opencl_jacobi(2, 0, n, a, b, x0, x1, delta, filename, kernelname, (double)j / 10, eps, nIter);
 		std::cout << (double)j / 10 << " * cpu & " << (1.0 - (double)j / 10) << " * gpu time = \t" << cpu_gpu_time.first << ";   \t" << cpu_gpu_time.second << '\n';
 	}
+	for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
+	partition = calibrate_partition(2, 0, n, a, b, x0, x1, delta, filename, kernelname);
+	for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
+	cpu_gpu_time = opencl_jacobi(2, 0, n, a, b, x0, x1, delta, filename, kernelname, partition, eps, nIter);
+	std::cout << "calibrated " << partition << " * cpu & " << 1 - partition << " * gpu time = \t" << cpu_gpu_time.first << ";   \t" << cpu_gpu_time.second << '\n';
+
+	std::cout << "\nAll devices\n******************************************************************\n";
+	std::vector<cl_device_id> devices = enumerate_devices();
+	for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
+	std::vector<device_share> shares = calibrate_shares(devices, n, a, b, x0, x1, delta, filename, kernelname);
+	for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
+	cpu_gpu_time = opencl_jacobi(shares, n, a, b, x0, x1, delta, filename, kernelname, eps, nIter);
+	std::cout << "calibrated " << devices.size() << " devices time = \t" << cpu_gpu_time.first << ";   \t" << cpu_gpu_time.second << '\n';
+	for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
+	cpu_gpu_time = opencl_jacobi_shared(shares, n, a, b, x0, x1, delta, filename, kernelname, eps, nIter);
+	std::cout << "shared contexts time = \t\t" << cpu_gpu_time.first << ";   \t" << cpu_gpu_time.second << '\n';
+	for (int i = 0; i < n; i++) x0[i] = 0, x1[i] = 0;
+	cpu_gpu_time = opencl_jacobi_async(shares, n, a, b, x0, x1, delta, filename, kernelname, eps, nIter);
+	std::cout << "asynchronous time = \t\t" << cpu_gpu_time.first << ";   \t" << cpu_gpu_time.second << '\n';
 	std::cout << '\n';
 }
 
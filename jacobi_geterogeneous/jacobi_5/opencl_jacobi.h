@@ -1,17 +1,70 @@
+#pragma once
 #include <CL/cl.h>
 #include <istream>
 #include <fstream>
 #include <omp.h>
+#include <algorithm>
+#include <vector>
 
 #define BLOCK_SIZE 32
 
 void initialize(int platform_index, cl_device_id& device) {
-	cl_platform_id* platforms = new cl_platform_id[3];
-	clGetPlatformIDs(3, platforms, nullptr);
+	cl_uint platform_count = 0;
+	clGetPlatformIDs(0, nullptr, &platform_count);
+	std::vector<cl_platform_id> platforms(platform_count);
+	clGetPlatformIDs(platform_count, platforms.data(), nullptr);
 
-	cl_device_id* devices = new cl_device_id[1];
-	clGetDeviceIDs(platforms[platform_index], CL_DEVICE_TYPE_ALL, 1, devices, nullptr);
-	device = devices[0];
+	clGetDeviceIDs(platforms[platform_index], CL_DEVICE_TYPE_ALL, 1, &device, nullptr);
+}
+
+// Every device of every platform, in platform order.
+std::vector<cl_device_id> enumerate_devices() {
+	cl_uint platform_count = 0;
+	clGetPlatformIDs(0, nullptr, &platform_count);
+	std::vector<cl_platform_id> platforms(platform_count);
+	clGetPlatformIDs(platform_count, platforms.data(), nullptr);
+
+	std::vector<cl_device_id> devices;
+	for (cl_uint i = 0; i < platform_count; i++) {
+		cl_uint device_count = 0;
+		clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 0, nullptr, &device_count);
+		std::vector<cl_device_id> platform_devices(device_count);
+		clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, device_count, platform_devices.data(), nullptr);
+		devices.insert(devices.end(), platform_devices.begin(), platform_devices.end());
+	}
+	return devices;
+}
+
+// A device of the heterogeneous executor and its relative share of the rows.
+struct device_share {
+	cl_device_id device;
+	double weight;
+};
+
+// Splits n rows into BLOCK_SIZE aligned parts proportional to the weights.
+std::vector<int> split_rows(int n, const std::vector<device_share>& devices) {
+	int blocks = n / BLOCK_SIZE;
+	double total = 0;
+	for (const device_share& d : devices) total += d.weight;
+
+	std::vector<int> rows(devices.size());
+	std::vector<double> rest(devices.size());
+	int given = 0;
+	for (size_t i = 0; i < devices.size(); i++) {
+		double share = blocks * devices[i].weight / total;
+		rows[i] = (int)share;
+		rest[i] = share - rows[i];
+		given += rows[i];
+	}
+	// the largest remainders get the leftover blocks
+	while (given < blocks) {
+		size_t i = std::max_element(rest.begin(), rest.end()) - rest.begin();
+		rows[i]++;
+		rest[i] = -1;
+		given++;
+	}
+	for (int& r : rows) r *= BLOCK_SIZE;
+	return rows;
 }
 
 char* get_device_name(cl_device_id& device) {
@@ -64,7 +117,20 @@ struct opencl_env {
 		memObjX0(_memX0),
 		memObjX1(_memX1),
 		memObjDelta(_memDelta) {}
+	opencl_env(opencl_env&& other) noexcept
+		: context(other.context),
+		queue(other.queue),
+		program(other.program),
+		kernel(other.kernel),
+		memObjA(other.memObjA),
+		memObjB(other.memObjB),
+		memObjX0(other.memObjX0),
+		memObjX1(other.memObjX1),
+		memObjDelta(other.memObjDelta) {
+		other.context = nullptr;
+	}
 	~opencl_env() {
+		if (context == nullptr) return;
 		clReleaseMemObject(memObjA);
 		clReleaseMemObject(memObjB);
 		clReleaseMemObject(memObjX0);
@@ -79,7 +145,7 @@ struct opencl_env {
 
 template<typename T>
 opencl_env create_env(
-	int platform_index,
+	cl_device_id device,
 	int n,
 	int m,
 	int stride,
@@ -90,8 +156,6 @@ opencl_env create_env(
 	T* delta,
 	char* filename,
 	char* kernelname) {
-	cl_device_id device;
-	initialize(platform_index, device);
 	std::string kernel_code = read_kernel(filename);
 	size_t kernel_len = kernel_code.size();
 
@@ -154,10 +218,77 @@ opencl_env create_env(
 	return opencl_env(context, command_queue, program, kernel, memObjA, memObjB, memObjX0, memObjX1, memObjDelta);
 }
 
+template<typename T>
+opencl_env create_env(
+	int platform_index,
+	int n,
+	int m,
+	int stride,
+	T* a,
+	T* b,
+	T* x0,
+	T* x1,
+	T* delta,
+	char* filename,
+	char* kernelname) {
+	cl_device_id device;
+	initialize(platform_index, device);
+	return create_env(device, n, m, stride, a, b, x0, x1, delta, filename, kernelname);
+}
+
+// Second queue, split kernels and partial sums of a device in opencl_jacobi.
+struct segment_exchange {
+	cl_command_queue transfer;
+	cl_kernel local;
+	cl_kernel remote;
+	cl_mem memObjPartial;
+	cl_mem memObjX[2];
+};
+
+// EPS of the kernel files, delta is divided by x0 only above it
+#define DELTA_EPS 0.0001
+// opencl_jacobi compares the kernel times of the devices every REBALANCE_EVERY sweeps and moves rows
+// when the slowest one takes REBALANCE_IMBALANCE times as long as the fastest one
+#define REBALANCE_EVERY 8
+#define REBALANCE_IMBALANCE 1.1
+
+// Row counts for devices that spent times[i] seconds on rows[i] rows: proportional to the measured
+// rows per second and at least one block each, so that every device can still be measured.
+// Returns rows unchanged when the devices are balanced within REBALANCE_IMBALANCE.
+std::vector<int> rebalance_rows(const std::vector<int>& rows, const std::vector<double>& times) {
+	double slowest = *std::max_element(times.begin(), times.end());
+	double fastest = *std::min_element(times.begin(), times.end());
+	if (!(fastest > 0) || slowest < REBALANCE_IMBALANCE * fastest) return rows;
+	int n = 0;
+	std::vector<device_share> shares(rows.size());
+	for (size_t i = 0; i < rows.size(); i++) {
+		n += rows[i];
+		shares[i] = { nullptr, rows[i] / times[i] };
+	}
+	std::vector<int> balanced = split_rows(n, shares);
+	for (size_t i = 0; i < balanced.size(); i++) {
+		if (balanced[i] > 0) continue;
+		size_t largest = std::max_element(balanced.begin(), balanced.end()) - balanced.begin();
+		balanced[largest] -= BLOCK_SIZE;
+		balanced[i] += BLOCK_SIZE;
+	}
+	return balanced;
+}
+
+// Splits the rows of the system between the devices by their weights.
+// Every device keeps x in two buffers: a sweep reads one and writes its own segment of the other.
+// Only the segments move: each device's new segment is read back without blocking and written to
+// the other devices, and the part of the next sweep over the device's own columns (<kernelname>Part
+// with finish == 0) runs meanwhile; the rest of the sweep waits for the segments. Transfers go
+// through a second queue of the device so that they overlap the kernels. The residual is computed
+// on the host from the segments, delta is not read.
+// The rows are rebalanced while solving: every REBALANCE_EVERY sweeps the profiled kernel times give
+// each device's rows per second, and when they are uneven the block-aligned row ranges move, the
+// kept rows of A copied on the device and the gained ones uploaded from a.
+// Returns the sum of the kernel times and the full solve time.
 template<typename T>
 std::pair<double, double> opencl_jacobi(
-		int cpu_platform_index,
-		int gpu_platform_index,
+		const std::vector<device_share>& devices,
 		int n,
 		T* a,
 		T* b,
@@ -166,20 +297,13 @@ std::pair<double, double> opencl_jacobi(
 		T* delta,
 		char* filename,
 		char* kernelname,
-		double partition,
 		double eps,
 		int nIter) {
-	
-	int cpu_n = n * partition;
-	int gpu_n = n - cpu_n;
-	
-	if (cpu_n % BLOCK_SIZE != 0 || gpu_n % BLOCK_SIZE != 0){
+	if (n % BLOCK_SIZE != 0){
 		std::cout << "wrong size of matrices\n";
 		exit(1);
 	}
 
-	size_t cpu_global_work_size[1] = { cpu_n };
-	size_t gpu_global_work_size[1] = { gpu_n };
 	size_t group_size = BLOCK_SIZE;
 	cl_int ret;
 	int iter = 0;
@@ -187,177 +311,535 @@ std::pair<double, double> opencl_jacobi(
 	double time = 0;
 	cl_ulong time_start;
 	cl_ulong time_end;
-	cl_event cpu_event, gpu_event;
-	T* buf = new T[n];
 	double full_time = omp_get_wtime();
 
-	if (gpu_n == 0){
-		opencl_env cpu_env = create_env(cpu_platform_index, cpu_n, n, 0, a, b, x0, x1, delta, filename, kernelname);
-
-		do {
-			ret = clSetKernelArg(cpu_env.kernel, 2, sizeof(cl_mem), &cpu_env.memObjX0);
-			check_ret(ret, "set cpu kernel arg 2");
-			
-			ret = clEnqueueNDRangeKernel(cpu_env.queue, cpu_env.kernel, 1, nullptr, cpu_global_work_size, &group_size, 0, nullptr, &cpu_event);
-			clWaitForEvents(1, &cpu_event);
-
-			clGetEventProfilingInfo(cpu_event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, nullptr);
-			clGetEventProfilingInfo(cpu_event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, nullptr);
-			time += (time_end - time_start) / 1e9;
+	std::vector<int> rows = split_rows(n, devices);
+	std::vector<int> first_row, env_rows;
+	std::vector<opencl_env> envs;
+	std::vector<segment_exchange> exchange;
+	envs.reserve(devices.size());
+	std::string part_kernel = std::string(kernelname) + "Part";
+	cl_queue_properties props[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
+	int row = 0;
+	for (size_t i = 0; i < devices.size(); row += rows[i], i++) {
+		if (rows[i] == 0) continue;
+		envs.push_back(create_env(devices[i].device, rows[i], n, row, &a[row * n], b, x0, x1, delta, filename, kernelname));
+		first_row.push_back(row);
+		env_rows.push_back(rows[i]);
+
+		opencl_env& env = envs.back();
+		segment_exchange ex;
+		ex.transfer = clCreateCommandQueueWithProperties(env.context, devices[i].device, props, &ret);
+		check_ret(ret, "clCreateCommandQueueWithProperties");
+		ex.memObjPartial = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * rows[i], nullptr, &ret);
+		check_ret(ret, "create buffer partial");
+		ex.memObjX[0] = env.memObjX0;
+		ex.memObjX[1] = env.memObjX1;
+		cl_kernel* kernels[2] = { &ex.local, &ex.remote };
+		for (int finish = 0; finish < 2; finish++) {
+			cl_kernel kernel = clCreateKernel(env.program, part_kernel.c_str(), &ret);
+			check_ret(ret, "clCreateKernel");
+			ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &env.memObjA);
+			check_ret(ret, "set kernel arg 0");
+			ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &env.memObjB);
+			check_ret(ret, "set kernel arg 1");
+			// the local part never writes x1, but every argument has to be bound
+			ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &ex.memObjX[1]);
+			check_ret(ret, "set kernel arg 3");
+			ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &env.memObjDelta);
+			check_ret(ret, "set kernel arg 4");
+			ret = clSetKernelArg(kernel, 5, sizeof(int), &n);
+			check_ret(ret, "set kernel arg 5");
+			ret = clSetKernelArg(kernel, 6, sizeof(int), &row);
+			check_ret(ret, "set kernel arg 6");
+			ret = clSetKernelArg(kernel, 7, sizeof(cl_mem), &ex.memObjPartial);
+			check_ret(ret, "set kernel arg 7");
+			ret = clSetKernelArg(kernel, 8, sizeof(int), &rows[i]);
+			check_ret(ret, "set kernel arg 8");
+			ret = clSetKernelArg(kernel, 9, sizeof(int), &finish);
+			check_ret(ret, "set kernel arg 9");
+			*kernels[finish] = kernel;
+		}
+		exchange.push_back(ex);
+	}
 
-			ret = clEnqueueReadBuffer(cpu_env.queue, cpu_env.memObjDelta, CL_TRUE, 0, sizeof(T) * n, delta, 0, nullptr, nullptr);
+	// host copies of x: the sweep reads x[cur], its segments come back to x[1 - cur]
+	std::vector<T> x[2] = { std::vector<T>(x0, x0 + n), std::vector<T>(x0, x0 + n) };
+	std::vector<cl_event> local_events(envs.size()), remote_events(envs.size()), reads(envs.size());
+	// the local part of the sweep in flight, local_events holds the one of the next sweep
+	std::vector<cl_event> done_local(envs.size());
+	// kernel seconds of every device since the last rebalancing
+	std::vector<double> device_time(envs.size(), 0);
+	// writes of the other segments the next sweep of a device waits for
+	std::vector<std::vector<cl_event>> writes(envs.size());
+	int cur = 0;
+
+	auto enqueue_local = [&](size_t i, int from) {
+		ret = clSetKernelArg(exchange[i].local, 2, sizeof(cl_mem), &exchange[i].memObjX[from]);
+		check_ret(ret, "set kernel arg 2");
+		ret = clSetKernelArg(exchange[i].local, 3, sizeof(cl_mem), &exchange[i].memObjX[1 - from]);
+		check_ret(ret, "set kernel arg 3");
+		size_t global_work_size[1] = { (size_t)env_rows[i] };
+		ret = clEnqueueNDRangeKernel(envs[i].queue, exchange[i].local, 1, nullptr, global_work_size, &group_size, 0, nullptr, &local_events[i]);
+		check_ret(ret, "clEnqueueNDRangeKernel");
+	};
+	// gives device i the rows [row, row + rows)
+	auto migrate = [&](size_t i, int row, int rows) {
+		cl_mem memObjA = clCreateBuffer(envs[i].context, CL_MEM_READ_ONLY, sizeof(T) * rows * n, nullptr, &ret);
+		check_ret(ret, "create buffer A");
+		int kept_first = std::max(row, first_row[i]);
+		int kept_last = std::min(row + rows, first_row[i] + env_rows[i]);
+		if (kept_first < kept_last) {
+			ret = clEnqueueCopyBuffer(envs[i].queue, envs[i].memObjA, memObjA, sizeof(T) * (kept_first - first_row[i]) * n, sizeof(T) * (kept_first - row) * n, sizeof(T) * (kept_last - kept_first) * n, 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueCopyBuffer A");
+		}
+		else {
+			kept_first = kept_last = row + rows;
+		}
+		if (row < kept_first) {
+			ret = clEnqueueWriteBuffer(envs[i].queue, memObjA, CL_FALSE, 0, sizeof(T) * (kept_first - row) * n, &a[(size_t)row * n], 0, nullptr, nullptr);
+			check_ret(ret, "EnqueueWriteBuffer A");
+		}
+		if (kept_last < row + rows) {
+			ret = clEnqueueWriteBuffer(envs[i].queue, memObjA, CL_FALSE, sizeof(T) * (kept_last - row) * n, sizeof(T) * (row + rows - kept_last) * n, &a[(size_t)kept_last * n], 0, nullptr, nullptr);
+			check_ret(ret, "EnqueueWriteBuffer A");
+		}
+		clFinish(envs[i].queue);
+		clReleaseMemObject(envs[i].memObjA);
+		envs[i].memObjA = memObjA;
+		clReleaseMemObject(exchange[i].memObjPartial);
+		exchange[i].memObjPartial = clCreateBuffer(envs[i].context, CL_MEM_READ_WRITE, sizeof(T) * rows, nullptr, &ret);
+		check_ret(ret, "create buffer partial");
+		for (cl_kernel kernel : { exchange[i].local, exchange[i].remote }) {
+			ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &envs[i].memObjA);
+			check_ret(ret, "set kernel arg 0");
+			ret = clSetKernelArg(kernel, 6, sizeof(int), &row);
+			check_ret(ret, "set kernel arg 6");
+			ret = clSetKernelArg(kernel, 7, sizeof(cl_mem), &exchange[i].memObjPartial);
+			check_ret(ret, "set kernel arg 7");
+			ret = clSetKernelArg(kernel, 8, sizeof(int), &rows);
+			check_ret(ret, "set kernel arg 8");
+		}
+		ret = clSetKernelArg(envs[i].kernel, 0, sizeof(cl_mem), &envs[i].memObjA);
+		check_ret(ret, "set kernel arg 0");
+		first_row[i] = row;
+		env_rows[i] = rows;
+	};
+
+	for (size_t i = 0; i < envs.size(); i++) enqueue_local(i, cur);
+
+	while (true) {
+		for (size_t i = 0; i < envs.size(); i++) {
+			ret = clSetKernelArg(exchange[i].remote, 2, sizeof(cl_mem), &exchange[i].memObjX[cur]);
+			check_ret(ret, "set kernel arg 2");
+			ret = clSetKernelArg(exchange[i].remote, 3, sizeof(cl_mem), &exchange[i].memObjX[1 - cur]);
+			check_ret(ret, "set kernel arg 3");
+			size_t global_work_size[1] = { (size_t)env_rows[i] };
+			ret = clEnqueueNDRangeKernel(envs[i].queue, exchange[i].remote, 1, nullptr, global_work_size, &group_size, (cl_uint)writes[i].size(), writes[i].data(), &remote_events[i]);
+			check_ret(ret, "clEnqueueNDRangeKernel");
+			ret = clEnqueueReadBuffer(exchange[i].transfer, exchange[i].memObjX[1 - cur], CL_FALSE, sizeof(T) * first_row[i], sizeof(T) * env_rows[i], &x[1 - cur][first_row[i]], 1, &remote_events[i], &reads[i]);
 			check_ret(ret, "clEnqueueReadBuffer");
+			clFlush(exchange[i].transfer);
+			// the own columns of the next sweep while the segment travels
+			done_local[i] = local_events[i];
+			enqueue_local(i, 1 - cur);
+			clFlush(envs[i].queue);
+		}
 
-			acc = 0;
-			for (int i = 0; i < cpu_n; i++) {
-				acc += fabs(delta[i]);
+		acc = 0;
+		for (size_t i = 0; i < envs.size(); i++) {
+			clWaitForEvents(1, &reads[i]);
+			clReleaseEvent(reads[i]);
+			for (cl_event event : writes[i]) clReleaseEvent(event);
+			writes[i].clear();
+			for (int j = first_row[i]; j < first_row[i] + env_rows[i]; j++) {
+				delta[j] = x[1 - cur][j] - x[cur][j];
+				if (x[cur][j] > DELTA_EPS) delta[j] /= x[cur][j];
+				acc += fabs(delta[j]);
 			}
+		}
+		for (size_t i = 0; i < envs.size(); i++) {
+			clGetEventProfilingInfo(remote_events[i], CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, nullptr);
+			clGetEventProfilingInfo(remote_events[i], CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, nullptr);
+			time += (time_end - time_start) / 1e9;
+			device_time[i] += (time_end - time_start) / 1e9;
+			clReleaseEvent(remote_events[i]);
+		}
 
-			// x1 to x0
-			ret = clEnqueueReadBuffer(cpu_env.queue, cpu_env.memObjX1, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-			check_ret(ret, "clEnqueueReadBuffer");
-			memcpy(x1, buf, sizeof(T) * cpu_n);
+		bool next = iter++ < nIter && acc > eps;
+		for (size_t i = 0; i < envs.size(); i++) {
+			clGetEventProfilingInfo(done_local[i], CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, nullptr);
+			clGetEventProfilingInfo(done_local[i], CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, nullptr);
+			time += (time_end - time_start) / 1e9;
+			device_time[i] += (time_end - time_start) / 1e9;
+			clReleaseEvent(done_local[i]);
+		}
+		std::vector<int> balanced = env_rows;
+		if (next && envs.size() > 1 && iter % REBALANCE_EVERY == 0) {
+			balanced = rebalance_rows(env_rows, device_time);
+			std::fill(device_time.begin(), device_time.end(), 0);
+		}
+		if (next && balanced != env_rows) {
+			// the local part already enqueued is for the old rows: wait, move the rows, start it again
+			// with the whole x on every device
+			for (size_t i = 0; i < envs.size(); i++) {
+				clFinish(envs[i].queue);
+				clFinish(exchange[i].transfer);
+				clReleaseEvent(local_events[i]);
+			}
+			for (size_t i = 0, row = 0; i < envs.size(); row += balanced[i], i++) {
+				migrate(i, (int)row, balanced[i]);
+				ret = clEnqueueWriteBuffer(envs[i].queue, exchange[i].memObjX[1 - cur], CL_TRUE, 0, sizeof(T) * n, x[1 - cur].data(), 0, nullptr, nullptr);
+				check_ret(ret, "EnqueueWriteBuffer X");
+				enqueue_local(i, 1 - cur);
+			}
+			cur = 1 - cur;
+			continue;
+		}
+		for (size_t i = 0; i < envs.size(); i++) {
+			if (!next) continue;
+			for (size_t p = 0; p < envs.size(); p++) {
+				if (p == i) continue;
+				cl_event event;
+				ret = clEnqueueWriteBuffer(exchange[i].transfer, exchange[i].memObjX[1 - cur], CL_FALSE, sizeof(T) * first_row[p], sizeof(T) * env_rows[p], &x[1 - cur][first_row[p]], 0, nullptr, &event);
+				check_ret(ret, "EnqueueWriteBuffer X");
+				writes[i].push_back(event);
+			}
+			clFlush(exchange[i].transfer);
+		}
+		cur = 1 - cur;
+		if (!next) break;
+	}
 
-			ret = clEnqueueWriteBuffer(cpu_env.queue, cpu_env.memObjX0, CL_TRUE, 0, sizeof(T) * n, x1, 0, nullptr, nullptr);
-			check_ret(ret, "EnqueueWriteBuffer X0");
-		} while (iter++ < nIter && acc > eps);
+	/*std::cout << "Iterations: " << iter << '\n';
+	std::cout << "Accuracy: " << acc << '\n';*/
 
-		/*std::cout << "Iterations: " << iter << '\n';
-		std::cout << "Accuracy: " << acc << '\n';*/
+	for (size_t i = 0; i < envs.size(); i++) {
+		clFinish(envs[i].queue);
+		clFinish(exchange[i].transfer);
+		// the local part enqueued after the last sweep is not used
+		clReleaseEvent(local_events[i]);
+		clReleaseKernel(exchange[i].local);
+		clReleaseKernel(exchange[i].remote);
+		clReleaseMemObject(exchange[i].memObjPartial);
+		clReleaseCommandQueue(exchange[i].transfer);
+	}
+	memcpy(x0, x[cur].data(), sizeof(T) * n);
+	memcpy(x1, x[cur].data(), sizeof(T) * n);
 
-		ret = clEnqueueReadBuffer(cpu_env.queue, cpu_env.memObjX0, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-		check_ret(ret, "clEnqueueReadBuffer");
-		memcpy(x0, buf, sizeof(T) * cpu_n);
+	full_time = omp_get_wtime() - full_time;
+	return std::make_pair(time, full_time);
+}
 
-		ret = clEnqueueReadBuffer(cpu_env.queue, cpu_env.memObjX1, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-		check_ret(ret, "clEnqueueReadBuffer");
-		memcpy(x1, buf, sizeof(T) * cpu_n);
-		
-		clFinish(cpu_env.queue);
-		full_time = omp_get_wtime() - full_time;
-		return std::make_pair(time, full_time);
+template<typename T>
+std::pair<double, double> opencl_jacobi(
+		int cpu_platform_index,
+		int gpu_platform_index,
+		int n,
+		T* a,
+		T* b,
+		T* x0,
+		T* x1,
+		T* delta,
+		char* filename,
+		char* kernelname,
+		double partition,
+		double eps,
+		int nIter) {
+	
+	int cpu_n = (int)(n * partition + 0.5);
+	int gpu_n = n - cpu_n;
+	
+	if (cpu_n % BLOCK_SIZE != 0 || gpu_n % BLOCK_SIZE != 0){
+		std::cout << "wrong size of matrices\n";
+		exit(1);
 	}
+	cl_device_id cpu, gpu;
+	initialize(cpu_platform_index, cpu);
+	initialize(gpu_platform_index, gpu);
+	std::vector<device_share> devices = { { cpu, (double)cpu_n }, { gpu, (double)gpu_n } };
+	return opencl_jacobi(devices, n, a, b, x0, x1, delta, filename, kernelname, eps, nIter);
+}
 
-	if (cpu_n == 0){
-		opencl_env gpu_env = create_env(gpu_platform_index, gpu_n, n, cpu_n, &a[cpu_n * n], b, x0, x1, delta, filename, kernelname);
-
-		do {
-			ret = clSetKernelArg(gpu_env.kernel, 2, sizeof(cl_mem), &gpu_env.memObjX0);
-			check_ret(ret, "set gpu kernel arg 2");
+// Devices of one platform sharing a context: the program is built once for all of them,
+// and every device gets its own queue and kernel.
+struct opencl_shared_env {
+	cl_context context;
+	cl_program program;
+	std::vector<cl_device_id> devices;
+	std::vector<cl_command_queue> queues;
+	std::vector<cl_kernel> kernels;
+	// parents first, then their sub-buffers; released in reverse order
+	std::vector<cl_mem> buffers;
+	opencl_shared_env(cl_context _context, cl_program _program, const std::vector<cl_device_id>& _devices)
+		: context(_context), program(_program), devices(_devices) {}
+	opencl_shared_env(opencl_shared_env&& other) noexcept
+		: context(other.context),
+		program(other.program),
+		devices(std::move(other.devices)),
+		queues(std::move(other.queues)),
+		kernels(std::move(other.kernels)),
+		buffers(std::move(other.buffers)) {
+		other.context = nullptr;
+	}
+	~opencl_shared_env() {
+		if (context == nullptr) return;
+		for (size_t i = buffers.size(); i-- > 0;) clReleaseMemObject(buffers[i]);
+		for (cl_kernel kernel : kernels) clReleaseKernel(kernel);
+		clReleaseProgram(program);
+		for (cl_command_queue queue : queues) clReleaseCommandQueue(queue);
+		clReleaseContext(context);
+	}
+};
 
-			ret = clEnqueueNDRangeKernel(gpu_env.queue, gpu_env.kernel, 1, nullptr, gpu_global_work_size, &group_size, 0, nullptr, &gpu_event);
-			clWaitForEvents(1, &gpu_event);
+cl_platform_id get_platform(cl_device_id device) {
+	cl_platform_id platform;
+	clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr);
+	return platform;
+}
 
-			clGetEventProfilingInfo(gpu_event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, nullptr);
-			clGetEventProfilingInfo(gpu_event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, nullptr);
-			time += (time_end - time_start) / 1e9;
+opencl_shared_env create_shared_env(const std::vector<cl_device_id>& devices, char* filename, const char* kernelname) {
+	std::string kernel_code = read_kernel(filename);
+	size_t kernel_len = kernel_code.size();
 
-			ret = clEnqueueReadBuffer(gpu_env.queue, gpu_env.memObjDelta, CL_TRUE, 0, sizeof(T) * n, delta, 0, nullptr, nullptr);
-			check_ret(ret, "clEnqueueReadBuffer");
+	cl_int ret;
+	// Create context
+	cl_context context = clCreateContext(nullptr, (cl_uint)devices.size(), devices.data(), nullptr, nullptr, &ret);
+	check_ret(ret, "clCreateContext");
+	// Create program
+	cl_program program = clCreateProgramWithSource(context, 1, (const char**)&kernel_code, &kernel_len, &ret);
+	check_ret(ret, "clCreateProgramWithSource");
+	// Build once for all devices
+	ret = clBuildProgram(program, (cl_uint)devices.size(), devices.data(), nullptr, nullptr, nullptr);
+	check_ret(ret, "clBuildProgram");
 
-			acc = 0;
-			for (int i = cpu_n; i < n; i++) {
-				acc += fabs(delta[i]);
-			}
+	opencl_shared_env env(context, program, devices);
+	cl_queue_properties props[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
+	for (cl_device_id device : devices) {
+		// Create queue
+		env.queues.push_back(clCreateCommandQueueWithProperties(context, device, props, &ret));
+		check_ret(ret, "clCreateCommandQueueWithProperties");
+		// Create kernel
+		env.kernels.push_back(clCreateKernel(program, kernelname, &ret));
+		check_ret(ret, "clCreateKernel");
+	}
+	return env;
+}
 
-			// x1 to x0
-			ret = clEnqueueReadBuffer(gpu_env.queue, gpu_env.memObjX1, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-			check_ret(ret, "clEnqueueReadBuffer");
-			memcpy(x1 + cpu_n, buf + cpu_n, sizeof(T) * gpu_n);
+cl_mem create_sub_buffer(opencl_shared_env& env, cl_mem buffer, size_t origin, size_t size) {
+	cl_buffer_region region = { origin, size };
+	cl_int ret;
+	cl_mem sub_buffer = clCreateSubBuffer(buffer, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &ret);
+	check_ret(ret, "clCreateSubBuffer");
+	env.buffers.push_back(sub_buffer);
+	return sub_buffer;
+}
 
-			ret = clEnqueueWriteBuffer(gpu_env.queue, gpu_env.memObjX0, CL_TRUE, 0, sizeof(T) * n, x1, 0, nullptr, nullptr);
-			check_ret(ret, "EnqueueWriteBuffer X0");
-		} while (iter++ < nIter && acc > eps);
+// Sub-buffer origins must be multiples of CL_DEVICE_MEM_BASE_ADDR_ALIGN of the device.
+bool sub_buffer_aligned(cl_device_id device, size_t origin) {
+	cl_uint align_bits;
+	clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(align_bits), &align_bits, nullptr);
+	return origin % (align_bits / 8) == 0;
+}
 
-		/*std::cout << "Iterations: " << iter << '\n';
-		std::cout << "Accuracy: " << acc << '\n';*/
+// Rows of one device in opencl_jacobi_shared and its views of the shared buffers.
+struct shared_rows {
+	size_t env;
+	size_t queue;
+	int row;
+	int rows;
+	cl_mem x[2];
+	cl_mem delta;
+};
 
-		ret = clEnqueueReadBuffer(gpu_env.queue, gpu_env.memObjX0, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-		check_ret(ret, "clEnqueueReadBuffer");
-		memcpy(x0 + cpu_n, buf + cpu_n, sizeof(T) * gpu_n);
+// Like opencl_jacobi, but devices of the same platform share one context. A, b, x and delta are
+// allocated once per platform with a sub-buffer view per device, so the devices exchange x inside
+// the context and only platforms exchange their segments through the host. Uses the <kernelname>Shared
+// kernel. Falls back to opencl_jacobi when a device's rows do not start at an aligned sub-buffer origin.
+template<typename T>
+std::pair<double, double> opencl_jacobi_shared(
+		const std::vector<device_share>& devices,
+		int n,
+		T* a,
+		T* b,
+		T* x0,
+		T* x1,
+		T* delta,
+		char* filename,
+		char* kernelname,
+		double eps,
+		int nIter) {
+	if (n % BLOCK_SIZE != 0){
+		std::cout << "wrong size of matrices\n";
+		exit(1);
+	}
+	// devices of one platform go next to each other so that they own a contiguous range of rows
+	std::vector<device_share> sorted = devices;
+	std::stable_sort(sorted.begin(), sorted.end(), [](const device_share& l, const device_share& r) {
+		return get_platform(l.device) < get_platform(r.device);
+	});
+	std::vector<int> rows = split_rows(n, sorted);
+
+	// group[i] is the first device of the platform of device i
+	std::vector<size_t> group(sorted.size());
+	std::vector<int> first_row(sorted.size());
+	for (size_t i = 0, row = 0; i < sorted.size(); row += rows[i], i++) {
+		group[i] = (i > 0 && get_platform(sorted[i].device) == get_platform(sorted[i - 1].device)) ? group[i - 1] : i;
+		first_row[i] = (int)row;
+		int offset = first_row[i] - first_row[group[i]];
+		if (!sub_buffer_aligned(sorted[i].device, sizeof(T) * offset * n) || !sub_buffer_aligned(sorted[i].device, sizeof(T) * first_row[i])) {
+			return opencl_jacobi(devices, n, a, b, x0, x1, delta, filename, kernelname, eps, nIter);
+		}
+	}
 
-		ret = clEnqueueReadBuffer(gpu_env.queue, gpu_env.memObjX1, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-		check_ret(ret, "clEnqueueReadBuffer");
-		memcpy(x1 + cpu_n, buf + cpu_n, sizeof(T) * gpu_n);
+	std::string shared_kernel = std::string(kernelname) + "Shared";
+	cl_int ret;
+	int iter = 0;
+	T acc;
+	double time = 0;
+	cl_ulong time_start;
+	cl_ulong time_end;
+	double full_time = omp_get_wtime();
 
-		clFinish(gpu_env.queue);
-		full_time = omp_get_wtime() - full_time;
-		return std::make_pair(time, full_time);
+	std::vector<opencl_shared_env> envs;
+	envs.reserve(sorted.size());
+	std::vector<shared_rows> parts;
+	std::vector<cl_mem> memObjX[2];
+	for (size_t g = 0; g < sorted.size(); g++) {
+		if (group[g] != g) continue;
+		size_t last = g;
+		while (last + 1 < sorted.size() && group[last + 1] == g) last++;
+		int group_rows = first_row[last] + rows[last] - first_row[g];
+		if (group_rows == 0) continue;
+
+		std::vector<cl_device_id> group_devices;
+		for (size_t i = g; i <= last; i++) group_devices.push_back(sorted[i].device);
+		envs.push_back(create_shared_env(group_devices, filename, shared_kernel.c_str()));
+		opencl_shared_env& env = envs.back();
+
+		// Create buffer: A holds the rows of the platform, the vectors are whole
+		cl_mem memObjA = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(T) * group_rows * n, &a[first_row[g] * n], &ret);
+		check_ret(ret, "create buffer A");
+		env.buffers.push_back(memObjA);
+		cl_mem memObjB = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(T) * n, b, &ret);
+		check_ret(ret, "create buffer B");
+		env.buffers.push_back(memObjB);
+		memObjX[0].push_back(clCreateBuffer(env.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(T) * n, x0, &ret));
+		check_ret(ret, "create buffer X0");
+		env.buffers.push_back(memObjX[0].back());
+		memObjX[1].push_back(clCreateBuffer(env.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(T) * n, x1, &ret));
+		check_ret(ret, "create buffer X1");
+		env.buffers.push_back(memObjX[1].back());
+		cl_mem memObjDelta = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY, sizeof(T) * n, nullptr, &ret);
+		check_ret(ret, "create buffer delta");
+		env.buffers.push_back(memObjDelta);
+
+		for (size_t i = g; i <= last; i++) {
+			if (rows[i] == 0) continue;
+			shared_rows part;
+			part.env = envs.size() - 1;
+			part.queue = i - g;
+			part.row = first_row[i];
+			part.rows = rows[i];
+			cl_mem subA = create_sub_buffer(env, memObjA, sizeof(T) * (first_row[i] - first_row[g]) * n, sizeof(T) * rows[i] * n);
+			cl_mem subB = create_sub_buffer(env, memObjB, sizeof(T) * first_row[i], sizeof(T) * rows[i]);
+			part.x[0] = create_sub_buffer(env, memObjX[0].back(), sizeof(T) * first_row[i], sizeof(T) * rows[i]);
+			part.x[1] = create_sub_buffer(env, memObjX[1].back(), sizeof(T) * first_row[i], sizeof(T) * rows[i]);
+			part.delta = create_sub_buffer(env, memObjDelta, sizeof(T) * first_row[i], sizeof(T) * rows[i]);
+
+			cl_mem rows_data[2] = { subA, subB };
+			ret = clEnqueueMigrateMemObjects(env.queues[part.queue], 2, rows_data, 0, 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueMigrateMemObjects");
+
+			cl_kernel kernel = env.kernels[part.queue];
+			ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &subA);
+			check_ret(ret, "set kernel arg 0");
+			ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &subB);
+			check_ret(ret, "set kernel arg 1");
+			ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &part.delta);
+			check_ret(ret, "set kernel arg 4");
+			ret = clSetKernelArg(kernel, 5, sizeof(int), &n);
+			check_ret(ret, "set kernel arg 5");
+			ret = clSetKernelArg(kernel, 6, sizeof(int), &part.row);
+			check_ret(ret, "set kernel arg 6");
+			parts.push_back(part);
+		}
 	}
 
-	opencl_env cpu_env = create_env(cpu_platform_index, cpu_n, n, 0, a, b, x0, x1, delta, filename, kernelname);
-	opencl_env gpu_env = create_env(gpu_platform_index, gpu_n, n, cpu_n, &a[cpu_n * n], b, x0, x1, delta, filename, kernelname);
-
-	
-	do{
-		ret = clSetKernelArg(cpu_env.kernel, 2, sizeof(cl_mem), &cpu_env.memObjX0);
-		check_ret(ret, "set cpu kernel arg 2");
-		ret = clSetKernelArg(gpu_env.kernel, 2, sizeof(cl_mem), &gpu_env.memObjX0);
-		check_ret(ret, "set gpu kernel arg 2");
-
-		ret = clEnqueueNDRangeKernel(cpu_env.queue, cpu_env.kernel, 1, nullptr, cpu_global_work_size, &group_size, 0, nullptr, &cpu_event);
-		ret = clEnqueueNDRangeKernel(gpu_env.queue, gpu_env.kernel, 1, nullptr, gpu_global_work_size, &group_size, 0, nullptr, &gpu_event);
-		clWaitForEvents(1, &cpu_event);
-		clWaitForEvents(1, &gpu_event);
-
-		clGetEventProfilingInfo(cpu_event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, nullptr);
-		clGetEventProfilingInfo(cpu_event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, nullptr);
-		time += (time_end - time_start) / 1e9;
-
-		clGetEventProfilingInfo(gpu_event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, nullptr);
-		clGetEventProfilingInfo(gpu_event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, nullptr);
-		time += (time_end - time_start) / 1e9;
-
-		ret = clEnqueueReadBuffer(cpu_env.queue, cpu_env.memObjDelta, CL_TRUE, 0, sizeof(T) * n, delta, 0, nullptr, nullptr);
-		check_ret(ret, "clEnqueueReadBuffer");
+	// commands the next iteration of every context has to wait for
+	std::vector<std::vector<cl_event>> waits(envs.size());
+	std::vector<cl_event> kernel_events(parts.size());
+	size_t group_size = BLOCK_SIZE;
+	int cur = 0;
+	do {
+		for (size_t p = 0; p < parts.size(); p++) {
+			opencl_shared_env& env = envs[parts[p].env];
+			cl_kernel kernel = env.kernels[parts[p].queue];
+			ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &memObjX[cur][parts[p].env]);
+			check_ret(ret, "set kernel arg 2");
+			ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &parts[p].x[1 - cur]);
+			check_ret(ret, "set kernel arg 3");
+
+			size_t global_work_size[1] = { parts[p].rows };
+			std::vector<cl_event>& wait = waits[parts[p].env];
+			ret = clEnqueueNDRangeKernel(env.queues[parts[p].queue], kernel, 1, nullptr, global_work_size, &group_size, (cl_uint)wait.size(), wait.data(), &kernel_events[p]);
+			check_ret(ret, "clEnqueueNDRangeKernel");
+			ret = clEnqueueReadBuffer(env.queues[parts[p].queue], parts[p].delta, CL_FALSE, 0, sizeof(T) * parts[p].rows, &delta[parts[p].row], 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueReadBuffer");
+		}
+		for (opencl_shared_env& env : envs) {
+			for (cl_command_queue queue : env.queues) clFinish(queue);
+		}
+		for (size_t e = 0; e < envs.size(); e++) {
+			for (cl_event event : waits[e]) clReleaseEvent(event);
+			waits[e].clear();
+		}
 
 		acc = 0;
-		for(int i = 0;i < cpu_n;i++){
-			acc += fabs(delta[i]);
+		for (size_t p = 0; p < parts.size(); p++) {
+			clGetEventProfilingInfo(kernel_events[p], CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, nullptr);
+			clGetEventProfilingInfo(kernel_events[p], CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, nullptr);
+			time += (time_end - time_start) / 1e9;
+			waits[parts[p].env].push_back(kernel_events[p]);
+			for (int j = parts[p].row; j < parts[p].row + parts[p].rows; j++) {
+				acc += fabs(delta[j]);
+			}
 		}
 
-		ret = clEnqueueReadBuffer(gpu_env.queue, gpu_env.memObjDelta, CL_TRUE, 0, sizeof(T) * n, delta, 0, nullptr, nullptr);
-		check_ret(ret, "clEnqueueReadBuffer");
-
-		for (int i = cpu_n; i < n; i++) {
-			acc += fabs(delta[i]);
+		// different platforms exchange the new segments through the host
+		if (envs.size() > 1) {
+			for (size_t p = 0; p < parts.size(); p++) {
+				opencl_shared_env& env = envs[parts[p].env];
+				ret = clEnqueueReadBuffer(env.queues[parts[p].queue], parts[p].x[1 - cur], CL_TRUE, 0, sizeof(T) * parts[p].rows, &x1[parts[p].row], 0, nullptr, nullptr);
+				check_ret(ret, "clEnqueueReadBuffer");
+			}
+			for (size_t e = 0; e < envs.size(); e++) {
+				for (size_t p = 0; p < parts.size(); p++) {
+					if (parts[p].env == e) continue;
+					cl_event event;
+					ret = clEnqueueWriteBuffer(envs[e].queues[0], memObjX[1 - cur][e], CL_FALSE, sizeof(T) * parts[p].row, sizeof(T) * parts[p].rows, &x1[parts[p].row], 0, nullptr, &event);
+					check_ret(ret, "EnqueueWriteBuffer X");
+					waits[e].push_back(event);
+				}
+				clFinish(envs[e].queues[0]);
+			}
 		}
-		
-		// x1 to x0
-		ret = clEnqueueReadBuffer(cpu_env.queue, cpu_env.memObjX1, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-		check_ret(ret, "clEnqueueReadBuffer");
-		memcpy(x1, buf, sizeof(T) * cpu_n);
-		ret = clEnqueueReadBuffer(gpu_env.queue, gpu_env.memObjX1, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-		check_ret(ret, "clEnqueueReadBuffer");
-		memcpy(x1 + cpu_n, buf + cpu_n, sizeof(T) * gpu_n);
-		
-		ret = clEnqueueWriteBuffer(cpu_env.queue, cpu_env.memObjX0, CL_TRUE, 0, sizeof(T) * n, x1, 0, nullptr, nullptr);
-		check_ret(ret, "EnqueueWriteBuffer X0");
-		ret = clEnqueueWriteBuffer(gpu_env.queue, gpu_env.memObjX0, CL_TRUE, 0, sizeof(T) * n, x1, 0, nullptr, nullptr);
-		check_ret(ret, "EnqueueWriteBuffer X0");
+		cur = 1 - cur;
 	} while (iter++ < nIter && acc > eps);
-	
+
 	/*std::cout << "Iterations: " << iter << '\n';
 	std::cout << "Accuracy: " << acc << '\n';*/
 
-	ret = clEnqueueReadBuffer(cpu_env.queue, cpu_env.memObjX0, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-	check_ret(ret, "clEnqueueReadBuffer");
-	memcpy(x0, buf, sizeof(T) * cpu_n);
-	ret = clEnqueueReadBuffer(gpu_env.queue, gpu_env.memObjX0, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-	check_ret(ret, "clEnqueueReadBuffer");
-	memcpy(x0 + cpu_n, buf + cpu_n, sizeof(T) * gpu_n);
-
-	ret = clEnqueueReadBuffer(cpu_env.queue, cpu_env.memObjX1, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-	check_ret(ret, "clEnqueueReadBuffer");
-	memcpy(x1, buf, sizeof(T) * cpu_n);
-	ret = clEnqueueReadBuffer(gpu_env.queue, gpu_env.memObjX1, CL_TRUE, 0, sizeof(T) * n, buf, 0, nullptr, nullptr);
-	check_ret(ret, "clEnqueueReadBuffer");
-	memcpy(x1 + cpu_n, buf + cpu_n, sizeof(T) * gpu_n);
-	
-	clFinish(cpu_env.queue);
-	clFinish(gpu_env.queue);
+	for (size_t p = 0; p < parts.size(); p++) {
+		opencl_shared_env& env = envs[parts[p].env];
+		ret = clEnqueueReadBuffer(env.queues[parts[p].queue], parts[p].x[cur], CL_TRUE, 0, sizeof(T) * parts[p].rows, &x1[parts[p].row], 0, nullptr, nullptr);
+		check_ret(ret, "clEnqueueReadBuffer");
+	}
+	memcpy(x0, x1, sizeof(T) * n);
+	for (size_t e = 0; e < envs.size(); e++) {
+		for (cl_event event : waits[e]) clReleaseEvent(event);
+	}
 
 	full_time = omp_get_wtime() - full_time;
 	return std::make_pair(time, full_time);
 }
-
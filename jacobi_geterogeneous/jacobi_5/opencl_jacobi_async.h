@@ -0,0 +1,148 @@
+#pragma once
+#include <CL/cl.h>
+#include <vector>
+#include <limits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "opencl_jacobi.h"
+
+// A device may start sweep k once every other device has published sweep k - ASYNC_STALENESS.
+#define ASYNC_STALENESS 4
+
+// Asynchronous (chaotic) block-Jacobi: every device sweeps its rows in a host thread of its own, at
+// its own pace, with no barrier between the devices. After a sweep a device publishes its segment of
+// x and the residual of its rows; before a sweep it uploads the newest published segments of the
+// others, whatever sweep they come from. The bounded staleness keeps a fast device at most staleness
+// sweeps ahead of the slowest one. Convergence is decided by whichever device publishes: it stops
+// everyone when the sum of the latest residuals of all blocks is <= eps. Otherwise every device
+// makes nIter sweeps. Uses the kernel of opencl_jacobi.
+// Returns the sum of the kernel times and the full solve time.
+template<typename T>
+std::pair<double, double> opencl_jacobi_async(
+		const std::vector<device_share>& devices,
+		int n,
+		T* a,
+		T* b,
+		T* x0,
+		T* x1,
+		T* delta,
+		char* filename,
+		char* kernelname,
+		double eps,
+		int nIter,
+		int staleness = ASYNC_STALENESS) {
+	if (n % BLOCK_SIZE != 0){
+		std::cout << "wrong size of matrices\n";
+		exit(1);
+	}
+	double full_time = omp_get_wtime();
+
+	std::vector<int> rows = split_rows(n, devices);
+	std::vector<int> first_row, env_rows;
+	std::vector<opencl_env> envs;
+	envs.reserve(devices.size());
+	int row = 0;
+	for (size_t i = 0; i < devices.size(); row += rows[i], i++) {
+		if (rows[i] == 0) continue;
+		envs.push_back(create_env(devices[i].device, rows[i], n, row, &a[row * n], b, x0, x1, delta, filename, kernelname));
+		first_row.push_back(row);
+		env_rows.push_back(rows[i]);
+	}
+
+	// published state: x by segments, the latest residual of every block and its number of sweeps
+	std::vector<T> published(x0, x0 + n);
+	std::vector<T> residual(envs.size(), std::numeric_limits<T>::max());
+	std::vector<int> version(envs.size(), 0);
+	std::vector<double> kernel_time(envs.size(), 0);
+	std::mutex lock;
+	std::condition_variable progress;
+	bool stop = false;
+
+	auto run = [&](size_t i) {
+		opencl_env& env = envs[i];
+		const size_t offset = sizeof(T) * first_row[i];
+		const size_t size = sizeof(T) * env_rows[i];
+		std::vector<T> own(x0 + first_row[i], x0 + first_row[i] + env_rows[i]);
+		std::vector<T> next(env_rows[i]);
+		// the versions of the other segments on the device and a staging copy of them
+		std::vector<int> seen(envs.size(), 0);
+		std::vector<T> peers(n);
+		std::vector<size_t> changed;
+		size_t group_size = BLOCK_SIZE;
+		size_t global_work_size[1] = { (size_t)env_rows[i] };
+		cl_int ret = clSetKernelArg(env.kernel, 2, sizeof(cl_mem), &env.memObjX0);
+		check_ret(ret, "set kernel arg 2");
+
+		for (int k = 0; k < nIter; k++) {
+			changed.clear();
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				progress.wait(guard, [&] {
+					if (stop) return true;
+					for (size_t p = 0; p < envs.size(); p++) {
+						if (p != i && version[p] < k - staleness) return false;
+					}
+					return true;
+				});
+				if (stop) break;
+				for (size_t p = 0; p < envs.size(); p++) {
+					if (p == i || version[p] == seen[p]) continue;
+					memcpy(&peers[first_row[p]], &published[first_row[p]], sizeof(T) * env_rows[p]);
+					seen[p] = version[p];
+					changed.push_back(p);
+				}
+			}
+			for (size_t p : changed) {
+				ret = clEnqueueWriteBuffer(env.queue, env.memObjX0, CL_FALSE, sizeof(T) * first_row[p], sizeof(T) * env_rows[p], &peers[first_row[p]], 0, nullptr, nullptr);
+				check_ret(ret, "EnqueueWriteBuffer X0");
+			}
+			cl_event event;
+			ret = clEnqueueNDRangeKernel(env.queue, env.kernel, 1, nullptr, global_work_size, &group_size, 0, nullptr, &event);
+			check_ret(ret, "clEnqueueNDRangeKernel");
+			// the own segment is the input of the next sweep as is
+			ret = clEnqueueCopyBuffer(env.queue, env.memObjX1, env.memObjX0, offset, offset, size, 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueCopyBuffer");
+			ret = clEnqueueReadBuffer(env.queue, env.memObjX1, CL_TRUE, offset, size, next.data(), 0, nullptr, nullptr);
+			check_ret(ret, "clEnqueueReadBuffer");
+
+			cl_ulong time_start, time_end;
+			clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, nullptr);
+			clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, nullptr);
+			kernel_time[i] += (time_end - time_start) / 1e9;
+			clReleaseEvent(event);
+
+			T acc = 0;
+			for (int j = 0; j < env_rows[i]; j++) {
+				T d = next[j] - own[j];
+				if (own[j] > DELTA_EPS) d /= own[j];
+				delta[first_row[i] + j] = d;
+				acc += fabs(d);
+			}
+			own.swap(next);
+
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				memcpy(&published[first_row[i]], own.data(), size);
+				residual[i] = acc;
+				version[i] = k + 1;
+				T total = 0;
+				for (T r : residual) total += r;
+				if (!(total > eps)) stop = true;
+			}
+			progress.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < envs.size(); i++) threads.emplace_back(run, i);
+	for (std::thread& thread : threads) thread.join();
+
+	memcpy(x0, published.data(), sizeof(T) * n);
+	memcpy(x1, published.data(), sizeof(T) * n);
+	double time = 0;
+	for (double t : kernel_time) time += t;
+
+	full_time = omp_get_wtime() - full_time;
+	return std::make_pair(time, full_time);
+}
@@ -0,0 +1,228 @@
+#pragma once
+#include <CL/cl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <cmath>
+#include "opencl_jacobi.h"
+
+#define CALIBRATION_CACHE "partition_cache.txt"
+#define PROBE_RUNS 3
+
+// Kernel time on a device as a function of the number of rows: t0 + per_row * rows.
+struct throughput_model {
+	double t0;
+	double per_row;
+	double time(int rows) const {
+		return rows == 0 ? 0 : t0 + per_row * rows;
+	}
+};
+
+std::string device_key(cl_device_id device) {
+	char name[128];
+	clGetDeviceInfo(device, CL_DEVICE_NAME, 128, name, nullptr);
+	return name;
+}
+
+// Sizes in the same power of two share a model.
+int shape_class(int size) {
+	return (int)std::floor(std::log2((double)size));
+}
+
+std::map<std::string, throughput_model> load_calibration() {
+	std::map<std::string, throughput_model> cache;
+	std::ifstream is(CALIBRATION_CACHE);
+	std::string line;
+	while (getline(is, line)) {
+		size_t tab = line.rfind('\t');
+		tab = line.rfind('\t', tab - 1);
+		if (tab == std::string::npos) continue;
+		throughput_model model;
+		std::istringstream(line.substr(tab + 1)) >> model.t0 >> model.per_row;
+		cache[line.substr(0, tab)] = model;
+	}
+	return cache;
+}
+
+void save_calibration(const std::string& key, const throughput_model& model) {
+	std::ofstream os(CALIBRATION_CACHE, std::ios::app);
+	os.precision(17);
+	os << key << '\t' << model.t0 << '\t' << model.per_row << '\n';
+}
+
+double event_time(cl_event event) {
+	cl_ulong time_start;
+	cl_ulong time_end;
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, nullptr);
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, nullptr);
+	return (time_end - time_start) / 1e9;
+}
+
+// Least squares line through the probe points.
+throughput_model fit_model(int probes, const int* rows, const double* times) {
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	for (int i = 0; i < probes; i++) {
+		sx += rows[i];
+		sy += times[i];
+		sxx += (double)rows[i] * rows[i];
+		sxy += rows[i] * times[i];
+	}
+	throughput_model model;
+	double det = probes * sxx - sx * sx;
+	model.per_row = det > 0 ? (probes * sxy - sx * sy) / det : 0;
+	if (model.per_row <= 0) {
+		model.per_row = sy / sx;
+	}
+	model.t0 = std::max(0.0, (sy - model.per_row * sx) / probes);
+	return model;
+}
+
+// Times a sweep on the first few block rows of A and fits the model. The sweep is the one
+// opencl_jacobi runs: <kernelname>Part over the own columns (finish == 0) and then over the rest
+// (finish == 1), the rows probed taking the place of the device's segment.
+template<typename T>
+throughput_model probe_jacobi(cl_device_id device, int n, T* a, T* b, T* x0, T* x1, T* delta, char* filename, char* kernelname) {
+	const int probes = 4;
+	int rows[probes];
+	double times[probes];
+	int max_rows = std::min(n, 16 * BLOCK_SIZE);
+	opencl_env env = create_env(device, max_rows, n, 0, a, b, x0, x1, delta, filename, kernelname);
+	size_t group_size = BLOCK_SIZE;
+	cl_int ret;
+	cl_event events[2];
+	std::string part_kernel = std::string(kernelname) + "Part";
+	cl_mem memObjPartial = clCreateBuffer(env.context, CL_MEM_READ_WRITE, sizeof(T) * max_rows, nullptr, &ret);
+	check_ret(ret, "create buffer partial");
+	const int stride = 0;
+	cl_kernel kernels[2];
+	for (int finish = 0; finish < 2; finish++) {
+		kernels[finish] = clCreateKernel(env.program, part_kernel.c_str(), &ret);
+		check_ret(ret, "clCreateKernel");
+		cl_mem args[5] = { env.memObjA, env.memObjB, env.memObjX0, env.memObjX1, env.memObjDelta };
+		for (int i = 0; i < 5; i++) {
+			ret = clSetKernelArg(kernels[finish], i, sizeof(cl_mem), &args[i]);
+			check_ret(ret, "set kernel arg");
+		}
+		ret = clSetKernelArg(kernels[finish], 5, sizeof(int), &n);
+		check_ret(ret, "set kernel arg 5");
+		ret = clSetKernelArg(kernels[finish], 6, sizeof(int), &stride);
+		check_ret(ret, "set kernel arg 6");
+		ret = clSetKernelArg(kernels[finish], 7, sizeof(cl_mem), &memObjPartial);
+		check_ret(ret, "set kernel arg 7");
+		ret = clSetKernelArg(kernels[finish], 9, sizeof(int), &finish);
+		check_ret(ret, "set kernel arg 9");
+	}
+	for (int i = 0; i < probes; i++) {
+		rows[i] = std::max(BLOCK_SIZE, (max_rows >> (probes - 1 - i)) / BLOCK_SIZE * BLOCK_SIZE);
+		size_t global_work_size[1] = { (size_t)rows[i] };
+		for (int finish = 0; finish < 2; finish++) {
+			ret = clSetKernelArg(kernels[finish], 8, sizeof(int), &rows[i]);
+			check_ret(ret, "set kernel arg 8");
+		}
+		times[i] = 0;
+		// the first launch is a warm up
+		for (int run = 0; run <= PROBE_RUNS; run++) {
+			for (int finish = 0; finish < 2; finish++) {
+				ret = clEnqueueNDRangeKernel(env.queue, kernels[finish], 1, nullptr, global_work_size, &group_size, 0, nullptr, &events[finish]);
+				check_ret(ret, "clEnqueueNDRangeKernel");
+			}
+			clWaitForEvents(2, events);
+			double time = event_time(events[0]) + event_time(events[1]);
+			clReleaseEvent(events[0]);
+			clReleaseEvent(events[1]);
+			if (run == 1 || (run > 1 && time < times[i])) times[i] = time;
+		}
+	}
+	clReleaseKernel(kernels[0]);
+	clReleaseKernel(kernels[1]);
+	clReleaseMemObject(memObjPartial);
+	return fit_model(probes, rows, times);
+}
+
+// Rows for the first device minimising the finish time of the slower one.
+int optimal_split(int n, const throughput_model& cpu, const throughput_model& gpu) {
+	int best = 0;
+	double best_time = gpu.time(n);
+	for (int cpu_n = BLOCK_SIZE; cpu_n <= n; cpu_n += BLOCK_SIZE) {
+		double time = std::max(cpu.time(cpu_n), gpu.time(n - cpu_n));
+		if (time < best_time) {
+			best_time = time;
+			best = cpu_n;
+		}
+	}
+	return best;
+}
+
+// Rows for any number of devices: every block goes to the device that would finish it first.
+std::vector<int> balanced_rows(int n, const std::vector<throughput_model>& models) {
+	std::vector<int> rows(models.size(), 0);
+	for (int block = 0; block < n / BLOCK_SIZE; block++) {
+		size_t best = 0;
+		for (size_t i = 1; i < models.size(); i++) {
+			if (models[i].time(rows[i] + BLOCK_SIZE) < models[best].time(rows[best] + BLOCK_SIZE)) best = i;
+		}
+		rows[best] += BLOCK_SIZE;
+	}
+	return rows;
+}
+
+template<typename T>
+throughput_model calibrated_model(cl_device_id device, int n, T* a, T* b, T* x0, T* x1, T* delta, char* filename, char* kernelname) {
+	// keyed by the probed kernel, models of the whole-row kernel in old caches are not reused
+	std::string key = device_key(device) + '\t' + kernelname + "Part n" + std::to_string(shape_class(n));
+
+	std::map<std::string, throughput_model> cache = load_calibration();
+	auto it = cache.find(key);
+	if (it != cache.end()) return it->second;
+
+	throughput_model model = probe_jacobi(device, n, a, b, x0, x1, delta, filename, kernelname);
+	save_calibration(key, model);
+	return model;
+}
+
+// Partition to pass to opencl_jacobi. Models are probed once per (device, kernel, shape class)
+// and cached in CALIBRATION_CACHE for the next runs.
+template<typename T>
+double calibrate_partition(
+		int cpu_platform_index,
+		int gpu_platform_index,
+		int n,
+		T* a,
+		T* b,
+		T* x0,
+		T* x1,
+		T* delta,
+		char* filename,
+		char* kernelname) {
+	cl_device_id cpu_device, gpu_device;
+	initialize(cpu_platform_index, cpu_device);
+	initialize(gpu_platform_index, gpu_device);
+	throughput_model cpu = calibrated_model(cpu_device, n, a, b, x0, x1, delta, filename, kernelname);
+	throughput_model gpu = calibrated_model(gpu_device, n, a, b, x0, x1, delta, filename, kernelname);
+	return (double)optimal_split(n, cpu, gpu) / n;
+}
+
+// Calibrated weights for the N-device opencl_jacobi.
+template<typename T>
+std::vector<device_share> calibrate_shares(
+		const std::vector<cl_device_id>& devices,
+		int n,
+		T* a,
+		T* b,
+		T* x0,
+		T* x1,
+		T* delta,
+		char* filename,
+		char* kernelname) {
+	std::vector<throughput_model> models;
+	for (cl_device_id device : devices) {
+		models.push_back(calibrated_model(device, n, a, b, x0, x1, delta, filename, kernelname));
+	}
+	std::vector<int> rows = balanced_rows(n, models);
+	std::vector<device_share> shares;
+	for (size_t i = 0; i < devices.size(); i++) {
+		shares.push_back({ devices[i], (double)rows[i] });
+	}
+	return shares;
+}